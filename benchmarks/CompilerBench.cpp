@@ -0,0 +1,393 @@
+// Measures compiler throughput per stage (Lexer, Parser, BytecodeCompiler) on large inputs.
+//
+// usage: CompilerBench [options] [<program.he>...]
+//
+//   --functions=<n>        number of functions in the generated source (default 20000)
+//   --depth=<n>            nesting depth of the deeply nested functions (default 32)
+//   --strings=<n>          number of distinct string literals in the string table (default 5000)
+//   --string-length=<n>    length of each string literal (default 80)
+//   --runs=<n>             compile every input this many times and report the median (default 3)
+//   --threads=<n>          bytecode compiler threads, 0 for one per hardware thread (default 0)
+//   --write-source=<file>  write the generated source to a file, e.g. to run it with HeliumExe, and exit
+//   --batch                compile the program files and the units they import as a whole with BatchCompiler,
+//                          on one thread and on --threads threads, and report the end-to-end time of both
+//   -I<directory>          module path for --batch
+//   -o<output.json>        also write the results as JSON
+//
+// Without any program files a synthetic source is generated from the options above. The generator is
+// deterministic, so results are comparable between runs and between builds.
+
+#include <Helium/Compiler/BatchCompiler.hpp>
+#include <Helium/Compiler/Compiler.hpp>
+#include <Helium/Runtime/Code.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using namespace Helium;
+    using fmt::format;
+
+    struct GeneratorOptions
+    {
+        size_t numFunctions = 20000;
+        size_t depth = 32;
+        size_t numStrings = 5000;
+        size_t stringLength = 80;
+    };
+
+    struct Input
+    {
+        std::string name;
+        std::string source;
+    };
+
+    struct StageTimes
+    {
+        double lexerMs, parserMs, bytecodeCompilerMs, totalMs;
+    };
+
+    std::string makeStringLiteral(size_t index, size_t length)
+    {
+        auto text = format("string {} ", index);
+
+        for (size_t i = 0; text.size() < length; i++)
+            text += static_cast<char>('a' + (index + i) % 26);
+
+        return "'" + text + "'";
+    }
+
+    // Every function calls its predecessor so that the call graph spans the whole module.
+    // One in a hundred functions nests `if` blocks `depth` levels deep; the rest mix the common statement kinds.
+    std::string generateSource(GeneratorOptions const& options)
+    {
+        std::string source = "-- generated by CompilerBench\n";
+
+        source += "strings = (\n";
+
+        for (size_t i = 0; i < options.numStrings; i++) {
+            source += "    " + makeStringLiteral(i, options.stringLength);
+            source += (i + 1 < options.numStrings) ? ",\n" : "\n";
+        }
+
+        source += ");\n\n";
+
+        source += "class Accumulator {\n"
+                  "    member total = 0;\n"
+                  "\n"
+                  "    add(value)\n"
+                  "        total = total + value;\n"
+                  "}\n\n";
+
+        for (size_t i = 0; i < options.numFunctions; i++) {
+            source += format("function f{}(a, b) {{\n", i);
+
+            if (i % 100 == 99) {
+                std::string indent = "    ";
+
+                for (size_t level = 0; level < options.depth; level++) {
+                    source += format("{}if a > {}\n", indent, level);
+                    indent += "    ";
+                }
+
+                source += format("{}return a + b;\n", indent);
+                source += "\n    return 0;\n";
+            }
+            else {
+                source += format("    local x = a * {} + b;\n"
+                                 "    local object = ${{ index: {}, label: 'f{}', items: (x, a, b) }};\n"
+                                 "\n"
+                                 "    if x > {}\n"
+                                 "        x = x - b;\n"
+                                 "    else\n"
+                                 "        x = x + object.index;\n"
+                                 "\n"
+                                 "    for i = 0, i = i + 1 while i < 4\n"
+                                 "        object.items.add(i);\n"
+                                 "\n",
+                                 i % 13, i, i, i % 1000);
+
+                if (options.numStrings > 0)
+                    source += format("    local s = {};\n", makeStringLiteral(i % options.numStrings, options.stringLength));
+
+                if (i > 0)
+                    source += format("    return f{}(x, b) + object.items.length;\n", i - 1);
+                else
+                    source += "    return x + object.items.length;\n";
+            }
+
+            source += "}\n\n";
+        }
+
+        source += "accumulator = Accumulator();\n"
+                  "accumulator.add(f0(1, 2));\n"
+                  "assert accumulator.total > 0;\n";
+
+        if (options.numStrings > 0)
+            source += format("assert strings.length == {};\n", options.numStrings);
+
+        return source;
+    }
+
+    size_t countLines(std::string const& source)
+    {
+        return std::count(source.begin(), source.end(), '\n') + 1;
+    }
+
+    double getMedian(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        auto n = values.size();
+        return (n % 2 == 1) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    }
+
+    double toMs(std::chrono::nanoseconds duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    // Returns a JSON object (without a trailing newline)
+    std::string runBenchmark(Input const& input, size_t numRuns, unsigned numThreads)
+    {
+        std::vector<double> lexerMs, parserMs, bytecodeCompilerMs, endToEndMs;
+        CompileStatistics statistics;
+        size_t numInstructions = 0, numFunctions = 0, stringPoolBytes = 0;
+
+        for (size_t run = 0; run < numRuns; run++) {
+            Compiler compiler;
+            compiler.setNumThreads(numThreads);
+            auto module = compiler.compileString(input.name, input.source, &statistics);
+
+            lexerMs.push_back(toMs(statistics.lexerTime));
+            parserMs.push_back(toMs(statistics.parserTime));
+            bytecodeCompilerMs.push_back(toMs(statistics.bytecodeCompilerTime));
+
+            numInstructions = module->code.size();
+            numFunctions = module->functions.size();
+            stringPoolBytes = 0;
+
+            for (auto const& string : module->stringPool)
+                stringPoolBytes += string.size();
+
+            // Without statistics, i.e. exactly what a host pays for
+            auto start = std::chrono::steady_clock::now();
+            Compiler plainCompiler;
+            plainCompiler.setNumThreads(numThreads);
+            plainCompiler.compileString(input.name, input.source);
+            endToEndMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        auto numLines = countLines(input.source);
+        StageTimes median {getMedian(lexerMs), getMedian(parserMs), getMedian(bytecodeCompilerMs), getMedian(endToEndMs)};
+
+        std::cout << format("{}: {} lines, {} bytes, {} tokens\n", input.name, numLines, input.source.size(),
+                            statistics.numTokens);
+        std::cout << format("  {:<18} {:>10.2f} ms {:>12.0f} lines/s\n", "lexer", median.lexerMs,
+                            numLines / median.lexerMs * 1000);
+        std::cout << format("  {:<18} {:>10.2f} ms {:>12.0f} lines/s\n", "parser", median.parserMs,
+                            numLines / median.parserMs * 1000);
+        std::cout << format("  {:<18} {:>10.2f} ms {:>12.0f} lines/s\n", "bytecode compiler", median.bytecodeCompilerMs,
+                            numLines / median.bytecodeCompilerMs * 1000);
+        std::cout << format("  {:<18} {:>10.2f} ms {:>12.0f} lines/s\n", "compileString", median.totalMs,
+                            numLines / median.totalMs * 1000);
+        std::cout << format("  AST memory: {} bytes ({} including overhead)\n", statistics.astMemoryUsage,
+                            statistics.astMemoryUsageInclOverhead);
+        std::cout << format("  module: {} functions, {} instructions, {} bytes of strings\n\n", numFunctions,
+                            numInstructions, stringPoolBytes);
+
+        return format(R"({{"name": "{}", "runs": {}, "lines": {}, "bytes": {}, "tokens": {}, )"
+                      R"("lexerMs": {:.3f}, "parserMs": {:.3f}, "bytecodeCompilerMs": {:.3f}, "compileStringMs": {:.3f}, )"
+                      R"("astMemoryBytes": {}, "astMemoryBytesInclOverhead": {}, )"
+                      R"("functions": {}, "instructions": {}, "stringPoolBytes": {}}})",
+                      input.name, numRuns, numLines, input.source.size(), statistics.numTokens,
+                      median.lexerMs, median.parserMs, median.bytecodeCompilerMs, median.totalMs,
+                      statistics.astMemoryUsage, statistics.astMemoryUsageInclOverhead,
+                      numFunctions, numInstructions, stringPoolBytes);
+    }
+
+    // Returns a JSON object (without a trailing newline), or an empty string if any unit failed to compile
+    std::string runBatchBenchmark(std::vector<std::filesystem::path> const& entryFiles,
+                                  std::vector<std::filesystem::path> const& modulePaths, size_t numRuns, unsigned numThreads)
+    {
+        std::vector<double> sequentialMs, parallelMs;
+        size_t numUnits = 0, numInstructions = 0;
+
+        for (size_t run = 0; run < numRuns; run++) {
+            for (auto threads : {1u, numThreads}) {
+                BatchCompiler compiler;
+                compiler.setNumThreads(threads);
+
+                for (auto const& path : modulePaths)
+                    compiler.addModulePath(path);
+
+                std::vector<BatchCompiler::Unit> units;
+                auto start = std::chrono::steady_clock::now();
+                auto succeeded = compiler.compile(entryFiles, units);
+                auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                if (!succeeded) {
+                    for (auto const& unit : units) {
+                        if (!unit.module)
+                            fprintf(stderr, "%s: %s\n", unit.fileName.string().c_str(), unit.error.c_str());
+                    }
+
+                    return {};
+                }
+
+                (threads == 1 ? sequentialMs : parallelMs).push_back(elapsed);
+
+                numUnits = units.size();
+                numInstructions = 0;
+
+                for (auto const& unit : units)
+                    numInstructions += unit.module->code.size();
+            }
+        }
+
+        auto sequential = getMedian(sequentialMs), parallel = getMedian(parallelMs);
+
+        std::cout << format("batch: {} units, {} instructions\n", numUnits, numInstructions);
+        std::cout << format("  {:<18} {:>10.2f} ms\n", "1 thread", sequential);
+        std::cout << format("  {:<18} {:>10.2f} ms {:>10.2f}x\n", format("{} threads", numThreads), parallel,
+                            sequential / parallel);
+
+        return format(R"({{"name": "batch", "runs": {}, "units": {}, "instructions": {}, "threads": {}, )"
+                      R"("sequentialMs": {:.3f}, "parallelMs": {:.3f}}})",
+                      numRuns, numUnits, numInstructions, numThreads, sequential, parallel);
+    }
+
+    bool parseSizeOption(const char* arg, const char* name, size_t* value_out)
+    {
+        auto length = strlen(name);
+
+        if (strncmp(arg, name, length) != 0 || arg[length] != '=')
+            return false;
+
+        *value_out = std::stoul(arg + length + 1);
+        return true;
+    }
+
+    void printUsage()
+    {
+        fprintf(stderr, "usage: CompilerBench [--functions=<n>] [--depth=<n>] [--strings=<n>] [--string-length=<n>]\n"
+                        "                     [--runs=<n>] [--threads=<n>] [--write-source=<file>] [-o<output.json>] [<program.he>...]\n"
+                        "       CompilerBench --batch [-I<directory>...] [--runs=<n>] [--threads=<n>] [-o<output.json>] <program.he>...\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    GeneratorOptions generatorOptions;
+    size_t numRuns = 3, numThreads = 0;
+    std::string outputFileName, sourceOutputFileName;
+    std::vector<Input> inputs;
+    bool batch = false;
+    std::vector<std::filesystem::path> modulePaths, entryFiles;
+
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+
+        if (parseSizeOption(arg, "--functions", &generatorOptions.numFunctions)
+                || parseSizeOption(arg, "--depth", &generatorOptions.depth)
+                || parseSizeOption(arg, "--strings", &generatorOptions.numStrings)
+                || parseSizeOption(arg, "--string-length", &generatorOptions.stringLength)
+                || parseSizeOption(arg, "--runs", &numRuns)
+                || parseSizeOption(arg, "--threads", &numThreads))
+            continue;
+        else if (strncmp(arg, "--write-source=", 15) == 0)
+            sourceOutputFileName = arg + 15;
+        else if (strncmp(arg, "-o", 2) == 0)
+            outputFileName = arg + 2;
+        else if (strcmp(arg, "--batch") == 0)
+            batch = true;
+        else if (strncmp(arg, "-I", 2) == 0)
+            modulePaths.emplace_back(arg + 2);
+        else if (arg[0] == '-') {
+            printUsage();
+            return 1;
+        }
+        else if (batch)
+            entryFiles.emplace_back(arg);
+        else {
+            std::ifstream file(arg);
+
+            if (!file) {
+                fprintf(stderr, "CompilerBench: cannot read %s\n", arg);
+                return 1;
+            }
+
+            std::stringstream buffer;
+            buffer << file.rdbuf();
+            inputs.push_back({arg, buffer.str()});
+        }
+    }
+
+    numRuns = std::max<size_t>(numRuns, 1);
+
+    if (batch) {
+        if (entryFiles.empty()) {
+            printUsage();
+            return 1;
+        }
+
+        auto numBatchThreads = numThreads ? static_cast<unsigned>(numThreads) : std::thread::hardware_concurrency();
+        auto json = runBatchBenchmark(entryFiles, modulePaths, numRuns, std::max(numBatchThreads, 1u));
+
+        if (json.empty())
+            return 1;
+
+        if (!outputFileName.empty())
+            std::ofstream(outputFileName) << "{\n  \"inputs\": [\n    " << json << "\n  ]\n}\n";
+
+        return 0;
+    }
+
+    if (inputs.empty()) {
+        auto source = generateSource(generatorOptions);
+
+        if (!sourceOutputFileName.empty()) {
+            std::ofstream(sourceOutputFileName) << source;
+            return 0;
+        }
+
+        inputs.push_back({format("generated(functions={},depth={},strings={})", generatorOptions.numFunctions,
+                                 generatorOptions.depth, generatorOptions.numStrings), std::move(source)});
+    }
+
+    std::string json = "{\n  \"inputs\": [\n";
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        try {
+            json += "    " + runBenchmark(inputs[i], numRuns, static_cast<unsigned>(numThreads));
+        }
+        catch (CompileException const& ex) {
+            fprintf(stderr, "%s: %s - %s\n", inputs[i].name.c_str(), ex.name.c_str(), ex.desc.c_str());
+            return 1;
+        }
+
+        json += (i + 1 < inputs.size()) ? ",\n" : "\n";
+    }
+
+    json += "  ]\n}\n";
+
+    if (!outputFileName.empty())
+        std::ofstream(outputFileName) << json;
+
+    return 0;
+}
+
+void helium_assert_fail(const char* expression, const char* file, int line) {
+    fprintf(stderr, "helium_assert_fail: %s\n\tfile %s, line %d\n\n", expression, file, line);
+    abort();
+}
@@ -0,0 +1,236 @@
+// Runs Helium benchmark programs and reports the results as JSON.
+//
+// usage: HeliumBench [-n<runs>] [-o<output.json>] <program.he>...
+//
+// Each program is compiled once and then executed <runs> times, every time in a fresh VM. On POSIX systems every
+// program runs in a separate process, so that the reported peak RSS belongs to that program alone.
+
+#include <Helium/Compiler/Compiler.hpp>
+#include <Helium/Compiler/Optimizer.hpp>
+#include <Helium/Runtime/RuntimeFunctions.hpp>
+#include <Helium/Runtime/VM.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HELIUM_BENCH_FORK 1
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+namespace Helium
+{
+    void registerBuiltinFunctions(VM* vm);
+}
+
+namespace
+{
+    using namespace Helium;
+    using fmt::format;
+
+    uint64_t getPeakRssKiB()
+    {
+#if defined(HELIUM_BENCH_FORK)
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+        return usage.ru_maxrss / 1024;          // bytes on macOS
+#else
+        return usage.ru_maxrss;
+#endif
+#elif defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters {};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize / 1024;
+#else
+        return 0;
+#endif
+    }
+
+    std::string escapeJson(std::string_view string)
+    {
+        std::string escaped;
+
+        for (char c : string) {
+            if (c == '"' || c == '\\')
+                escaped += { '\\', c };
+            else if (static_cast<unsigned char>(c) < 0x20)
+                escaped += format("\\u{:04x}", c);
+            else
+                escaped += c;
+        }
+
+        return escaped;
+    }
+
+    std::string describeException(Value ex)
+    {
+        if (ex.type == ValueType::string)
+            return ex.string->text;
+
+        ValueRef desc;
+
+        if (ex.type == ValueType::object
+                && RuntimeFunctions::getProperty(ex, VMString::fromCString("desc"), &desc, false)
+                && desc->type == ValueType::string)
+            return desc->string->text;
+
+        return format("exception of type {}", to_string(ex.type));
+    }
+
+    // Returns a JSON object (without a trailing newline)
+    std::string runBenchmark(std::filesystem::path const& path, size_t numRuns)
+    {
+        auto name = escapeJson(path.stem().u8string());
+
+        std::unique_ptr<Module> module;
+
+        try {
+            Compiler compiler;
+            module = compiler.compileFile(path);
+        }
+        catch (CompileException const& ex) {
+            return format(R"({{"name": "{}", "error": "{}"}})", name, escapeJson(ex.name + " - " + ex.desc));
+        }
+
+        Optimizer::optimize(*module);
+
+        std::vector<double> timesMs;
+        uint64_t numInstructions = 0;
+        GcStats gcStats;
+
+        for (size_t run = 0; run < numRuns; run++) {
+            VM vm;
+            registerBuiltinFunctions(&vm);
+
+            auto moduleIndex = vm.loadModule(module.get());
+
+            ActivationContext ctx(&vm);
+            ActivationScope scope(ctx);
+
+            auto start = std::chrono::steady_clock::now();
+
+            if (ctx.callMainFunction(moduleIndex))
+                vm.execute(ctx);
+
+            timesMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+            if (ctx.getState() == ActivationContext::raisedException)
+                return format(R"({{"name": "{}", "error": "{}"}})", name, escapeJson(describeException(ctx.getException())));
+
+            numInstructions = vm.getNumInstructionsExecuted();
+            gcStats = vm.getGcStats();
+        }
+
+        std::sort(timesMs.begin(), timesMs.end());
+        auto medianMs = (numRuns % 2 == 1) ? timesMs[numRuns / 2] : (timesMs[numRuns / 2 - 1] + timesMs[numRuns / 2]) / 2;
+
+        return format(R"({{"name": "{}", "runs": {}, "medianMs": {:.3f}, "minMs": {:.3f}, "maxMs": {:.3f}, )"
+                      R"("instructions": {}, "peakRssKiB": {}, )"
+                      R"("gc": {{"collections": {}, "valuesCollected": {}, "timeMs": {:.3f}}}}})",
+                      name, numRuns, medianMs, timesMs.front(), timesMs.back(),
+                      numInstructions, getPeakRssKiB(),
+                      gcStats.numCollections, gcStats.numValuesCollected,
+                      std::chrono::duration<double, std::milli>(gcStats.totalTime).count());
+    }
+
+    std::string runBenchmarkIsolated(std::filesystem::path const& path, size_t numRuns)
+    {
+#if defined(HELIUM_BENCH_FORK)
+        int fds[2];
+
+        if (pipe(fds) != 0)
+            return runBenchmark(path, numRuns);
+
+        std::cout.flush();
+        auto pid = fork();
+
+        if (pid == 0) {
+            close(fds[0]);
+
+            auto result = runBenchmark(path, numRuns);
+            auto written = write(fds[1], result.data(), result.size());
+            _exit(written == static_cast<ssize_t>(result.size()) ? 0 : 1);
+        }
+
+        close(fds[1]);
+
+        std::string result;
+        char buffer[4096];
+        ssize_t numRead;
+
+        while ((numRead = read(fds[0], buffer, sizeof(buffer))) > 0)
+            result.append(buffer, numRead);
+
+        close(fds[0]);
+
+        int status = 0;
+
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || result.empty())
+            return format(R"({{"name": "{}", "error": "benchmark process crashed"}})", escapeJson(path.stem().u8string()));
+
+        return result;
+#else
+        return runBenchmark(path, numRuns);
+#endif
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t numRuns = 5;
+    std::string outputFileName;
+    std::vector<std::filesystem::path> programs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-n", 2) == 0)
+            numRuns = std::max(std::stoul(argv[i] + 2), 1ul);
+        else if (strncmp(argv[i], "-o", 2) == 0)
+            outputFileName = argv[i] + 2;
+        else
+            programs.emplace_back(argv[i]);
+    }
+
+    if (programs.empty()) {
+        fprintf(stderr, "usage: HeliumBench [-n<runs>] [-o<output.json>] <program.he>...\n");
+        return 1;
+    }
+
+    std::sort(programs.begin(), programs.end());
+
+    std::string json = "{\n  \"benchmarks\": [\n";
+
+    for (size_t i = 0; i < programs.size(); i++) {
+        fprintf(stderr, "%s...\n", programs[i].u8string().c_str());
+
+        json += "    " + runBenchmarkIsolated(programs[i], numRuns);
+        json += (i + 1 < programs.size()) ? ",\n" : "\n";
+    }
+
+    json += "  ]\n}\n";
+
+    if (!outputFileName.empty())
+        std::ofstream(outputFileName) << json;
+    else
+        std::cout << json;
+
+    return 0;
+}
+
+void helium_assert_fail(const char* expression, const char* file, int line) {
+    fprintf(stderr, "helium_assert_fail: %s\n\tfile %s, line %d\n\n", expression, file, line);
+    abort();
+}
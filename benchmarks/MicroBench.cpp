@@ -0,0 +1,415 @@
+// Micro-benchmarks for the runtime primitives that VM-level optimizations touch.
+//
+// usage: MicroBench [-r<repetitions>] [-t<batch-ms>] [-o<output.json>] [filter]...
+//
+// Every benchmark is first calibrated so that one batch takes at least <batch-ms> milliseconds, then the batch is
+// repeated <repetitions> times. The median time per operation is reported together with its spread (the median
+// absolute deviation, as a percentage of the median); compare medians only when the spread is small.
+// Only benchmarks whose name contains one of the filters are run.
+
+#include <Helium/Compiler/Compiler.hpp>
+#include <Helium/Config.hpp>
+#include <Helium/Memory/LinearAllocator.hpp>
+#include <Helium/Runtime/Code.hpp>
+#include <Helium/Runtime/Hash.hpp>
+#include <Helium/Runtime/InlineStack.hpp>
+#include <Helium/Runtime/Value.hpp>
+#include <Helium/Runtime/VM.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using namespace Helium;
+    using fmt::format;
+
+    // Keep the compiler from optimizing away a computation whose result is otherwise unused
+    template <typename Type>
+    void doNotOptimize(Type const& value)
+    {
+#if defined(__GNUC__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        static volatile char sink;
+        sink = *reinterpret_cast<volatile const char*>(&value);
+#endif
+    }
+
+    struct Options
+    {
+        size_t numRepetitions = 15;
+        double batchMs = 20;
+        std::vector<std::string> filters;
+    };
+
+    struct Result
+    {
+        std::string name;
+        const char* unit;
+        double medianNs, minNs, spreadPercent;
+    };
+
+    class Runner
+    {
+    public:
+        explicit Runner(Options const& options) : options(options) {
+        }
+
+        // `body(numIterations)` performs numIterations iterations, each consisting of `opsPerIteration` operations
+        void run(std::string const& name, const char* unit, size_t opsPerIteration,
+                 std::function<void(size_t numIterations)> const& body) {
+            if (!isSelected(name))
+                return;
+
+            size_t numIterations = 1;
+
+            for (;;) {
+                if (timeBatch(body, numIterations) >= options.batchMs * 1e6 || numIterations >= (size_t(1) << 40))
+                    break;
+
+                numIterations *= 2;
+            }
+
+            std::vector<double> nsPerOp;
+
+            for (size_t i = 0; i < options.numRepetitions; i++)
+                nsPerOp.push_back(timeBatch(body, numIterations) / (numIterations * opsPerIteration));
+
+            auto median = getMedian(nsPerOp);
+
+            std::vector<double> deviations;
+
+            for (auto ns : nsPerOp)
+                deviations.push_back(std::fabs(ns - median));
+
+            Result result {name, unit, median, *std::min_element(nsPerOp.begin(), nsPerOp.end()),
+                           100.0 * getMedian(deviations) / median};
+
+            std::cout << format("{:<40} {:>12.2f} {:>12.2f} {:>7.1f}% {:>14.0f} {}/s\n", result.name,
+                                result.medianNs, result.minNs, result.spreadPercent, 1e9 / result.medianNs,
+                                result.unit);
+            std::cout.flush();
+
+            results.push_back(std::move(result));
+        }
+
+        std::vector<Result> const& getResults() const { return results; }
+
+    private:
+        bool isSelected(std::string const& name) const {
+            if (options.filters.empty())
+                return true;
+
+            return std::any_of(options.filters.begin(), options.filters.end(),
+                               [&name](std::string const& filter) { return name.find(filter) != std::string::npos; });
+        }
+
+        static double timeBatch(std::function<void(size_t)> const& body, size_t numIterations) {
+            auto start = std::chrono::steady_clock::now();
+            body(numIterations);
+            return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        static double getMedian(std::vector<double> values) {
+            std::sort(values.begin(), values.end());
+            auto n = values.size();
+            return (n % 2 == 1) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+        }
+
+        Options const& options;
+        std::vector<Result> results;
+    };
+
+    std::vector<std::string> makePropertyNames(size_t count)
+    {
+        std::vector<std::string> names;
+
+        for (size_t i = 0; i < count; i++)
+            names.push_back(format("property{}", i));
+
+        return names;
+    }
+
+    std::vector<VMString> makeVMStrings(std::vector<std::string> const& names)
+    {
+        std::vector<VMString> strings;
+
+        for (auto const& name : names)
+            strings.push_back(VMString::fromCString(name.c_str()));
+
+        return strings;
+    }
+
+    // Deterministic source text of roughly `numLines` lines, mixing the common statement kinds
+    std::string makeSource(size_t numFunctions, size_t* numLines_out)
+    {
+        std::string source;
+        size_t numLines = 0;
+
+        for (size_t i = 0; i < numFunctions; i++) {
+            source += format("function f{}(a, b) {{\n"
+                             "    local x = a + b * {};\n"
+                             "    local list = (x, 'item {}', a);\n"
+                             "    local object = ${{ key: x, other: list }};\n"
+                             "\n"
+                             "    if x > {}\n"
+                             "        x = x - b;\n"
+                             "    else\n"
+                             "        x = x + object.key;\n"
+                             "\n"
+                             "    for i = 0, i = i + 1 while i < 10\n"
+                             "        list.add(i * x);\n"
+                             "\n"
+                             "    return x + list.length;\n"
+                             "}}\n"
+                             "\n", i, i % 7, i, i * 3);
+            numLines += 16;
+        }
+
+        source += "assert f0(1, 2) > 0;\n";
+        numLines++;
+
+        *numLines_out = numLines;
+        return source;
+    }
+
+    void benchmarkValues(Runner& runner, VM& vm)
+    {
+        auto run = [&runner](const char* name, Value value) {
+            runner.run(format("value/reference-release/{}", name), "op", 1, [value](size_t numIterations) {
+                for (size_t i = 0; i < numIterations; i++) {
+                    Value copy = value.reference();
+                    doNotOptimize(copy);
+                    copy.release();
+                }
+            });
+        };
+
+        ValueRef integer {Value::newInteger(42)};
+        ValueRef string {Value::newString("benchmark")};
+        ValueRef list {Value::newList(&vm, 4)};
+        ValueRef object {Value::newObject(&vm)};
+
+        run("integer", integer);
+        run("string", string);
+        run("list", list);
+        run("object", object);
+    }
+
+    void benchmarkObjects(Runner& runner, VM& vm)
+    {
+        for (size_t numMembers : {1, 4, 16, 64}) {
+            auto names = makePropertyNames(numMembers);
+            auto strings = makeVMStrings(names);
+
+            ValueRef object {Value::newObject(&vm)};
+
+            for (size_t i = 0; i < numMembers; i++)
+                object->objectSetProperty(strings[i], Value::newInteger(i), false);
+
+            // The last member is the worst case for the linear search.
+            // objectFindProperty itself is private; objectCloneProperty is the thinnest public wrapper around it.
+            auto last = strings.back();
+
+            runner.run(format("object/find-property/{}", numMembers), "op", 1, [&object, last](size_t numIterations) {
+                for (size_t i = 0; i < numIterations; i++) {
+                    Value value = object->objectCloneProperty(last);
+                    doNotOptimize(value);
+                    value.release();
+                }
+            });
+
+            runner.run(format("object/set-property/{}", numMembers), "op", 1, [&object, last](size_t numIterations) {
+                for (size_t i = 0; i < numIterations; i++)
+                    object->objectSetProperty(last, Value::newInteger(i), false);
+            });
+
+            // Building an object from scratch also covers member array growth and key allocation
+            runner.run(format("object/build/{}", numMembers), "member", numMembers,
+                       [&vm, &strings](size_t numIterations) {
+                for (size_t i = 0; i < numIterations; i++) {
+                    ValueRef object {Value::newObject(&vm)};
+
+                    for (size_t j = 0; j < strings.size(); j++)
+                        object->objectSetProperty(strings[j], Value::newInteger(j), false);
+                }
+            });
+        }
+    }
+
+    void benchmarkLists(Runner& runner, VM& vm)
+    {
+        for (size_t numItems : {16, 1024, 65536}) {
+            runner.run(format("list/set-item-growth/{}", numItems), "item", numItems,
+                       [&vm, numItems](size_t numIterations) {
+                for (size_t i = 0; i < numIterations; i++) {
+                    ValueRef list {Value::newList(&vm, 0)};
+
+                    for (size_t j = 0; j < numItems; j++)
+                        list->listSetItem(j, Value::newInteger(j));
+                }
+            });
+        }
+    }
+
+    void benchmarkHash(Runner& runner)
+    {
+        for (size_t length : {8, 32, 256}) {
+            std::string string(length, 'x');
+
+            for (size_t i = 0; i < length; i++)
+                string[i] = static_cast<char>('a' + i % 26);
+
+            runner.run(format("hash/from-string/{}", length), "op", 1, [&string](size_t numIterations) {
+                for (size_t i = 0; i < numIterations; i++) {
+                    doNotOptimize(string.data());
+                    doNotOptimize(Hash::fromString(string.data(), string.size()));
+                }
+            });
+        }
+    }
+
+    void benchmarkInlineStack(Runner& runner)
+    {
+        enum { depth = 16 };
+
+        ValueRef string {Value::newString("benchmark")};
+
+        runner.run("inline-stack/push-pop", "op", depth, [&string](size_t numIterations) {
+            InlineStack<Value> stack;
+
+            for (size_t i = 0; i < numIterations; i++) {
+                for (size_t j = 0; j < depth; j++)
+                    stack.push(string.reference());
+
+                for (size_t j = 0; j < depth; j++)
+                    doNotOptimize(stack.pop());
+            }
+        });
+
+        runner.run("inline-stack/push-pop-borrowed", "op", depth, [&string](size_t numIterations) {
+            InlineStack<Value> stack;
+
+            for (size_t i = 0; i < numIterations; i++) {
+                for (size_t j = 0; j < depth; j++)
+                    stack.pushBorrowed(string);
+
+                for (size_t j = 0; j < depth; j++)
+                    doNotOptimize(stack.popForReading());
+            }
+        });
+    }
+
+    void benchmarkLinearAllocator(Runner& runner)
+    {
+        enum { numAllocations = 1024 };
+
+        for (size_t size : {16, 64, 256}) {
+            runner.run(format("linear-allocator/allocate/{}", size), "op", numAllocations,
+                       [size](size_t numIterations) {
+                for (size_t i = 0; i < numIterations; i++) {
+                    LinearAllocator allocator(LinearAllocator::kDefaultBlockSize);
+
+                    for (size_t j = 0; j < numAllocations; j++)
+                        doNotOptimize(allocator.allocate(size, alignof(std::max_align_t)));
+                }
+            });
+        }
+    }
+
+    void benchmarkCompiler(Runner& runner)
+    {
+        size_t numLines;
+        auto source = makeSource(200, &numLines);
+
+        runner.run("compiler/compile-string", "line", numLines, [&source](size_t numIterations) {
+            for (size_t i = 0; i < numIterations; i++) {
+                Compiler compiler;
+                auto module = compiler.compileString("microbench", source);
+                doNotOptimize(module);
+            }
+        });
+    }
+
+    void writeJson(std::ostream& os, std::vector<Result> const& results)
+    {
+        os << "{\n  \"benchmarks\": [\n";
+
+        for (size_t i = 0; i < results.size(); i++) {
+            auto const& result = results[i];
+
+            os << format(R"(    {{"name": "{}", "unit": "{}", "medianNs": {:.3f}, "minNs": {:.3f}, "spreadPercent": {:.2f}}})",
+                         result.name, result.unit, result.medianNs, result.minNs, result.spreadPercent);
+            os << ((i + 1 < results.size()) ? ",\n" : "\n");
+        }
+
+        os << "  ]\n}\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    std::string outputFileName;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-r", 2) == 0)
+            options.numRepetitions = std::max(std::stoul(argv[i] + 2), 1ul);
+        else if (strncmp(argv[i], "-t", 2) == 0)
+            options.batchMs = std::stod(argv[i] + 2);
+        else if (strncmp(argv[i], "-o", 2) == 0)
+            outputFileName = argv[i] + 2;
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: MicroBench [-r<repetitions>] [-t<batch-ms>] [-o<output.json>] [filter]...\n");
+            return 1;
+        }
+        else
+            options.filters.emplace_back(argv[i]);
+    }
+
+#if HELIUM_TRACE_VALUES
+    // Every reference would be logged, and the trace needs a context that a bare VM does not set up
+    fprintf(stderr, "MicroBench: value tracing is enabled in this build; use a Release build\n");
+    return 1;
+#endif
+
+    Runner runner(options);
+
+    std::cout << format("{:<40} {:>12} {:>12} {:>8} {:>14}\n", "benchmark", "median ns", "min ns", "spread",
+                        "throughput");
+
+    {
+        VM vm;
+
+        benchmarkValues(runner, vm);
+        benchmarkObjects(runner, vm);
+        benchmarkLists(runner, vm);
+    }
+
+    benchmarkHash(runner);
+    benchmarkInlineStack(runner);
+    benchmarkLinearAllocator(runner);
+    benchmarkCompiler(runner);
+
+    if (!outputFileName.empty()) {
+        std::ofstream file(outputFileName);
+        writeJson(file, runner.getResults());
+    }
+
+    return 0;
+}
+
+void helium_assert_fail(const char* expression, const char* file, int line) {
+    fprintf(stderr, "helium_assert_fail: %s\n\tfile %s, line %d\n\n", expression, file, line);
+    abort();
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Helium/Runtime/Code.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Helium
+{
+    /**
+     * Compiles a program made of many units, with one Compiler per worker thread.
+     *
+     * Units are discovered from the entry files through their imports. A dependency of the form `Unit::function`
+     * (see Module::dependencies) refers to the unit `Unit.he`, and `A::B::function` to `A/B.he`; these are looked up
+     * in the module paths in the order they were added. Dependencies that do not name a unit file, such as native
+     * functions, are left for the VM to resolve. Every unit is compiled once, however many units import it.
+     *
+     * Units are handed out to the workers as soon as they are discovered, but the result does not depend on the
+     * scheduling: units are returned breadth-first from the entry files, in the order of their imports.
+     */
+    class BatchCompiler
+    {
+        public:
+            struct Unit
+            {
+                std::filesystem::path fileName;
+                std::unique_ptr<Module> module;     // null if the unit failed to compile
+                std::string error;                  // empty on success
+            };
+
+            void addModulePath(std::filesystem::path path) { modulePaths.push_back(std::move(path)); }
+            void setDebugInformation(bool enabled) { withDebugInformation = enabled; }
+
+            // 0 means one per hardware thread
+            void setNumThreads(unsigned count) { numThreads = count; }
+
+            // Returns false if any of the units failed to compile; the others are returned either way
+            bool compile(std::vector<std::filesystem::path> const& entryFiles, std::vector<Unit>& units_out) const;
+
+            // Returns the file a dependency refers to, if it names a unit that exists in one of the module paths
+            std::optional<std::filesystem::path> resolveImport(std::string_view dependency) const;
+
+        private:
+            std::vector<std::filesystem::path> modulePaths;
+            bool withDebugInformation = true;
+            unsigned numThreads = 0;
+    };
+}
@@ -13,6 +13,8 @@ namespace Helium
     class BytecodeCompiler
     {
         public:
-            static std::unique_ptr<Module> compile(AstNodeScript& tree, bool withDebugInformation = true, std::shared_ptr<std::string> unitNameString = 0 );
+            // Functions are compiled on up to numThreads threads; the resulting module does not depend on the number
+            static std::unique_ptr<Module> compile(AstNodeScript& tree, bool withDebugInformation = true, std::shared_ptr<std::string> unitNameString = 0,
+                                                   unsigned numThreads = 1 );
     };
 }
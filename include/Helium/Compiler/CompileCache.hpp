@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Helium/Runtime/Code.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+namespace Helium
+{
+    /**
+     * An on-disk cache of compiled modules, so that unchanged scripts skip the compiler front end.
+     *
+     * Entries are binary modules (see Module::save) keyed by an xxHash of the unit name and source, Compiler::version
+     * and caller-defined flags (e.g. whether the module was optimized before being stored). Entries are written to a
+     * temporary file and renamed into place, so a directory can be shared by concurrent processes. Unreadable or
+     * outdated entries are treated as misses and overwritten.
+     */
+    class CompileCache
+    {
+        public:
+            explicit CompileCache(std::filesystem::path directory, uint32_t flags = 0);
+
+            // Returns nullptr on a miss
+            std::unique_ptr<Module> load(std::filesystem::path const& fileName, std::string_view source) const;
+
+            // Failing to store an entry is not an error; the module will simply be compiled again next time
+            void store(std::filesystem::path const& fileName, std::string_view source, Module const& module) const;
+
+            std::filesystem::path getEntryPath(std::filesystem::path const& fileName, std::string_view source) const;
+
+        private:
+            std::filesystem::path directory;
+            uint32_t flags;
+    };
+}
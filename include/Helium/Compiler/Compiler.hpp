@@ -2,6 +2,7 @@
 
 #include <Helium/Assert.hpp>
 
+#include <chrono>
 #include <filesystem>
 #include <memory>
 #include <stack>
@@ -54,15 +55,37 @@ namespace Helium
         }
     };
 
+    // Per-stage measurements of a single compileString call.
+    // Lexing is interleaved with parsing, so lexerTime comes from a separate tokenizing pass over the source, and
+    // parserTime is the time spent parsing minus lexerTime.
+    struct CompileStatistics
+    {
+        std::chrono::nanoseconds lexerTime {}, parserTime {}, bytecodeCompilerTime {};
+        size_t numTokens = 0;
+        size_t astMemoryUsage = 0, astMemoryUsageInclOverhead = 0;
+    };
+
     class Compiler
     {
         std::stack<std::shared_ptr<std::string>> currentUnitName;
+        bool withDebugInformation = true;
+        unsigned numThreads = 0;
 
         public:
             enum { version = 1000 };
 
+            // Without debug information, modules carry no unit name or line tables, and stack traces only list
+            // function names
+            void setDebugInformation(bool enabled) { withDebugInformation = enabled; }
+
+            // Number of threads generating bytecode for the functions of a module; 0 means one per hardware thread.
+            // Large modules only; the output is identical for any number of threads.
+            void setNumThreads(unsigned count) { numThreads = count; }
+
             std::unique_ptr<Module> compileFile(std::filesystem::path const& fileName);
-            std::unique_ptr<Module> compileString(std::filesystem::path const& fileName, std::string_view script);
+            // If statistics_out is not null, it receives per-stage timings. This costs an extra lexer pass.
+            std::unique_ptr<Module> compileString(std::filesystem::path const& fileName, std::string_view script,
+                                                  CompileStatistics* statistics_out = nullptr);
 
             // TODO: nuke
             std::string getCurrentUnit() const { return *currentUnitName.top().get(); }
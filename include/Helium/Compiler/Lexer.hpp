@@ -3,6 +3,9 @@
 #include <Helium/Compiler/Compiler.hpp>
 #include <Helium/Runtime/Value.hpp>
 
+#include <string>
+#include <string_view>
+
 namespace Helium
 {
     // TODO: rename Token_number, Token_integer
@@ -89,6 +92,7 @@ namespace Helium
         Token_MAX
     };
 
+    // A plain value owned by the Lexer; see Lexer::readToken for how long it stays valid
     struct Token
     {
         TokenType type;
@@ -96,7 +100,8 @@ namespace Helium
         unsigned indent;
         bool usedFixedIndent;       // TODO: what is this for?
 
-        std::string text;
+        // Identifiers and strings. Points into the source, or into a Lexer buffer if escapes had to be decoded.
+        std::string_view text;
         Int_t integerValue;
         Real_t realValue;
         bool boolValue;
@@ -104,62 +109,36 @@ namespace Helium
         // Keep this for debugging
         void print()
         {
-            printf( "%3i:%02i - [%02i]: '%s'\n", span.start.line, span.start.column, type, text.c_str() );
-        }
-
-    protected:
-        Token( TokenType type, SourceSpan span, unsigned indent, int fixedIndent,
-               std::string&& text, Int_t integerValue, Real_t realValue, bool boolValue )
-                : type( type ), span( span ), indent( indent ), text( std::move(text) ), integerValue(integerValue),
-                  realValue(realValue), boolValue(boolValue)
-        {
-            if ( fixedIndent < 0 )
-                usedFixedIndent = false;
-            else
-            {
-                indent = fixedIndent;
-                usedFixedIndent = true;
-            }
-        }
-    };
-
-    struct TokenLiteralInteger : public Token {
-        TokenLiteralInteger(TokenType type, SourceSpan span, unsigned int indent, Int_t integerValue)
-                : Token(type, span, indent, -1, "", integerValue, 0, false) {
-        }
-    };
-
-    struct TokenLiteralReal : public Token {
-        TokenLiteralReal(TokenType type, SourceSpan span, unsigned int indent, Real_t realValue)
-        : Token(type, span, indent, -1, "", 0, realValue, false) {
-        }
-    };
-
-    struct TokenLiteralString : public Token {
-        TokenLiteralString(TokenType type, SourceSpan span, unsigned int indent, int fixedIndent, std::string&& text)
-                : Token(type, span, indent, fixedIndent, std::move(text), 0, 0.0, false) {
-        }
-    };
-
-    struct TokenPrimitive : public Token {
-        TokenPrimitive(TokenType type, SourceSpan span, unsigned int indent)
-                : Token(type, span, indent, -1, "", 0, 0.0, false) {
+            printf( "%3i:%02i - [%02i]: '%.*s'\n", span.start.line, span.start.column, type,
+                    static_cast<int>(text.size()), text.data() );
         }
     };
 
     class Lexer
     {
+        // A token stays valid until this many more tokens have been read
+        static constexpr size_t tokenRingSize = 4;
+
         SourcePoint point, nextPoint;
         const char* source_start;
         const char* source, * end;
         unsigned indent;
         int fixedIndent;
 
+        Token tokens[tokenRingSize];
+        std::string decodedText[tokenRingSize];     // text of the token in the same slot, if it is not in the source
+        size_t numTokensRead;
+
         private:
             char read();
             bool read( char what );
             bool read( const char* what, size_t length );
 
+            Token* newToken( TokenType type, SourcePoint start );
+
+            // Cleared buffer for the text of the token that newToken will return next
+            std::string& getDecodedTextBuffer();
+
             void parseError(const char* message);
 
         public:
@@ -167,6 +146,8 @@ namespace Helium
             Lexer( Compiler* compiler, const char* fileName, const std::string_view script );
 
             std::string getTextOfSpan(SourceSpan span);
+
+            // Returns nullptr at the end of the input. Tokens live in a small ring buffer, so no allocation is needed.
             Token* readToken();
             void setFixedIndent( unsigned fixedIndent ) { this->fixedIndent = fixedIndent; }
     };
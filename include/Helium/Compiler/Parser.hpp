@@ -13,7 +13,6 @@ namespace Helium
     {
         public:
             Parser(Compiler* compiler, Lexer* lexer, LinearAllocator& astAllocator);
-            ~Parser();
 
         pool_ptr<AstNodeScript> parseScript();
 
@@ -14,3 +14,18 @@
 #define HELIUM_TRACE_GC 0
 #define HELIUM_TRACE_VALUES 0
 #endif
+
+// Per-opcode execution statistics (see OpcodeStats); set by CMake
+#ifndef HELIUM_OPCODE_STATS
+#define HELIUM_OPCODE_STATS 0
+#endif
+
+// Baseline JIT (see Jit); can be turned off with the CMake option JIT=OFF.
+// Opcode statistics are collected per interpreted instruction, so they rule it out.
+#ifndef HELIUM_WITH_JIT
+#if defined(__x86_64__) && defined(__linux__) && !HELIUM_OPCODE_STATS
+#define HELIUM_WITH_JIT 1
+#else
+#define HELIUM_WITH_JIT 0
+#endif
+#endif
@@ -0,0 +1,73 @@
+#ifndef HELIUM_MEMORY_POOLALLOCATOR_HPP
+#define HELIUM_MEMORY_POOLALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Helium {
+
+// Allocator for many small blocks of a single size.
+// Blocks are carved out of chunks, each of which keeps its own free list and count of blocks in use. Chunks are
+// aligned to their size, so the chunk of a block is found by masking its address. A chunk whose blocks have all been
+// freed goes back to the system; one of them is kept as a spare, so that a pool which keeps emptying and refilling
+// does not allocate a chunk every time.
+// Not thread-safe.
+class PoolAllocator {
+public:
+    enum { kDefaultBlocksPerChunk = 256 };
+
+    // The chunk size is rounded up to a power of two, so there may be more blocks per chunk than requested
+    PoolAllocator(size_t blockSize, size_t blocksPerChunk = kDefaultBlocksPerChunk);
+    ~PoolAllocator();
+
+    PoolAllocator(const PoolAllocator&) = delete;
+    void operator=(const PoolAllocator&) = delete;
+
+    // Returns nullptr if out of memory
+    void* allocate();
+    void deallocate(void* block);
+
+    size_t getBlockSize() const { return blockSize; }
+    size_t getMemoryUsage() const { return memoryUsage; }
+    size_t getMemoryUsageInclOverhead() const { return memoryUsageInclOverhead; }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Chunk {
+        Chunk* prev;
+        Chunk* next;
+
+        FreeBlock* freeList;
+        uint8_t* bumpPointer;           // blocks from here on have never been handed out
+        size_t numUsedBlocks;
+    };
+
+    // Keeps the blocks 16-byte aligned
+    static constexpr size_t chunkHeaderSize = (sizeof(Chunk) + 15) & ~size_t(15);
+
+    // Chunks with some free blocks, and chunks without any
+    struct ChunkList {
+        Chunk* first = nullptr;
+
+        void insert(Chunk* chunk);
+        void remove(Chunk* chunk);
+    };
+
+    Chunk* getChunk(void* block) const;
+    Chunk* newChunk();
+    void freeChunk(Chunk* chunk);
+
+    size_t blockSize, blocksPerChunk, chunkSize;
+    size_t memoryUsage = 0;
+    size_t memoryUsageInclOverhead = 0;
+
+    ChunkList availableChunks, fullChunks;
+    Chunk* spareChunk = nullptr;
+};
+
+}
+
+#endif
@@ -4,21 +4,46 @@
 #include <Helium/Runtime/InlineStack.hpp>
 #include <Helium/Runtime/Value.hpp>
 
+#include <chrono>
 #include <deque>
 #include <functional>
 #include <stack>
+#include <string>
 #include <vector>
 
 namespace Helium
 {
+    struct FunctionHotness;
     struct Instruction;
-    struct InstructionOrigin;
+    struct JitFunction;
     struct VMModule;
     struct ScriptFunction;
     class VM;
 
     typedef unsigned int ModuleIndex_t;
 
+    // Accumulated by the VM while function statistics are enabled
+    struct FunctionStats {
+        uint64_t numCalls = 0;
+        std::chrono::nanoseconds inclusiveTime {0};     // recursive calls are only counted once
+        std::chrono::nanoseconds exclusiveTime {0};     // excludes time spent in callees
+
+        unsigned numActiveCalls = 0;
+    };
+
+    // A script function on the call stack, as reported by ActivationContext::walkStack
+    struct StackFrameInfo {
+        VMModule const* module;
+        ScriptFunction const* function;
+        CodeAddr_t pc;                  // the instruction being executed
+
+        // Looked up in the function's line table; -1 without debug information
+        int getLine() const;
+    };
+
+    // "function (unit:line)", leaving out what the module has no debug information for
+    std::string to_string(StackFrameInfo const& frame);
+
     // A stack frame. Always corresponds to a script function.
     struct Frame {
         const ScriptFunction* scriptFunction;
@@ -33,6 +58,16 @@ namespace Helium
         ModuleIndex_t moduleIndex;
         CodeAddr_t pc;
 
+        FunctionHotness* hotness;
+
+        // Set once the frame runs compiled code: on entry, or at a loop header (see FunctionHotness)
+        JitFunction* jitFunction = nullptr;
+
+        // Only set if function statistics were enabled when the function was entered
+        FunctionStats* stats = nullptr;
+        std::chrono::steady_clock::time_point callStartTime;
+        std::chrono::nanoseconds calleeTime;
+
         Frame() {}
 
 #if HELIUM_TRACE_VALUES
@@ -68,7 +103,7 @@ namespace Helium
         public:
             enum State { ready, suspended, returnedValue, raisedException };
 
-            explicit ActivationContext(VM* vm) : vm(vm) {}
+            explicit ActivationContext(VM* vm);
             ~ActivationContext();
             ActivationContext(const ActivationContext&) = delete;
             void operator=(const ActivationContext&) = delete;
@@ -80,7 +115,7 @@ namespace Helium
             static ActivationContext* setCurrent(ActivationContext* ac_or_null);
 
             Value getException() { return exception; }
-            Instruction* getLastExecutedInstruction();          // return nullptr if none applicable
+            Instruction const* getLastExecutedInstruction();          // return nullptr if none applicable
             State getState() const { return state; }
             VM* getVM() { return vm; }
 
@@ -99,10 +134,13 @@ namespace Helium
             void raiseException(ValueRef&& val);
             void raiseOutOfMemoryException(const char* where);
 
-            void walkStack(std::function<void(InstructionOrigin const&)> const& callback);
+            // Innermost frame first
+            void walkStack(std::function<void(StackFrameInfo const&)> const& callback);
 
         private:
             bool enterFunction(const ScriptFunction& function, size_t numArgs);
+            void leaveFunction();
+            void callNativeFunctionWithStats(NativeFunction func, NativeFunctionContext& ctx);
 
             State state = ready;
             VM* vm;
@@ -117,6 +155,8 @@ namespace Helium
 
             ValueRef exception;
 
+        friend class HeapSnapshot;
+        friend class Jit;
         friend class NativeFunctionContext;
         friend class VM;
     };
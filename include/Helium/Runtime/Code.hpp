@@ -3,6 +3,7 @@
 #include <Helium/Runtime/Value.hpp>
 
 #include <functional>
+#include <limits>
 #include <memory>
 #include <span.hpp>
 #include <string>
@@ -72,6 +73,7 @@ namespace Helium
             // Locals
             getLocal,       // push local (int)
             setLocal,       // pop local[INTEGER]
+            clearLocal,     // release local[INTEGER]; stack[top], which may borrow from it, keeps its own reference
 
             // Indexed access
             getIndexed,     // pop index; pop range; push range[index]
@@ -88,6 +90,10 @@ namespace Helium
             new_list,   // create a list from top values on the stack
             new_obj,    // create a new empty object
 
+            // Operators - Register forms of the binary operators (see RegisterOperands)
+            add_r, div_r, mod_r, mul_r, sub_r,
+            eq_r, grtr_r, grtrEq_r, less_r, lessEq_r, neq_r,
+
             numValidOpcodes,
 
             // Special (valid only during compilation)
@@ -105,8 +111,31 @@ namespace Helium
 
     struct SwitchTable
     {
+        // How op_switch finds the case matching a value; chosen by classify() based on the case values
+        enum class Kind
+        {
+            linear,             // generic comparison against every case; for mixed, nil, boolean and real cases
+            denseInteger,       // integer cases covering a small range, indexed directly by (value - minimum)
+            sparseInteger,      // other integer cases, binary-searched
+            stringHash,         // string cases, in an open-addressed hash table keyed by their xxHash
+        };
+
         std::vector<ValueRef> cases;
         std::vector<CodeAddr_t> handlers;       // size: cases.size() + 1 -- the last one is the 'else' handler
+
+        // Derived from `cases` by classify() and never serialized. Cases are referred to by index, so handlers can
+        // be relocated without reclassifying.
+        Kind kind = Kind::linear;
+        Int_t minimum = 0;                                      // denseInteger
+        std::vector<uint32_t> caseIndices;                      // denseInteger, stringHash; cases.size() if unused
+        std::vector<std::pair<Int_t, uint32_t>> sortedCases;    // sparseInteger: (value, case index) by value
+        std::vector<Hash_t> caseHashes;                         // stringHash
+
+        // Must be called after the cases have been filled in
+        void classify();
+
+        // Returns the index of the first case equal to `value`, or cases.size() (the 'else' handler)
+        size_t findCase(Value value) const;
     };
 
     enum class OperandType
@@ -117,10 +146,37 @@ namespace Helium
         localIndex,
         none,
         real,
+        registers,
         string,
         switchTable,
     };
 
+    // Operands of the register forms of binary operators, packed into Instruction::integer.
+    // A register form reads its operands straight from locals, so `a = b + c` takes one instruction instead of
+    // getLocal, getLocal, op_add and setLocal. The optimizer produces them; the compiler only emits stack code.
+    struct RegisterOperands
+    {
+        static constexpr LocalIndex_t toStack = std::numeric_limits<LocalIndex_t>::max();
+
+        // Constants are stored in 31 bits
+        static constexpr Int_t minConstant = -(Int_t(1) << 30), maxConstant = (Int_t(1) << 30) - 1;
+
+        LocalIndex_t destination;       // toStack to push the result instead
+        LocalIndex_t left;
+        bool rightIsConstant;
+        int32_t right;                  // a local, or an integer constant
+
+        static RegisterOperands unpack(int64_t packed) {
+            return RegisterOperands{static_cast<LocalIndex_t>(packed), static_cast<LocalIndex_t>(packed >> 16),
+                                    ((packed >> 32) & 1) != 0, static_cast<int32_t>(packed >> 33)};
+        }
+
+        int64_t pack() const {
+            return static_cast<int64_t>(destination | uint64_t(left) << 16 | uint64_t(rightIsConstant) << 32
+                                        | static_cast<uint64_t>(int64_t(right)) << 33);
+        }
+    };
+
     struct InstructionDesc
     {
         Opcode_t opcode;
@@ -131,32 +187,15 @@ namespace Helium
         static const InstructionDesc* getByOpcode(Opcode_t opcode);
     };
 
-    struct InstructionOrigin
-    {
-        std::shared_ptr<std::string> unit, function;
-        int line;
-
-        InstructionOrigin() : line( -2 )
-        {
-        }
-
-        InstructionOrigin( const InstructionOrigin* other )
-                : line( other->line )
-        {
-            unit = other->unit;
-            function = other->function;
-        }
-    };
-
     using ReadCallback = std::function<size_t(span<std::byte>)>;
     using WriteCallback = std::function<size_t(span<const std::byte>)>;
 
     // TODO: this structure is cache-awful, and should be completely redone (or disposed of)
+    // Source lines live in the line tables of ScriptFunction, so instructions are trivially copyable.
     struct Instruction
     {
         // <8-byte header
         Opcode_t opcode;          // keep
-        InstructionOrigin* origin = nullptr;    // move into another structure for cache reasons
 
         // 8-byte union
         int64_t integer = 0;                    // keep in union
@@ -166,13 +205,31 @@ namespace Helium
         CodeAddr_t functionIndex;
         size_t stringIndex;                     // TODO: in loaded code, resolve to direct pointer
 
-        Instruction() = default;
-        Instruction( const Instruction& other );
-        ~Instruction();
-
         static bool needsRelocation( Opcode_t opcode );
     };
 
+    // Maps the instructions of a function to source lines. An entry covers the instructions from its offset up to the
+    // next entry, so a run of instructions on the same line takes up a single entry.
+    struct LineTable
+    {
+        struct Entry
+        {
+            CodeAddr_t offset;          // relative to ScriptFunction::start
+            int line;
+        };
+
+        std::vector<Entry> entries;     // sorted by offset
+
+        // Offsets must be added in increasing order
+        void addLine(CodeAddr_t offset, int line);
+
+        // Returns -1 if there is no line information for the offset
+        int getLine(CodeAddr_t offset) const;
+
+        // Shifts the following entries back after the optimizer has removed the instruction at `offset`
+        void removeInstruction(CodeAddr_t offset, CodeAddr_t newFunctionLength);
+    };
+
     // TODO: track SourceSpan ?
     struct ScriptFunction
     {
@@ -192,10 +249,17 @@ namespace Helium
         CodeAddr_t start, length;
 
         std::vector<Eh> exceptionHandlers;
+
+        LineTable lineTable;    // empty without debug information
     };
 
     struct Module
     {
+        // Bump on any incompatible change to the binary format (see Code.cpp)
+        static constexpr uint16_t binaryFormatVersion = 2;
+
+        std::string unitName;                   // debug information; empty if stripped or unknown
+
         std::vector<std::string> dependencies;
         std::vector<ScriptFunction> functions;
         std::vector<Instruction*> code;         // aaaaaaaaaaaaaaaaaa
@@ -204,5 +268,16 @@ namespace Helium
         std::vector<std::shared_ptr<SwitchTable>> switchTables;
 
         ~Module();
+
+        // Check whether data starting with `header` is a binary module (as opposed to source code)
+        static bool isBinaryModule(span<const std::byte> header);
+
+        // Serialize into the binary module format. The unit name and line tables are only included with debug
+        // information.
+        // Returns false if the callback did not accept all of the data.
+        bool save(WriteCallback const& write, bool withDebugInformation = true) const;
+
+        // Returns nullptr if the data is not a well-formed module of the current format version
+        static std::unique_ptr<Module> load(ReadCallback const& read);
     };
 }
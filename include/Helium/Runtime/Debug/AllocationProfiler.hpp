@@ -0,0 +1,55 @@
+#ifndef HELIUM_RUNTIME_DEBUG_ALLOCATIONPROFILER_HPP
+#define HELIUM_RUNTIME_DEBUG_ALLOCATIONPROFILER_HPP
+
+#include <Helium/Runtime/Value.hpp>
+
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+
+namespace Helium {
+
+/**
+ * Sampling heap profiler. While an instance exists, roughly every `sampleInterval`-th allocated byte triggers a
+ * sample, which is attributed to the script stack of the current ActivationContext.
+ *
+ * Between samples, an allocation only costs a subtraction, so it is fine to keep the profiler enabled in
+ * production. At most one instance may exist at a time; the profiler is not thread-safe.
+ */
+class AllocationProfiler {
+public:
+    static constexpr size_t defaultSampleInterval = 512 * 1024;
+
+    explicit AllocationProfiler(size_t sampleInterval = defaultSampleInterval);
+    ~AllocationProfiler();
+
+    AllocationProfiler(const AllocationProfiler&) = delete;
+    void operator=(const AllocationProfiler&) = delete;
+
+    static void recordAllocation(ValueType type, size_t size) {
+        if (active != nullptr) {
+            active->bytesUntilNextSample -= static_cast<int64_t>(size);
+
+            if (active->bytesUntilNextSample <= 0)
+                active->takeSample(type);
+        }
+    }
+
+    // One line per distinct stack, in the format expected by flamegraph.pl:
+    //   outermost-function (unit:line);...;innermost-function (unit:line);type estimated-bytes
+    void writeFoldedStacks(std::ostream& os) const;
+
+private:
+    void takeSample(ValueType type);
+
+    static AllocationProfiler* active;
+
+    const int64_t sampleInterval;
+    int64_t bytesUntilNextSample;
+
+    std::unordered_map<std::string, uint64_t> bytesByStack;
+};
+
+}
+
+#endif
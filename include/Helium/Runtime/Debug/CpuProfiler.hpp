@@ -0,0 +1,81 @@
+#ifndef HELIUM_RUNTIME_DEBUG_CPUPROFILER_HPP
+#define HELIUM_RUNTIME_DEBUG_CPUPROFILER_HPP
+
+#include <Helium/Config.hpp>
+#include <Helium/Runtime/ActivationContext.hpp>
+
+#include <atomic>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace Helium {
+
+/**
+ * Sampling profiler for script code. While an instance exists, VM::execute takes a sample of the current script
+ * stack every `sampleInterval` executed instructions.
+ *
+ * Samples are written into a fixed-size single-producer, single-consumer ring buffer. The VM thread is the
+ * producer; collect() is the consumer and may run on another thread, e.g. to drain the buffer periodically.
+ * When the buffer is full, new samples are dropped (and counted). At most one instance may exist at a time.
+ *
+ * Samples refer to script functions and are only resolved to names and lines by collect(), so collect() must not be
+ * called after the profiled modules have been unloaded.
+ */
+class CpuProfiler {
+public:
+    static constexpr size_t defaultSampleInterval = 10000;
+    static constexpr size_t defaultCapacity = 4096;
+    static constexpr size_t maxStackDepth = 32;
+
+    explicit CpuProfiler(size_t sampleInterval = defaultSampleInterval, size_t capacity = defaultCapacity);
+    ~CpuProfiler();
+
+    CpuProfiler(const CpuProfiler&) = delete;
+    void operator=(const CpuProfiler&) = delete;
+
+    static bool isActive() { return active != nullptr; }
+
+    // Called by the VM for every executed instruction
+    static void tick(ActivationContext& ctx) {
+        if (--active->instructionsUntilNextSample == 0)
+            active->takeSample(ctx);
+    }
+
+    // Move samples from the ring buffer into the aggregated stacks
+    void collect();
+
+    size_t getNumDroppedSamples() const { return numDroppedSamples.load(std::memory_order_relaxed); }
+
+    // One line per distinct stack, in the format expected by flamegraph.pl:
+    //   outermost-function (unit:line);...;innermost-function (unit:line) number-of-samples
+    // Call collect() first.
+    void writeFoldedStacks(std::ostream& os) const;
+
+private:
+    struct Sample {
+        // Innermost first
+        StackFrameInfo frames[maxStackDepth];
+        size_t depth;
+        bool truncated;
+    };
+
+    void takeSample(ActivationContext& ctx);
+
+    static CpuProfiler* active;
+
+    const size_t sampleInterval;
+    size_t instructionsUntilNextSample;
+
+    const size_t capacity;
+    std::unique_ptr<Sample[]> ring;
+    std::atomic<size_t> readIndex {0}, writeIndex {0};
+    std::atomic<size_t> numDroppedSamples {0};
+
+    std::unordered_map<std::string, size_t> samplesByStack;
+};
+
+}
+
+#endif
@@ -14,10 +14,10 @@ public:
     ~GcTrace();
 
 #if HELIUM_TRACE_GC
-    static void beginCollectGarbage(GarbageCollectReason reason, int numInstructionsSinceLastCollect);
+    static void beginCollectGarbage(GarbageCollectReason reason, uint64_t numInstructionsSinceLastCollect);
     static void endCollectGarbage(int numValuesCollected);
 #else
-    static void beginCollectGarbage(GarbageCollectReason reason, int numInstructionsSinceLastCollect) {}
+    static void beginCollectGarbage(GarbageCollectReason reason, uint64_t numInstructionsSinceLastCollect) {}
     static void endCollectGarbage(int numValuesCollected) {}
 #endif
 };
@@ -0,0 +1,69 @@
+#ifndef HELIUM_RUNTIME_DEBUG_HEAPSNAPSHOT_HPP
+#define HELIUM_RUNTIME_DEBUG_HEAPSNAPSHOT_HPP
+
+#include <Helium/Runtime/VM.hpp>
+
+#include <iosfwd>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Helium {
+
+/**
+ * A graph of all heap values reachable from a VM, together with their retained sizes.
+ *
+ * Node 0 is a synthetic root. Its children are the VM's global object, every live ActivationContext (with its
+ * frames, locals and operand stack) and any possible cycle roots that are not reachable otherwise (that is,
+ * garbage which is waiting for the next collection).
+ *
+ * The retained size of a node is the amount of memory that would be released if the node was freed; it is
+ * computed from the dominator tree of the graph.
+ */
+class HeapSnapshot {
+public:
+    enum class NodeType : uint8_t {
+        root,
+        activationContext,
+        frame,
+        list,
+        object,
+        string,
+    };
+
+    static constexpr uint32_t noNode = UINT32_MAX;
+
+    struct Edge {
+        uint32_t to;
+        std::string name;
+    };
+
+    struct Node {
+        NodeType type;
+        uint64_t shallowSize;
+        uint64_t retainedSize;
+        uint32_t dominator;
+        std::vector<Edge> edges;
+    };
+
+    static HeapSnapshot capture(VM& vm);
+
+    // Binary format; see HeapSnapshot.cpp
+    bool save(std::ostream& os) const;
+    static std::optional<HeapSnapshot> load(std::istream& is);
+
+    void printSummary(std::ostream& os, size_t maxEntries) const;
+
+    std::vector<Node> const& getNodes() const { return nodes; }
+
+private:
+    void computeRetainedSizes();
+
+    std::vector<Node> nodes;
+};
+
+std::string_view to_string(HeapSnapshot::NodeType t);
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef HELIUM_RUNTIME_DEBUG_OPCODESTATS_HPP
+#define HELIUM_RUNTIME_DEBUG_OPCODESTATS_HPP
+
+#include <Helium/Config.hpp>
+#include <Helium/Runtime/Code.hpp>
+
+#include <iosfwd>
+
+namespace Helium {
+
+/**
+ * Per-opcode execution counts, cumulative cycles and opcode pair frequencies.
+ *
+ * VM::execute only records these when built with HELIUM_OPCODE_STATS (CMake option OPCODE_STATS), because the
+ * bookkeeping roughly doubles the cost of dispatch. The counters are global and not thread-safe.
+ */
+class OpcodeStats {
+public:
+    // TSC on x86, nanoseconds elsewhere
+    static uint64_t readCycleCounter();
+
+    static void record(Opcode_t opcode, uint64_t cycles) {
+        counts[opcode]++;
+        totalCycles[opcode] += cycles;
+
+        if (previousOpcode != Opcodes::numValidOpcodes)
+            pairCounts[previousOpcode][opcode]++;
+
+        previousOpcode = opcode;
+    }
+
+    static void reset();
+    static void writeReport(std::ostream& os, size_t maxPairs);
+
+private:
+    static uint64_t counts[Opcodes::numValidOpcodes];
+    static uint64_t totalCycles[Opcodes::numValidOpcodes];
+    static uint64_t pairCounts[Opcodes::numValidOpcodes][Opcodes::numValidOpcodes];
+    static Opcode_t previousOpcode;     // numValidOpcodes until the first instruction after a reset
+};
+
+}
+
+#endif
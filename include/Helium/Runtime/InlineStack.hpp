@@ -3,26 +3,72 @@
 #include <Helium/Assert.hpp>
 #include <Helium/Runtime/Value.hpp>
 
+#include <cstdint>
 #include <cstdlib>
 
 namespace Helium
 {
+    class Jit;
+
+    // A value popped off an InlineStack for reading only.
+    // It holds a reference only if the stack slot did, so a borrowed slot costs no reference counting at all.
+    class PoppedValue
+    {
+    public:
+        PoppedValue(Value value, bool owned) : value{value}, owned{owned} {
+        }
+
+        PoppedValue(PoppedValue&& other) noexcept : value{other.value}, owned{other.owned} {
+            other.owned = false;
+        }
+
+        ~PoppedValue() {
+            if (owned)
+                value.release();
+        }
+
+        Value* operator ->() {
+            return &value;
+        }
+
+        operator Value() {
+            return value;
+        }
+
+        PoppedValue(const PoppedValue& other) = delete;
+        PoppedValue& operator =(const PoppedValue& other) = delete;
+        PoppedValue& operator =(PoppedValue&& other) = delete;
+
+    private:
+        Value value;
+        bool owned;
+    };
+
+    // Operand stack.
+    //
+    // Slots are either *owned* (holding a reference, like a ValueRef) or *borrowed* (a plain copy of a value that is
+    // kept alive by somebody else -- a local variable, the global object, or an owned slot further down the stack).
+    // Pushing and popping borrowed slots does not touch reference counts. The interpreter only ever borrows from
+    // places that outlive the slot, and any slot whose value escapes the stack is converted to an owned reference.
     template <typename Type>
     class InlineStack
     {
         Type* data;
+        uint8_t* borrowed;
         size_t pos, size;
 
         public:
-            InlineStack() : data( nullptr ), pos( 0 ), size( 4 )
+            InlineStack() : data( nullptr ), borrowed( nullptr ), pos( 0 ), size( 4 )
             {
                 // FIXME: handle failure
                 data = static_cast<Type*>(malloc(size * sizeof(Type)));
+                borrowed = static_cast<uint8_t*>(malloc(size));
             }
 
             ~InlineStack()
             {
                 free( data );
+                free( borrowed );
             }
 
             void clear()
@@ -32,6 +78,18 @@ namespace Helium
 
                 // FIXME: handle failure
                 data = static_cast<Type*>(realloc(data, size * sizeof(Type)));
+                borrowed = static_cast<uint8_t*>(realloc(borrowed, size));
+            }
+
+            // Pop and release the top value without looking at it
+            void drop()
+            {
+                helium_assert_userdata(pos > 0);
+
+                --pos;
+
+                if ( !borrowed[pos] )
+                    data[pos].release();
             }
 
             Type getBelowTop( size_t index )
@@ -51,28 +109,41 @@ namespace Helium
 
             void push( ValueRef val )
             {
-                if ( pos >= size )
-                {
-                    size = pos * 2 + 1;
-                    // FIXME: handle failure
-                    data = static_cast<Type*>(realloc(data, size * sizeof(Type)));
-                }
+                reserveOne();
 
+                borrowed[pos] = false;
                 data[pos++] = val.detach();
             }
 
+            // Push a copy of a value without taking a reference.
+            // The caller guarantees that the value outlives the slot (see above).
+            void pushBorrowed( Type val )
+            {
+                reserveOne();
+
+                borrowed[pos] = true;
+                data[pos++] = val;
+            }
+
+            // Always returns a reference, even if the slot was borrowed
             ValueRef pop()
             {
                 helium_assert_userdata(pos > 0);
 
-                return ValueRef{data[--pos]};
+                --pos;
+
+                if ( borrowed[pos] )
+                    return ValueRef{data[pos].reference()};
+                else
+                    return ValueRef{data[pos]};
             }
 
-            Type* popPtr()
+            PoppedValue popForReading()
             {
                 helium_assert_userdata(pos > 0);
 
-                return data + ( --pos );
+                --pos;
+                return PoppedValue{data[pos], !borrowed[pos]};
             }
 
             Type top()
@@ -80,9 +151,31 @@ namespace Helium
                 return data[pos - 1];
             }
 
-            Type& topRef()
+            // Make sure the top slot holds its own reference, e.g. before the value it borrows from goes away
+            void takeOwnershipOfTop()
             {
-                return data[pos - 1];
+                helium_assert_userdata(pos > 0);
+
+                if ( borrowed[pos - 1] )
+                {
+                    data[pos - 1] = data[pos - 1].reference();
+                    borrowed[pos - 1] = false;
+                }
+            }
+
+            // Make room for one more slot (compiled code pushes by itself)
+            void reserveOne()
+            {
+                if ( pos >= size )
+                {
+                    size = pos * 2 + 1;
+                    // FIXME: handle failure
+                    data = static_cast<Type*>(realloc(data, size * sizeof(Type)));
+                    borrowed = static_cast<uint8_t*>(realloc(borrowed, size));
+                }
             }
+
+        // Compiled code accesses the slots directly
+        friend class Jit;
     };
 }
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Helium/Config.hpp>
+#include <Helium/Runtime/Code.hpp>
+#include <Helium/Runtime/InlineStack.hpp>
+#include <Helium/Runtime/Value.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Helium
+{
+    class ActivationContext;
+    struct FunctionHotness;
+    class VM;
+    struct VMModule;
+
+    // Machine code of a script function (see Jit)
+    struct JitFunction
+    {
+        // Runs the code from `entry` up to the next instruction left to the interpreter, and returns its address
+        using Code = CodeAddr_t (*)(void const* entry, CodeAddr_t* pc, ValueRef* locals, InlineStack<Value>* stack,
+                                    uint64_t* numInstructions, VarId_t* numValues);
+
+        JitFunction() = default;
+        ~JitFunction();
+
+        JitFunction(const JitFunction&) = delete;
+        void operator=(const JitFunction&) = delete;
+
+        uint8_t* memory = nullptr;
+        size_t memorySize = 0;
+
+        CodeAddr_t start = 0;
+        size_t numLocals = 0;               // the frame's locals are grown to this before the code is entered
+
+        // Indexed by instruction (relative to start): the offset of its code, or 0 where the interpreter takes over
+        std::vector<uint32_t> entries;
+    };
+
+    /**
+     * Baseline JIT for x86-64 (see HELIUM_WITH_JIT). Enabled per VM with VM::setJitEnabled.
+     *
+     * The VM decides when a script function is hot enough to be compiled (see FunctionHotness). Each instruction is
+     * translated into a template of machine code on its own: local variables, constants, integer arithmetic,
+     * comparisons and branches have inline fast paths, and everything else calls into RuntimeFunctions, just like
+     * the interpreter does.
+     *
+     * Compiled code works on the same state as the interpreter -- the operand stack, the locals of the frame and the
+     * pc -- so either of them can take over at any instruction. Calls, returns, throws and the instructions without a
+     * template are left to the interpreter: compiled code returns to VM::execute, which executes the instruction and
+     * enters compiled code again at the next one. This is also what makes on-stack replacement trivial: a frame that
+     * was entered before its function got compiled switches over at its next loop back edge, simply by having its
+     * jitFunction set.
+     */
+    class Jit
+    {
+        public:
+            static constexpr unsigned defaultThreshold = 1000;
+            static constexpr unsigned defaultBackEdgeThreshold = 10000;
+
+            explicit Jit(VM* vm) : vm(vm) {}
+
+            Jit(const Jit&) = delete;
+            void operator=(const Jit&) = delete;
+
+            // Returns the compiled code of a function, compiling it on the first request. Null if nothing in the
+            // function could be compiled.
+            JitFunction* getCode(VMModule const& module, ScriptFunction const& function, FunctionHotness& hotness);
+
+            // Runs the compiled code of the current frame from ctx.pc until it reaches an instruction left to the
+            // interpreter. Does nothing if there is no code for the instruction at ctx.pc.
+            void run(ActivationContext& ctx);
+
+            size_t getNumCompiledFunctions() const { return numCompiledFunctions; }
+
+        private:
+            std::unique_ptr<JitFunction> compile(VMModule const& module, ScriptFunction const& function);
+
+            VM* vm;
+            size_t numCompiledFunctions = 0;
+    };
+}
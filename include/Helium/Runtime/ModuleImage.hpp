@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Helium/Runtime/Code.hpp>
+
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+namespace Helium
+{
+    /**
+     * A compiled module laid out to be memory-mapped and executed in place (see VM::loadModuleImage).
+     *
+     * Instructions are stored exactly as the VM executes them, so an image is only valid for the build of Helium that
+     * wrote it; the header records the instruction layout and byte order, and mismatching images are rejected.
+     * Use Module::save/load to exchange compiled modules between builds.
+     *
+     * Everything in an image is position-independent: strings and tables are referenced by index or offset, and
+     * call_ext operands stay dependency indices that every VM resolves through its own side table. Processes mapping
+     * the same file therefore share its pages. Line tables are kept if the module has debug information.
+     */
+    class ModuleImage
+    {
+        public:
+            ~ModuleImage();
+
+            ModuleImage(const ModuleImage&) = delete;
+            ModuleImage& operator=(const ModuleImage&) = delete;
+
+            static bool isModuleImage(span<const std::byte> header);
+
+            static bool write(Module const& module, WriteCallback const& write);
+
+            // Returns nullptr if the file cannot be mapped or is not a valid image for this build.
+            // The whole image is validated, so that the VM can trust it as much as compiled code.
+            static std::shared_ptr<ModuleImage> map(std::filesystem::path const& path);
+
+            span<const Instruction> getInstructions() const;
+
+            // The first getNumPoolStrings() strings form the module string pool
+            size_t getNumPoolStrings() const;
+            VMString getString(size_t index) const;
+
+            size_t getNumDependencies() const;
+            std::string_view getDependency(size_t index) const;
+
+            size_t getNumFunctions() const;
+            ScriptFunction getFunction(size_t index) const;
+
+            // Empty if the module was compiled without debug information
+            std::string_view getUnitName() const;
+
+            // Switch case values live in the VM heap, so every VM needs its own copy
+            size_t getNumSwitchTables() const;
+            std::shared_ptr<SwitchTable> createSwitchTable(size_t index) const;
+
+        private:
+            ModuleImage() = default;
+
+            template <typename Type>
+            Type const* getSection(size_t sectionIndex) const;
+
+            bool validate() const;
+
+            std::byte const* data = nullptr;
+            size_t size = 0;
+
+            // Either mapped, or (where mapping is not available) read into memory
+            bool isMapped = false;
+            std::unique_ptr<std::byte[]> buffer;
+    };
+}
@@ -2,15 +2,20 @@
 
 #include <Helium/Runtime/ActivationContext.hpp>
 #include <Helium/Runtime/Code.hpp>
+#include <Helium/Runtime/Jit.hpp>
 #include <Helium/Runtime/Value.hpp>
 
+#include <chrono>
+#include <memory>
 #include <optional>
 #include <stack>
+#include <unordered_map>
 #include <vector>
 
 namespace Helium
 {
     class ActivationContext;
+    class ModuleImage;
 
     enum class GarbageCollectReason {
         numInstructionsSinceLastCollect,
@@ -18,22 +23,61 @@ namespace Helium
         vmShutdown,
     };
 
+    /**
+     * How often a script function has run in the interpreter, and the code it has been tiered up to.
+     *
+     * Calls are counted as the function is entered, back edges whenever a backward jump is taken in VM::execute.
+     * Once either count crosses its threshold (see VM::setJitThreshold), the function is compiled. A frame which
+     * crosses the back edge threshold switches to compiled code right at the loop header, without waiting for the
+     * next call.
+     */
+    struct FunctionHotness
+    {
+        uint32_t numCalls = 0;
+        uint64_t numBackEdges = 0;
+
+        bool compilationFailed = false;     // nothing in the function could be compiled
+        std::unique_ptr<JitFunction> compiled;
+    };
+
     /**
      * A loaded module bound to a specific VM (why ?)
      */
     struct VMModule
     {
         std::vector<ScriptFunction> functions;
-        std::vector<Instruction> instructions;
 
-        std::vector<uint8_t> stringMemory;
-        VMString* strings;
+        // Points either into ownedInstructions or directly into a mapped image
+        span<const Instruction> instructions;
+        std::vector<Instruction> ownedInstructions;
+
+        // Strings of images stay in the mapping, so stringMemory is only used by compiled modules
+        std::vector<char> stringMemory;
+        std::vector<VMString> strings;
 
         std::vector<std::shared_ptr<SwitchTable>> switchTables;
 
+        // Empty if the module was compiled without debug information
+        std::string unitName;
+
+        // call_ext operands are dependency indices; this maps them to VM::externals
+        std::vector<size_t> externalIndices;
+
+        // Keeps the mapping alive for as long as the module is loaded
+        std::shared_ptr<ModuleImage> image;
+
+        // Indexed like `functions`; never resized after loading, since frames point into it
+        std::vector<FunctionHotness> hotness;
+
         std::optional<FunctionIndex_t> findMainFunction();
     };
 
+    struct GcStats {
+        uint64_t numCollections = 0;
+        uint64_t numValuesCollected = 0;
+        std::chrono::nanoseconds totalTime {0};
+    };
+
     class VM
     {
         protected:
@@ -47,15 +91,47 @@ namespace Helium
             std::vector<std::unique_ptr<VMModule>> loadedModules;
             std::vector<ExternalFunc> externals;
 
+            // Live activation contexts bound to this VM (used for heap inspection)
+            std::vector<ActivationContext*> activationContexts;
+
             // Garbage collection
             // Possible roots of cycles (_purple_ in the paper's terminology)
             std::vector<Value> possibleRoots;
-            int numInstructionsSinceLastCollect = 0;
+            uint64_t numInstructionsSinceLastCollect = 0;
+            uint64_t numInstructionsBeforeLastCollect = 0;
+            GcStats gcStats;
+
+            // Function statistics
+            bool functionStatsEnabled = false;
+            std::unordered_map<ScriptFunction const*, FunctionStats> scriptFunctionStats;
+            std::unordered_map<NativeFunction, FunctionStats> nativeFunctionStats;
+
+            // Baseline JIT; null unless enabled
+            std::unique_ptr<Jit> jit;
+            unsigned jitThreshold = Jit::defaultThreshold;
+            unsigned jitBackEdgeThreshold = Jit::defaultBackEdgeThreshold;
 
             // Primitive variable methods
             //HashMap<StringWrapper, NativeFunction> stringFunctions;
 
+            size_t findExternal(std::string_view name) const;
+
+            // Unwinds the frames of `ctx` up to the innermost exception handler covering the instruction before
+            // ctx.pc, and resumes execution there. Leaves the exception raised if there is no handler.
+            void unwindToExceptionHandler(ActivationContext& ctx);
+
+            // Tiering hooks (see FunctionHotness). onFunctionEntered picks the code for a new frame of `module`;
+            // onBackEdge is called after a backward jump in the current frame of `ctx`, with ctx.pc at the loop header.
+            void onFunctionEntered(VMModule& module, Frame& frame);
+            void onBackEdge(ActivationContext& ctx);
+
         public:
+            struct FunctionStatsEntry {
+                std::string name;
+                bool isNative;
+                FunctionStats stats;
+            };
+
             ValueRef global;
 
         public:
@@ -63,14 +139,46 @@ namespace Helium
             ~VM();
 
             void addPossibleRootOfCycle(Value var ) { possibleRoots.push_back(var ); }
+            void addActivationContext(ActivationContext* ctx) { activationContexts.push_back(ctx); }
+            void removeActivationContext(ActivationContext* ctx);
             void collectGarbage( GarbageCollectReason reason );
+            void collectGarbageIfNeeded();
+
+            GcStats const& getGcStats() const { return gcStats; }
+            uint64_t getNumInstructionsExecuted() const { return numInstructionsBeforeLastCollect + numInstructionsSinceLastCollect; }
 
             VMModule* getModuleByIndex(ModuleIndex_t moduleIndex) { return loadedModules[moduleIndex].get(); }
             ModuleIndex_t loadModule(Module* script );
 
+            // Executes the image's code in place; only the function and switch tables are copied
+            ModuleIndex_t loadModuleImage(std::shared_ptr<ModuleImage> image);
+
             int16_t registerCallback( const char* name, NativeFunction callback );
 
             void execute( ActivationContext& ctx );
+
+            // Per-function call counts and timing
+            bool isFunctionStatsEnabled() const { return functionStatsEnabled; }
+            void setFunctionStatsEnabled(bool enabled) { functionStatsEnabled = enabled; }
+            std::vector<FunctionStatsEntry> getFunctionStats() const;
+            void resetFunctionStats();
+
+            // Baseline JIT (see Jit). Enabling it does nothing in builds without HELIUM_WITH_JIT; disabling it
+            // throws away all compiled code.
+            bool isJitEnabled() const { return jit != nullptr; }
+            void setJitEnabled(bool enabled);
+
+            // How many calls, or loop iterations in the interpreter, it takes for a function to be compiled
+            unsigned getJitThreshold() const { return jitThreshold; }
+            void setJitThreshold(unsigned threshold) { jitThreshold = threshold; }
+            unsigned getJitBackEdgeThreshold() const { return jitBackEdgeThreshold; }
+            void setJitBackEdgeThreshold(unsigned threshold) { jitBackEdgeThreshold = threshold; }
+
+            size_t getNumCompiledFunctions() const { return jit ? jit->getNumCompiledFunctions() : 0; }
+
+        friend class ActivationContext;
+        friend class HeapSnapshot;
+        friend class Jit;
     };
 
     std::string_view to_string(GarbageCollectReason);
@@ -88,7 +88,7 @@ namespace Helium
             propertyReadOnlyError,
         };
 
-#ifdef HELIUM_TRACE_VALUES
+#if HELIUM_TRACE_VALUES
         VarId_t varId, refId;
 #endif
 
@@ -250,6 +250,12 @@ namespace Helium
         // Diagnostics
         static int getNumExistingValues();
 
+        // Memory held by the pools of list and object storage, including chunks that are partially used or spare
+        static size_t getPoolMemoryUsage();
+
+        // Compiled code creates and releases scalars inline, and keeps the count up to date by itself
+        static VarId_t* getNumExistingValuesCounter();
+
     private:
         Value() = default;
 
@@ -309,7 +315,7 @@ namespace Helium
             return &value;
         }
 
-        operator Value() {
+        operator Value() const {
             return value;
         }
 
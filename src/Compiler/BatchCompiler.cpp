@@ -0,0 +1,194 @@
+#include <Helium/Compiler/BatchCompiler.hpp>
+#include <Helium/Compiler/Compiler.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace Helium
+{
+    namespace
+    {
+        struct Job
+        {
+            std::filesystem::path fileName;
+            std::unique_ptr<Module> module;
+            std::string error;
+            std::vector<size_t> imports;
+        };
+
+        // Identifies a unit, however it was reached
+        std::string getUnitKey(std::filesystem::path const& fileName) {
+            std::error_code ec;
+            auto canonical = std::filesystem::weakly_canonical(fileName, ec);
+
+            return (ec ? fileName.lexically_normal() : canonical).string();
+        }
+    }
+
+    bool BatchCompiler::compile(std::vector<std::filesystem::path> const& entryFiles, std::vector<Unit>& units_out) const {
+        std::mutex mutex;
+        std::condition_variable queueChanged;
+
+        // A deque, so that workers can keep references to their jobs while new ones are being queued
+        std::deque<Job> jobs;
+        std::unordered_map<std::string, size_t> jobIndices;
+        size_t nextJob = 0, numBusy = 0;
+
+        // Must be called with the mutex held
+        auto queue = [&jobs, &jobIndices](std::filesystem::path const& fileName) {
+            auto [it, inserted] = jobIndices.emplace(getUnitKey(fileName), jobs.size());
+
+            if (inserted)
+                jobs.push_back(Job{fileName, nullptr, {}, {}});
+
+            return it->second;
+        };
+
+        std::vector<size_t> entries;
+
+        for (auto const& fileName : entryFiles)
+            entries.push_back(queue(fileName));
+
+        auto work = [&] {
+            Compiler compiler;
+            compiler.setDebugInformation(withDebugInformation);
+
+            // Units are already compiled in parallel; splitting them up further would only oversubscribe the CPU
+            compiler.setNumThreads(1);
+
+            std::unique_lock<std::mutex> lock(mutex);
+
+            for (;;) {
+                // Once nothing is queued and nobody is busy, no more units can be discovered
+                queueChanged.wait(lock, [&] { return nextJob < jobs.size() || numBusy == 0; });
+
+                if (nextJob == jobs.size())
+                    break;
+
+                auto& job = jobs[nextJob++];
+                numBusy++;
+                lock.unlock();
+
+                try {
+                    job.module = compiler.compileFile(job.fileName);
+                }
+                catch (CompileException const& ex) {
+                    job.error = ex.name + " - " + ex.desc;
+                }
+
+                // Errors in code generation have already been printed by the compiler
+                if (!job.module && job.error.empty())
+                    job.error = "compilation failed";
+
+                std::vector<std::filesystem::path> imports;
+
+                if (job.module) {
+                    for (auto const& dependency : job.module->dependencies) {
+                        if (auto fileName = resolveImport(dependency))
+                            imports.push_back(std::move(*fileName));
+                    }
+                }
+
+                lock.lock();
+
+                for (auto const& fileName : imports)
+                    job.imports.push_back(queue(fileName));
+
+                numBusy--;
+                queueChanged.notify_all();
+            }
+        };
+
+        auto numWorkers = std::max(numThreads ? numThreads : std::thread::hardware_concurrency(), 1u);
+
+        // The calling thread is one of the workers
+        std::vector<std::thread> workers;
+
+        for (unsigned i = 1; i < numWorkers; i++)
+            workers.emplace_back(work);
+
+        work();
+
+        for (auto& worker : workers)
+            worker.join();
+
+        // Breadth-first from the entry files, which is the order in which a single worker would have found them
+        std::vector<bool> visited(jobs.size());
+        std::vector<size_t> order;
+
+        for (auto index : entries) {
+            if (!visited[index]) {
+                visited[index] = true;
+                order.push_back(index);
+            }
+        }
+
+        for (size_t i = 0; i < order.size(); i++) {
+            for (auto index : jobs[order[i]].imports) {
+                if (!visited[index]) {
+                    visited[index] = true;
+                    order.push_back(index);
+                }
+            }
+        }
+
+        bool succeeded = true;
+        units_out.clear();
+        units_out.reserve(order.size());
+
+        for (auto index : order) {
+            auto& job = jobs[index];
+
+            if (!job.module)
+                succeeded = false;
+
+            units_out.push_back(Unit{std::move(job.fileName), std::move(job.module), std::move(job.error)});
+        }
+
+        return succeeded;
+    }
+
+    std::optional<std::filesystem::path> BatchCompiler::resolveImport(std::string_view dependency) const {
+        // Helium:: is reserved for built-in functions (see '~' in the compiler)
+        if (dependency.substr(0, 8) == "Helium::")
+            return std::nullopt;
+
+        auto separator = dependency.rfind("::");
+
+        if (separator == std::string_view::npos || separator == 0)
+            return std::nullopt;
+
+        std::filesystem::path relativePath;
+
+        for (auto unitName = dependency.substr(0, separator); ; ) {
+            auto next = unitName.find("::");
+            auto component = unitName.substr(0, next);
+
+            if (component.empty())
+                return std::nullopt;
+
+            relativePath /= std::string(component);
+
+            if (next == std::string_view::npos)
+                break;
+
+            unitName.remove_prefix(next + 2);
+        }
+
+        relativePath += ".he";
+
+        for (auto const& directory : modulePaths) {
+            std::error_code ec;
+            auto fileName = directory / relativePath;
+
+            if (std::filesystem::is_regular_file(fileName, ec))
+                return fileName;
+        }
+
+        return std::nullopt;
+    }
+}
@@ -4,8 +4,15 @@
 #include <Helium/Compiler/Type.hpp>
 #include <Helium/Memory/LinearAllocator.hpp>
 
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <variant>
 #include <vector>
 
 #if HELIUM_TRACE_VALUES
@@ -19,6 +26,10 @@ namespace Helium
     using std::string;
     using stx::optional;
 
+    // The value heap is not thread-safe, so compilers running on different threads (see BatchCompiler) take turns
+    // creating and releasing switch case values
+    static std::mutex heapMutex;
+
     static ValueRef getConstant(const AstNodeLiteral* literal)
     {
         switch ( literal->literalType )
@@ -88,32 +99,61 @@ namespace Helium
         bool isArgument( const char* name );
     };
 
-    struct AssemblerState
+    static Function* createFunction(const AstNodeFunction* function)
     {
-        std::unique_ptr<Module> script;
+        Function* func = new Function;
+        func->name = function->getName();       // TODO: if we really need a unique name for every function,
+                                                //       it should be done here
+        func->offset = -1;
+        func->function = function;
+        func->toBeExported = false;
+        func->ownerClass = 0;
+        return func;
+    }
 
-        std::vector<Function*> functions;
-        std::vector<Function*> unknownPushFuncPtrs;     // TODO: what does this serve
-        std::vector<std::string> temporaryStrings;
-        Function* currentFunction;
-        ScriptFunction* currentScriptFunction = nullptr;
-        bool generateDebug;
+    // Case values live in the VM heap and must not be created on worker threads, so a switch table is only built
+    // from its literals once the function is placed into the module. Cases generated by the compiler itself are
+    // plain integers.
+    struct SwitchTableDraft
+    {
+        std::vector<std::variant<const AstNodeLiteral*, Int_t>> cases;
+        std::vector<CodeAddr_t> handlers;
+    };
 
-        std::shared_ptr<std::string> currentFunctionName, unitNameString;
+    /**
+     * Generates the bytecode of a single function.
+     *
+     * Functions are compiled independently of each other, possibly on worker threads, so everything is emitted into
+     * buffers owned by the FunctionAssembler: code addresses start at 0, and string, switch table and temporary string
+     * indices refer to its own tables. AssemblerState::place relocates the result into the module; calls and
+     * references to functions stay unknownCall/unknownPush until AssemblerState::cook.
+     */
+    struct FunctionAssembler
+    {
+        Function* currentFunction;
+        ScriptFunction scriptFunction;
+        std::vector<Instruction*> code;
 
+        std::vector<std::string> stringPool;
         std::unordered_map<std::string, size_t> stringPoolIndices;
+        std::vector<SwitchTableDraft> switchTables;
+        std::vector<std::string> temporaryStrings;
+        std::unordered_map<std::string, size_t> temporaryStringIndices;
 
-        bool failed = false;
+        // Anonymous functions in the order they were encountered
+        std::vector<Function*> newFunctions;
 
-        AssemblerState( bool withDebugInformation, std::shared_ptr<std::string> unitNameString )
-            : generateDebug( withDebugInformation ), unitNameString( unitNameString )
-        {
-            script = std::make_unique<Module>();
-        }
+        bool generateDebug;
 
-        ~AssemblerState()
+        std::shared_ptr<std::string> unitNameString;
+
+        // Printed when the function is placed, so that diagnostics come out in source order
+        std::vector<std::string> errors;
+        bool failed = false;
+
+        FunctionAssembler( Function* function, bool withDebugInformation, std::shared_ptr<std::string> unitNameString )
+            : currentFunction( function ), generateDebug( withDebugInformation ), unitNameString( unitNameString )
         {
-            functions.clear();
         }
 
         Instruction* add( Opcodes::Opcode opcode, const SourceSpan& span ) {
@@ -121,26 +161,15 @@ namespace Helium
             added->opcode = opcode;
 
             if ( generateDebug )
-            {
-                added->origin = new InstructionOrigin;
-                added->origin->unit = unitNameString;
-                added->origin->function = currentFunctionName;
-                added->origin->line = span.start.line;
-            }
+                scriptFunction.lineTable.addLine( currentOffset(), span.start.line );
 
-            script->code.push_back( added );
+            code.push_back( added );
             return added;
         }
 
         Function* addFunctionForProcessing(const AstNodeFunction* function) {
-            Function* func = new Function;
-            func->name = function->getName();       // TODO: if we really need a unique name for every function,
-                                                    //       it should be done here
-            func->offset = -1;
-            func->function = function;
-            func->toBeExported = false;
-            func->ownerClass = 0;
-            functions.push_back( func );
+            Function* func = createFunction(function);
+            newFunctions.push_back( func );
             return func;
         }
 
@@ -187,9 +216,10 @@ namespace Helium
             return instr;
         }
 
+        // Relative to the start of the function
         CodeAddr_t currentOffset()
         {
-            auto pos = script->code.size();
+            auto pos = code.size();
 
             helium_assert(pos < std::numeric_limits<CodeAddr_t>::max());
 
@@ -205,29 +235,31 @@ namespace Helium
             if (it != stringPoolIndices.end())
                 return it->second;
 
-            size_t index = script->stringPool.size();
-            script->stringPool.emplace_back(s.begin(), s.end());
+            size_t index = stringPool.size();
+            stringPool.push_back(s);
             stringPoolIndices.emplace(std::move(s), index);
             return index;
         }
 
-        size_t getSwitchTableIndex(std::shared_ptr<SwitchTable>&& switchTable)
+        size_t getSwitchTableIndex(SwitchTableDraft&& switchTable)
         {
-            script->switchTables.emplace_back(std::move(switchTable));
-            return script->switchTables.size() - 1;
+            switchTables.emplace_back(std::move(switchTable));
+            return switchTables.size() - 1;
         }
 
         size_t getTemporaryStringIndex( const char* str )
         {
             std::string s(str);
 
-            auto it = std::find(temporaryStrings.begin(), temporaryStrings.end(), s);
+            auto it = temporaryStringIndices.find(s);
 
-            if (it != temporaryStrings.end())
-                return it - temporaryStrings.begin();
+            if (it != temporaryStringIndices.end())
+                return it->second;
 
-            temporaryStrings.emplace_back(std::move(s));
-            return temporaryStrings.size() - 1;
+            size_t index = temporaryStrings.size();
+            temporaryStrings.push_back(s);
+            temporaryStringIndices.emplace(std::move(s), index);
+            return index;
         }
 
         static bool isGlobal(AstNodeExpression const& node)
@@ -265,37 +297,8 @@ namespace Helium
             return false;
         }
 
-        size_t getExternal( const char* name )
-        {
-            //* All functions beginning with '~' are implicitly prefixed with "Helium::"
-            //* ('~.IO::serialize' => 'Helium::IO::Serialize')
-
-            // FIXME: Not UTF-8 safe, but will be probably removed anyways
-            auto fullName = name[0] != '~' ? std::string( name ) : "Helium::" + std::string( name + 1 );
-
-            for ( size_t i = 0; i < script->dependencies.size(); i++ )
-            {
-                if ( script->dependencies[i] == fullName )
-                    return i;
-            }
-
-            script->dependencies.push_back( fullName );
-            return script->dependencies.size() - 1;
-        }
-
-        Function* findFunction( const char* name )
-        {
-            for ( auto function : functions )
-                if ( function->name == name )
-                    return function;
-
-            return 0;
-        }
-
         void binaryOperator(Opcodes::Opcode opcode, AstNodeBinaryExpr const& expr);
-        void compileClass(AstNodeClass* classDecl);
-        void cook();
-        void linearize( AstNodeScript& tree );
+        void compile();
         Type* maybeGetType(AstNodeTypeName* maybeTypeName);
         void unaryOperator(Opcodes::Opcode opcode, AstNodeUnaryExpr const& expr);
 
@@ -323,11 +326,135 @@ namespace Helium
          */
         bool pushLiteral(const AstNodeLiteral* node);
 
+        /**
+         * Escape analysis for list and object literals.
+         *
+         * A list literal of two or more items is materialized by new_list, and an object literal by new_obj. When a
+         * literal is only indexed by a constant, asked for its length or for one of its properties, iterated over or
+         * discarded, the value cannot escape: its items are evaluated in place, in their usual order, and nothing is
+         * allocated. Any other use of a literal still materializes it.
+         */
+        static optional<std::vector<const AstNodeExpression*>> getLiteralItems(const AstNodeExpression* node);
+
+        // True if evaluating the expression has no effects and cannot fail, so it may be skipped or repeated
+        bool isPure(const AstNodeExpression* node);
+
+        // Evaluate all items and keep only the one at `keep` on the stack (none if out of range)
+        void pushItem(std::vector<const AstNodeExpression*> const& items, size_t keep, const SourceSpan& span);
+
+        // Returns false if the expression is not a literal that can be accessed without being materialized
+        bool tryPushIndexedLiteral(const AstNodeExprIndexed* indexed);
+        bool tryPushLiteralProperty(const AstNodeProperty* property);
+        bool tryCompileForOverLiteral(const AstNodeForRange* forRange);
+
         bool compileStatement(const AstNodeStatement* node);
 
         // Errors
         void raiseError(const char* message, const SourceSpan& span);
         void typeError1() { abort(); }
+    };
+
+    struct AssemblerState
+    {
+        // Below this many functions per thread, spawning workers costs more than it saves
+        static constexpr size_t minFunctionsPerThread = 64;
+
+        // An unknownCall or unknownPush, to be resolved by cook() once all functions are known
+        struct UnresolvedReference
+        {
+            Instruction* instruction;
+            Function* parentFunction;
+        };
+
+        std::unique_ptr<Module> script;
+
+        std::vector<Function*> functions;
+        std::unordered_map<std::string, Function*> functionsByName;
+        std::vector<UnresolvedReference> unresolvedReferences;
+        std::vector<std::string> temporaryStrings;
+        std::unordered_map<std::string, size_t> temporaryStringIndices;
+        std::unordered_map<std::string, size_t> dependencyIndices;
+        bool generateDebug;
+        unsigned numThreads;
+
+        std::shared_ptr<std::string> unitNameString;
+
+        std::unordered_map<std::string, size_t> stringPoolIndices;
+
+        bool failed = false;
+
+        AssemblerState( bool withDebugInformation, std::shared_ptr<std::string> unitNameString, unsigned numThreads )
+            : generateDebug( withDebugInformation ), numThreads( numThreads ), unitNameString( unitNameString )
+        {
+            script = std::make_unique<Module>();
+
+            if ( generateDebug && unitNameString )
+                script->unitName = *unitNameString;
+        }
+
+        ~AssemblerState()
+        {
+            functions.clear();
+        }
+
+        size_t getStringIndex( std::string const& s )
+        {
+            auto it = stringPoolIndices.find(s);
+
+            if (it != stringPoolIndices.end())
+                return it->second;
+
+            size_t index = script->stringPool.size();
+            script->stringPool.emplace_back(s.begin(), s.end());
+            stringPoolIndices.emplace(s, index);
+            return index;
+        }
+
+        size_t getTemporaryStringIndex( std::string const& s )
+        {
+            auto [it, inserted] = temporaryStringIndices.emplace(s, temporaryStrings.size());
+
+            if (inserted)
+                temporaryStrings.push_back(s);
+
+            return it->second;
+        }
+
+        size_t getExternal( const char* name )
+        {
+            //* All functions beginning with '~' are implicitly prefixed with "Helium::"
+            //* ('~.IO::serialize' => 'Helium::IO::Serialize')
+
+            // FIXME: Not UTF-8 safe, but will be probably removed anyways
+            auto fullName = name[0] != '~' ? std::string( name ) : "Helium::" + std::string( name + 1 );
+
+            auto [it, inserted] = dependencyIndices.emplace( fullName, script->dependencies.size() );
+
+            if ( inserted )
+                script->dependencies.push_back( fullName );
+
+            return it->second;
+        }
+
+        void addFunction( Function* function )
+        {
+            functions.push_back( function );
+
+            // If several functions share a name, references resolve to the first one
+            functionsByName.emplace( function->name, function );
+        }
+
+        Function* findFunction( std::string const& name )
+        {
+            auto it = functionsByName.find( name );
+            return it != functionsByName.end() ? it->second : nullptr;
+        }
+
+        void compileClass(AstNodeClass* classDecl);
+        void compileFunctions(std::vector<FunctionAssembler>& assemblers);
+        void cook();
+        void linearize( AstNodeScript& tree );
+        void place(FunctionAssembler& assembler);
 
     private:
         // TODO: temporary, will be removed once we stop messing with the AST
@@ -379,14 +506,14 @@ namespace Helium
         return std::find( arguments.begin(), arguments.end(), name ) != arguments.end();
     }
 
-    void AssemblerState::binaryOperator(Opcodes::Opcode opcode, AstNodeBinaryExpr const& expr)
+    void FunctionAssembler::binaryOperator(Opcodes::Opcode opcode, AstNodeBinaryExpr const& expr)
     {
         pushExpression(expr.getLeft());
         pushExpression(expr.getRight());
         emit(opcode, expr.span);
     }
 
-    bool AssemblerState::compileStatement(const AstNodeStatement* node) {
+    bool FunctionAssembler::compileStatement(const AstNodeStatement* node) {
         switch (node->type) {
             case AstNodeStatement::Type::assert: {
                 auto assert = static_cast<const AstNodeAssert*>(node);
@@ -430,6 +557,11 @@ namespace Helium
                 auto expression = static_cast<const AstNodeStatementExpression*>(node);
                 auto expr = expression->getExpression();
 
+                if (auto items = getLiteralItems(expr)) {
+                    pushItem(*items, items->size(), expression->span);
+                    break;
+                }
+
                 pushExpression(expr);
                 emit(Opcodes::drop, expression->span);
                 break;
@@ -468,6 +600,9 @@ namespace Helium
             case AstNodeStatement::Type::forRange: {
                 auto forRange = static_cast<const AstNodeForRange*>(node);
 
+                if (tryCompileForOverLiteral(forRange))
+                    break;
+
                 auto iteratorVar = currentFunction->createLocal("(iterator)", nullptr);
                 auto itemVar = currentFunction->getOrAllocLocalIndex(forRange->getVariableName().c_str() );
 
@@ -590,9 +725,9 @@ namespace Helium
                 }
 
                 // Built the switch jump table
-                auto switchTable = std::make_shared<SwitchTable>();
-                switchTable->cases.resize(numCases);
-                switchTable->handlers.resize(numCases + 1);
+                SwitchTableDraft switchTable;
+                switchTable.cases.resize(numCases);
+                switchTable.handlers.resize(numCases + 1);
 
                 // We only need to add this instruction before compiling the cases
                 auto switchInstruction = add( Opcodes::op_switch, switch_->span );
@@ -610,8 +745,8 @@ namespace Helium
                         // FIXME: nobody guarantees this!
                         helium_assert(caseValue->type == AstNodeExpression::Type::literal);
 
-                        switchTable->cases[currentEntry] = getConstant(static_cast<const AstNodeLiteral*>(caseValue.get()));
-                        switchTable->handlers[currentEntry++] = currentOffset();
+                        switchTable.cases[currentEntry] = static_cast<const AstNodeLiteral*>(caseValue.get());
+                        switchTable.handlers[currentEntry++] = currentOffset();
                     }
 
                     // Compile the block
@@ -623,7 +758,7 @@ namespace Helium
                 helium_assert_debug(currentEntry == numCases);
 
                 //* The default handler pointer (if not present, this will point to the statement end)
-                switchTable->handlers[numCases] = currentOffset();
+                switchTable.handlers[numCases] = currentOffset();
 
                 switchInstruction->switchTableIndex = getSwitchTableIndex(std::move(switchTable));
 
@@ -688,7 +823,7 @@ namespace Helium
                 exit->codeAddr = currentOffset();
 
                 // Nested try-catch blocks will get pushed before this, which is exactly what we need
-                currentScriptFunction->exceptionHandlers.push_back(Eh {start, length, handler});
+                scriptFunction.exceptionHandlers.push_back(Eh {start, length, handler});
                 break;
             }
 
@@ -723,7 +858,7 @@ namespace Helium
         return true;
     }
 
-    bool AssemblerState::popExpression(const AstNodeExpression* node, bool keepOnStack) {
+    bool FunctionAssembler::popExpression(const AstNodeExpression* node, bool keepOnStack) {
         switch (node->type) {
             case AstNodeExpression::Type::identifier: {
                 auto& identifier = static_cast<AstNodeIdent const&>(*node);
@@ -794,7 +929,7 @@ namespace Helium
     }
 
     // Compute expression and push it to the top of the stack
-    bool AssemblerState::pushExpression(const AstNodeExpression* node) {
+    bool FunctionAssembler::pushExpression(const AstNodeExpression* node) {
         helium_assert_debug(node != nullptr);
 
         switch (node->type) {
@@ -914,7 +1049,6 @@ namespace Helium
                 auto func = addFunctionForProcessing(function);
 
                 add( Opcodes::unknownPush, function->span )->stringIndex = getTemporaryStringIndex( func->name.c_str() );
-                unknownPushFuncPtrs.push_back( currentFunction );
                 break;
             }
 
@@ -938,7 +1072,6 @@ namespace Helium
                 else
                 {
                     add( Opcodes::unknownPush, node->span )->stringIndex = getTemporaryStringIndex(identifier.name.c_str());
-                    unknownPushFuncPtrs.push_back( currentFunction );
                 }
 
                 break;
@@ -950,6 +1083,9 @@ namespace Helium
                 auto range = indexed->range.get();
                 auto index = indexed->index.get();
 
+                if (tryPushIndexedLiteral(indexed))
+                    break;
+
                 //* Stack parameters are: the list (lower) & index
                 pushExpression(range);
                 pushExpression(index);
@@ -986,6 +1122,9 @@ namespace Helium
                 auto object = property->object.get();
                 auto& propertyName = property->propertyName->name;
 
+                if (tryPushLiteralProperty(property))
+                    break;
+
                 pushExpression(object);
                 emitString(Opcodes::getProperty, propertyName.c_str(), node->span);
                 break;
@@ -1013,7 +1152,7 @@ namespace Helium
     }
 
     // Compute excepression and push it to the top of the stack
-    bool AssemblerState::pushLiteral(const AstNodeLiteral* node) {
+    bool FunctionAssembler::pushLiteral(const AstNodeLiteral* node) {
         switch (node->literalType) {
             case AstNodeLiteral::Type::boolean:
                 emitInteger(Opcodes::pushc_b, static_cast<const AstNodeLiteralBoolean*>(node)->value, node->span);
@@ -1056,18 +1195,280 @@ namespace Helium
         helium_unreachable();
     }
 
-    void AssemblerState::raiseError(const char* message, const SourceSpan& span) {
-        printf("%s:%i: error: %s\n", this->unitNameString->c_str(), span.start.line, message);
+    optional<std::vector<const AstNodeExpression*>> FunctionAssembler::getLiteralItems(const AstNodeExpression* node) {
+        std::vector<const AstNodeExpression*> items;
+
+        if (node->type == AstNodeExpression::Type::list) {
+            auto list = static_cast<const AstNodeList*>(node);
+
+            // A one-item list is just a parenthesized expression
+            if (list->getItems().size() < 2)
+                return {};
+
+            for (const auto& item : list->getItems())
+                items.push_back(item.get());
+
+            return items;
+        }
+
+        if (node->type == AstNodeExpression::Type::literal
+                && static_cast<const AstNodeLiteral*>(node)->literalType == AstNodeLiteral::Type::object) {
+            for (const auto& pair : static_cast<const AstNodeLiteralObject*>(node)->getProperties())
+                items.push_back(pair.second.get());
+
+            return items;
+        }
+
+        return {};
+    }
+
+    bool FunctionAssembler::isPure(const AstNodeExpression* node) {
+        switch (node->type) {
+            case AstNodeExpression::Type::identifier: {
+                auto& identifier = static_cast<AstNodeIdent const&>(*node);
+
+                // Members are looked up in `this`, which can fail
+                bool forceLocal = (identifier.ns == AstNodeIdent::Namespace::local) || currentFunction->isArgument( identifier.name.c_str() );
+                return isGlobal(identifier) || forceLocal || !isMember( identifier.name.c_str() );
+            }
+
+            case AstNodeExpression::Type::list: {
+                auto& items = static_cast<const AstNodeList*>(node)->getItems();
+                return std::all_of(items.begin(), items.end(), [this](auto const& item) { return isPure(item.get()); });
+            }
+
+            case AstNodeExpression::Type::literal: {
+                if (auto items = getLiteralItems(node))
+                    return std::all_of(items->begin(), items->end(), [this](auto item) { return isPure(item); });
+
+                return true;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    void FunctionAssembler::pushItem(std::vector<const AstNodeExpression*> const& items, size_t keep,
+                                     const SourceSpan& span) {
+        for (size_t i = 0; i < items.size(); i++) {
+            pushExpression(items[i]);
+
+            if (i != keep)
+                emit(Opcodes::drop, span);
+        }
+    }
+
+    bool FunctionAssembler::tryPushIndexedLiteral(const AstNodeExprIndexed* indexed) {
+        auto index = indexed->index.get();
+
+        if (indexed->range->type != AstNodeExpression::Type::list || index->type != AstNodeExpression::Type::literal
+                || static_cast<const AstNodeLiteral*>(index)->literalType != AstNodeLiteral::Type::integer)
+            return false;
+
+        auto items = getLiteralItems(indexed->range.get());
+        auto value = static_cast<const AstNodeLiteralInteger*>(index)->value;
+
+        // Out-of-range indices are left for getIndexed to report
+        if (!items || value < 0 || static_cast<size_t>(value) >= items->size())
+            return false;
+
+        pushItem(*items, static_cast<size_t>(value), indexed->span);
+        return true;
+    }
+
+    bool FunctionAssembler::tryPushLiteralProperty(const AstNodeProperty* property) {
+        auto object = property->object.get();
+        auto& propertyName = property->propertyName->name;
+
+        auto items = getLiteralItems(object);
+
+        if (!items)
+            return false;
+
+        if (object->type == AstNodeExpression::Type::list) {
+            if (propertyName != "length")
+                return false;
+
+            pushItem(*items, items->size(), property->span);
+            emitInteger(Opcodes::pushc_i, items->size(), property->span);
+            return true;
+        }
+
+        // If a property is set more than once, the last value wins
+        auto& properties = static_cast<const AstNodeLiteralObject*>(object)->getProperties();
+        auto it = std::find_if(properties.rbegin(), properties.rend(),
+                               [&propertyName](auto const& pair) { return pair.first == propertyName; });
+
+        if (it == properties.rend())
+            return false;
+
+        pushItem(*items, properties.rend() - it - 1, property->span);
+        return true;
+    }
+
+    bool FunctionAssembler::tryCompileForOverLiteral(const AstNodeForRange* forRange) {
+        auto range = forRange->getRange();
+        auto span = forRange->span;
+
+        // The generic loop evaluates the range at every step; with pure items, only the current one is needed
+        if (range->type != AstNodeExpression::Type::list || !isPure(range))
+            return false;
+
+        auto items = getLiteralItems(range);
+
+        if (!items)
+            return false;
+
+        auto iteratorVar = currentFunction->createLocal("(iterator)", nullptr);
+        auto itemVar = currentFunction->getOrAllocLocalIndex(forRange->getVariableName().c_str() );
+
+        emitInteger(Opcodes::pushc_i, 0, span);
+        emitLocal(Opcodes::setLocal, iteratorVar, span);
+
+        // if !(iterator < numItems)
+        //   break
+        unsigned begin = currentOffset();
+
+        emitLocal(Opcodes::getLocal, iteratorVar, span);
+        emitInteger(Opcodes::pushc_i, items->size(), span);
+        emit(Opcodes::less, span);
+        Instruction* jumpToEnd = add( Opcodes::jmp_false, span );
+
+        // item = switch (iterator) { case 0: items[0] ... }
+        emitLocal(Opcodes::getLocal, iteratorVar, span);
+        auto switchInstruction = add( Opcodes::op_switch, span );
+
+        SwitchTableDraft switchTable;
+        std::vector<Instruction*> storeJumps;
+
+        for (size_t i = 0; i < items->size(); i++) {
+            switchTable.cases.emplace_back(static_cast<Int_t>(i));
+            switchTable.handlers.push_back(currentOffset());
+
+            pushExpression((*items)[i]);
+
+            if (i + 1 < items->size())
+                storeJumps.push_back( add( Opcodes::jmp, span ) );
+        }
+
+        // Never taken; the iterator is always in range
+        switchTable.handlers.push_back(switchTable.handlers.back());
+        switchInstruction->switchTableIndex = getSwitchTableIndex(std::move(switchTable));
+
+        for (auto jump : storeJumps)
+            jump->codeAddr = currentOffset();
+
+        emitLocal(Opcodes::setLocal, itemVar, span);
+
+        compileStatement(forRange->getBlock());
+
+        // iterator += 1
+        emitLocal(Opcodes::getLocal, iteratorVar, span);
+        emitInteger(Opcodes::pushc_i, 1, span);
+        emit(Opcodes::op_add, span);
+        emitLocal(Opcodes::setLocal, iteratorVar, span);
+
+        add( Opcodes::jmp, span )->codeAddr = begin;
+
+        jumpToEnd->codeAddr = currentOffset();
+        return true;
+    }
+
+    void FunctionAssembler::raiseError(const char* message, const SourceSpan& span) {
+        errors.push_back(fmt::format("{}:{}: error: {}\n", *unitNameString, span.start.line, message));
 
         failed = true;
     }
 
-    void AssemblerState::unaryOperator(Opcodes::Opcode opcode, AstNodeUnaryExpr const& expr)
+    void FunctionAssembler::unaryOperator(Opcodes::Opcode opcode, AstNodeUnaryExpr const& expr)
     {
         pushExpression(expr.right.get());
         emit(opcode, expr.span);
     }
 
+    void FunctionAssembler::compile()
+    {
+        // Add function header + parameter loader
+
+        auto arguments = currentFunction->function->getArguments();
+        helium_assert_debug(arguments);
+
+        //if ( parameters->type == AstNodeType::list )
+        //{
+            // Ordinary fixed-argument function
+
+            size_t numArguments = arguments->decls.size();
+
+            scriptFunction = ScriptFunction {
+                    currentFunction->name,
+                    currentFunction->toBeExported,
+                    ScriptFunction::ArgumentListType::explicit_,
+                    numArguments,
+                    0,
+                    0,
+                    {},
+                    {},
+            };
+
+            for (auto& decl : arguments->decls) {
+                auto argName = decl.name.c_str();
+
+                currentFunction->addArgument(argName);
+                auto index = currentFunction->createLocal(argName, maybeGetType(decl.type.get()));
+
+                // TODO: argument type checking
+            }
+        /*}
+        else if ( parameters->type == AstNodeType::symbol )
+        {
+            // Variadic
+            auto argName = parameters->textValue;
+
+            add( Opcodes::func_var, parameters->line )->mode = currentFunction->getLocal( parameters->textValue );
+            currentFunction->addArgument( argName );
+        }*/
+
+        // Now compile the function body
+        compileStatement( currentFunction->function->getBody() );
+
+        // Implicit "return this" at the end of class methods
+        emitLocal(Opcodes::getLocal, LOCAL_THIS, currentFunction->function->span);
+        emit(Opcodes::ret, currentFunction->function->span);
+
+        scriptFunction.length = currentOffset();
+    }
+
+    void AssemblerState::compileFunctions(std::vector<FunctionAssembler>& assemblers)
+    {
+        auto numWorkers = std::min<size_t>(numThreads, assemblers.size() / minFunctionsPerThread);
+
+        if (numWorkers <= 1) {
+            for (auto& assembler : assemblers)
+                assembler.compile();
+
+            return;
+        }
+
+        std::atomic<size_t> next {0};
+
+        auto work = [&assemblers, &next] {
+            for (size_t i = next++; i < assemblers.size(); i = next++)
+                assemblers[i].compile();
+        };
+
+        // The calling thread is one of the workers
+        std::vector<std::thread> workers;
+
+        for (size_t i = 1; i < numWorkers; i++)
+            workers.emplace_back(work);
+
+        work();
+
+        for (auto& worker : workers)
+            worker.join();
+    }
+
     void AssemblerState::linearize( AstNodeScript& tree )
     {
         // Create an entry for .main function
@@ -1077,7 +1478,7 @@ namespace Helium
         main->function = tree.mainFunction.get();
         main->toBeExported = false;
         main->ownerClass = 0;
-        functions.push_back( main );
+        addFunction( main );
 
         for (auto& class_ : tree.classes) {
             compileClass(class_.get());
@@ -1086,82 +1487,112 @@ namespace Helium
         // TODO: Is this good enough?
         // Handling of anonymous & named functions should be probably unified
         for (auto& function : tree.functions) {
-            addFunctionForProcessing(function.get());
+            addFunction( createFunction(function.get()) );
         }
 
-        //* Iterate through the function list (which is incrementally built during the compilation!)
-        for ( size_t i = 0; i < functions.size(); i++ )
+        //* Anonymous functions are only discovered while compiling the function containing them, so the function list
+        //* is compiled in waves. Every wave is queued up behind the previous one in the order of discovery, so the
+        //* resulting module is the same regardless of the number of threads.
+        for ( size_t first = 0; first < functions.size(); )
         {
-            //* Register this function as being compiled
-            currentFunction = functions[i];
-            currentFunction->offset = currentOffset();
-            currentFunctionName = std::make_shared<std::string>( currentFunction->name );
-            //on_debug_printf( "%s:\t\t-- @ %i\n", currentFunctionName->c_str(), currentFunction->offset );
+            std::vector<FunctionAssembler> assemblers;
+            assemblers.reserve( functions.size() - first );
+
+            for ( ; first < functions.size(); first++ )
+                assemblers.emplace_back( functions[first], generateDebug, unitNameString );
 
-            // Add function header + parameter loader
+            compileFunctions( assemblers );
 
-            auto arguments = currentFunction->function->getArguments();
-            helium_assert_debug(arguments);
+            for ( auto& assembler : assemblers )
+            {
+                place( assembler );
 
-            auto startInstr = currentOffset();
+                for ( auto function : assembler.newFunctions )
+                    addFunction( function );
+            }
+        }
+    }
 
-            //if ( parameters->type == AstNodeType::list )
-            //{
-                // Ordinary fixed-argument function
+    void AssemblerState::place(FunctionAssembler& assembler)
+    {
+        for ( auto const& error : assembler.errors )
+            printf( "%s", error.c_str() );
 
-                size_t numArguments = arguments->decls.size();
+        if ( assembler.failed )
+            failed = true;
 
-                ScriptFunction scriptFunction {
-                        currentFunction->name,
-                        currentFunction->toBeExported,
-                        ScriptFunction::ArgumentListType::explicit_,
-                        numArguments,
-                        startInstr,
-                        0,
-                        {},
-                };
+        auto start = static_cast<CodeAddr_t>( script->code.size() );
+        helium_assert( script->code.size() + assembler.code.size() < std::numeric_limits<CodeAddr_t>::max() );
 
-                this->currentScriptFunction = &scriptFunction;
+        std::vector<size_t> stringRemap, temporaryStringRemap;
 
-                for (auto& decl : arguments->decls) {
-                    auto argName = decl.name.c_str();
+        for ( auto const& string : assembler.stringPool )
+            stringRemap.push_back( getStringIndex( string ) );
 
-                    currentFunction->addArgument(argName);
-                    auto index = currentFunction->createLocal(argName, maybeGetType(decl.type.get()));
+        for ( auto const& string : assembler.temporaryStrings )
+            temporaryStringRemap.push_back( getTemporaryStringIndex( string ) );
 
-                    // TODO: argument type checking
-                }
-            /*}
-			else if ( parameters->type == AstNodeType::symbol )
+        auto firstSwitchTable = script->switchTables.size();
+        std::unique_lock<std::mutex> heapLock( heapMutex, std::defer_lock );
+
+        if ( !assembler.switchTables.empty() )
+            heapLock.lock();
+
+        for ( auto& draft : assembler.switchTables )
+        {
+            auto switchTable = std::make_shared<SwitchTable>();
+
+            for ( auto const& case_ : draft.cases )
             {
-                // Variadic
-                auto argName = parameters->textValue;
+                if ( auto literal = std::get_if<const AstNodeLiteral*>( &case_ ) )
+                    switchTable->cases.push_back( getConstant( *literal ) );
+                else
+                    switchTable->cases.push_back( ValueRef::makeInteger( std::get<Int_t>( case_ ) ) );
+            }
 
-                add( Opcodes::func_var, parameters->line )->mode = currentFunction->getLocal( parameters->textValue );
-                currentFunction->addArgument( argName );
-            }*/
+            for ( auto handler : draft.handlers )
+                switchTable->handlers.push_back( start + handler );
+
+            switchTable->classify();
+            script->switchTables.emplace_back( std::move( switchTable ) );
+        }
 
-            // Now compile the function body
-            compileStatement( currentFunction->function->getBody() );
+        for ( Instruction* instr : assembler.code )
+        {
+            if ( instr->opcode == Opcodes::unknownCall || instr->opcode == Opcodes::unknownPush )
+            {
+                instr->stringIndex = temporaryStringRemap[instr->stringIndex];
+                unresolvedReferences.push_back( UnresolvedReference{ instr, assembler.currentFunction } );
+            }
+            else if ( Instruction::needsRelocation( instr->opcode ) )
+                instr->codeAddr += start;
+            else if ( instr->opcode == Opcodes::op_switch )
+                instr->switchTableIndex += firstSwitchTable;
+            else if ( InstructionDesc::getByOpcode( instr->opcode )->operandType == OperandType::string )
+                instr->stringIndex = stringRemap[instr->stringIndex];
+        }
 
-            // Implicit "return this" at the end of class methods
-            emitLocal(Opcodes::getLocal, LOCAL_THIS, currentFunction->function->span);
-            emit(Opcodes::ret, currentFunction->function->span);
+        script->code.insert( script->code.end(), assembler.code.begin(), assembler.code.end() );
 
-            scriptFunction.length = script->code.size() - startInstr;
-            this->currentScriptFunction = nullptr;
-            script->functions.emplace_back(std::move(scriptFunction));
-            currentFunction->scriptFunctionIndex = script->functions.size() - 1;
+        auto& scriptFunction = assembler.scriptFunction;
+        scriptFunction.start = start;
 
-            currentFunctionName.reset();
+        for ( auto& eh : scriptFunction.exceptionHandlers )
+        {
+            eh.start += start;
+            eh.handler += start;
         }
+
+        assembler.currentFunction->offset = start;
+        script->functions.emplace_back( std::move( scriptFunction ) );
+        assembler.currentFunction->scriptFunctionIndex = script->functions.size() - 1;
     }
 
     static bool isBuiltinInt(AstNodeTypeName* typeName) {
         return typeName->name == "Int";
     }
 
-    Type* AssemblerState::maybeGetType(AstNodeTypeName* maybeTypeName) {
+    Type* FunctionAssembler::maybeGetType(AstNodeTypeName* maybeTypeName) {
         if (!maybeTypeName)
             return nullptr;
 
@@ -1293,7 +1724,7 @@ namespace Helium
         func->toBeExported = !constructor->isPrivate;
 
         func->ownerClass = classDecl;
-        functions.push_back(func);
+        addFunction(func);
 
         // Compile other methods
         for (auto& method : nonConstructorMethods)
@@ -1304,19 +1735,19 @@ namespace Helium
             func->function = method;
             func->toBeExported = !method->isPrivate;
             func->ownerClass = classDecl;
-            functions.push_back(func);
+            addFunction(func);
         }
     }
 
     void AssemblerState::cook()
     {
-        for (Instruction* current: script->code) {
+        for (auto const& [current, parentFunction] : unresolvedReferences) {
             switch ( current->opcode )
             {
                 case Opcodes::unknownCall:
                 {
                     const auto& functionName = temporaryStrings[current->stringIndex];
-                    Function* function = findFunction( functionName.c_str() );
+                    Function* function = findFunction( functionName );
 
                     if ( !function )
                     // Not found, compiling as external...
@@ -1338,11 +1769,7 @@ namespace Helium
                 {
                     // Try to find the id of the referenced subroutine (if it /is/ one)
                     const auto& functionName = temporaryStrings[current->stringIndex];
-                    Function* function = findFunction( functionName.c_str() );
-
-                    // Pointer to the function this instruction comes from
-                    Function* parentFunction = unknownPushFuncPtrs[0];
-                    unknownPushFuncPtrs.erase( unknownPushFuncPtrs.begin() );
+                    Function* function = findFunction( functionName );
 
                     if ( !function )
                     {
@@ -1366,14 +1793,15 @@ namespace Helium
         }
     }
 
-    std::unique_ptr<Module> BytecodeCompiler::compile(AstNodeScript& tree, bool withDebugInformation, std::shared_ptr<std::string> unitNameString )
+    std::unique_ptr<Module> BytecodeCompiler::compile(AstNodeScript& tree, bool withDebugInformation, std::shared_ptr<std::string> unitNameString,
+                                                      unsigned numThreads )
     {
 #if HELIUM_TRACE_VALUES
         auto frame = string("compile: ") + *unitNameString;
         ValueTraceCtx tracking_ctx(frame.c_str());
 #endif
 
-        AssemblerState state{ withDebugInformation, unitNameString };
+        AssemblerState state{ withDebugInformation, unitNameString, std::max( numThreads, 1u ) };
 
         state.linearize( tree );
         state.cook();
@@ -1381,8 +1809,11 @@ namespace Helium
         // Cut-out the generated script from the Assembler State
         std::unique_ptr<Module> script = std::move(state.script);
 
-        if (state.failed)
+        if (state.failed) {
+            std::lock_guard<std::mutex> heapLock(heapMutex);
+            script.reset();
             return nullptr;
+        }
 
         return script;
     }
@@ -1,138 +1,800 @@
+#include <Helium/Assert.hpp>
 #include <Helium/Config.hpp>
 #include <Helium/Runtime/Code.hpp>
+#include <Helium/Runtime/RuntimeFunctions.hpp>
 
 #if HELIUM_TRACE_VALUES
 #include <Helium/Runtime/Debug/ValueTrace.hpp>
 #endif
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
 namespace Helium
 {
-    const unsigned short HeliumObject_magic = 0x2211;
+    /*
+     * Binary module format
+     *
+     * Integers are unsigned LEB128 unless noted otherwise; signed values are zigzag-encoded first.
+     * Strings are a length followed by the raw bytes. Constants are a ValueType byte followed by the value.
+     *
+     *   u32le      magic (Helium_object_magic)
+     *   u16le      format version (Module::binaryFormatVersion)
+     *   u16le      flags (moduleFlag_*)
+     *   u16le      Opcodes::numValidOpcodes of the writer
+     *   dependencies   count; name for each
+     *   string pool    count; string for each
+     *   switch tables  count; for each: number of cases, the case constants, number of cases + 1 handlers
+     *   functions      count; for each: name, exported (u8), argument list type (u8), number of explicit
+     *                  arguments, start, length, number of exception handlers, (start, length, handler) for each
+     *   code           count; for each: opcode, operand as given by InstructionDesc::operandType
+     *   debug info     only if moduleFlag_debugInformation is set:
+     *                  unit name; for each function the number of line table entries, then for each entry
+     *                  the offset minus the previous offset and the line minus the previous line (signed)
+     */
+    enum {
+        moduleFlag_debugInformation = 1,
+    };
+
+    namespace {
+        class ModuleWriter {
+        public:
+            void writeByte(uint8_t value) {
+                buffer.push_back(std::byte{value});
+            }
 
-#if 0
-    static bool serializeVariable(stream, Variable var) {
-        stream->writeLE<uint8_t>(var.type);
+            void writeU16(uint16_t value) {
+                writeByte(value & 0xff);
+                writeByte(value >> 8);
+            }
 
-        switch (var.type)
-        {
-        case ValueType::list:
-            stream->writeLE<uint32_t>(var.list->length);
+            void writeU32(uint32_t value) {
+                writeU16(value & 0xffff);
+                writeU16(value >> 16);
+            }
 
-            for (size_t i = 0; i < var.list->length; i++)
-                serializeVariable(stream, var.list->items[i]);
+            void writeUnsigned(uint64_t value) {
+                while (value >= 0x80) {
+                    writeByte((value & 0x7f) | 0x80);
+                    value >>= 7;
+                }
 
-            break;
+                writeByte(value);
+            }
 
-        case ValueType::integer:
-            stream->writeLE<int64_t>(var.integerValue);
-            break;
+            void writeSigned(int64_t value) {
+                writeUnsigned((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+            }
 
-        case ValueType::nil:
-            break;
+            void writeReal(Real_t value) {
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                writeU32(bits & 0xffffffff);
+                writeU32(bits >> 32);
+            }
 
-        case ValueType::real:
-            stream->write(&var.realValue, sizeof(var.realValue));
-            break;
+            void writeString(const void* data, size_t length) {
+                writeUnsigned(length);
 
-        case ValueType::object:
-            stream->writeLE<uint16_t>(var.object->numMembers);
+                auto bytes = static_cast<const std::byte*>(data);
+                buffer.insert(buffer.end(), bytes, bytes + length);
+            }
 
-            for (size_t i = 0; i < var.object->numMembers; i++)
-            {
-                stream->writeString(var.object->members[i].key);
-                serializeVariable(stream, var.object->members[i].value);
+            void writeString(std::string_view string) {
+                writeString(string.data(), string.size());
             }
 
-            break;
+            bool writeConstant(Value value) {
+                writeByte(static_cast<uint8_t>(value.type));
+
+                switch (value.type) {
+                    case ValueType::nil: return true;
+                    case ValueType::boolean: writeByte(value.booleanValue ? 1 : 0); return true;
+                    case ValueType::integer: writeSigned(value.integerValue); return true;
+                    case ValueType::real: writeReal(value.realValue); return true;
+                    case ValueType::string: writeString(value.string->text, value.length); return true;
+
+                    // Switch cases are literals; nothing else can appear in a module
+                    case ValueType::invalid:
+                    case ValueType::internal:
+                    case ValueType::nativeFunction:
+                    case ValueType::scriptFunction:
+                    case ValueType::list:
+                    case ValueType::object:
+                        return false;
+                }
+
+                helium_unreachable();
+            }
 
-        case ValueType::string:
-            stream->writeString(var.string->text);
-            break;
-        }
+            std::vector<std::byte> buffer;
+        };
 
-        return true;
-    }
-#endif
+        class ModuleReader {
+        public:
+            explicit ModuleReader(ReadCallback const& read) : read(read) {
+            }
 
-#if 0
-    bool deserializeVariable(stream, Variable* varRef_out) {
-        uint8_t type;
-        
-        if (!stream->readLE(&type))
-            return false;
+            bool readBytes(void* data_out, size_t length) {
+                auto bytes = static_cast<std::byte*>(data_out);
+
+                while (length > 0) {
+                    if (pos == available && !refill())
+                        return false;
+
+                    auto count = std::min(length, available - pos);
+                    memcpy(bytes, buffer + pos, count);
+                    pos += count;
+                    bytes += count;
+                    length -= count;
+                }
+
+                return true;
+            }
+
+            bool readByte(uint8_t* value_out) {
+                return readBytes(value_out, 1);
+            }
+
+            bool readU16(uint16_t* value_out) {
+                uint8_t bytes[2];
+
+                if (!readBytes(bytes, sizeof(bytes)))
+                    return false;
+
+                *value_out = bytes[0] | (bytes[1] << 8);
+                return true;
+            }
+
+            bool readU32(uint32_t* value_out) {
+                uint16_t low, high;
+
+                if (!readU16(&low) || !readU16(&high))
+                    return false;
+
+                *value_out = low | (static_cast<uint32_t>(high) << 16);
+                return true;
+            }
 
-        switch (type)
-        {
-        case ValueType::integer: {
-            int64_t integerValue;
+            bool readUnsigned(uint64_t* value_out) {
+                uint64_t value = 0;
+
+                for (unsigned shift = 0; shift < 64; shift += 7) {
+                    uint8_t byte;
+
+                    if (!readByte(&byte))
+                        return false;
+
+                    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+                    if (!(byte & 0x80)) {
+                        *value_out = value;
+                        return true;
+                    }
+                }
 
-            if (!stream->readLE(&integerValue))
                 return false;
+            }
 
-            *varRef_out = Variable::newInteger(integerValue);
-            return true;
+            // Reads an unsigned integer that must be less than `limit`
+            template <typename Type>
+            bool readIndex(Type* value_out, uint64_t limit) {
+                uint64_t value;
+
+                if (!readUnsigned(&value) || value >= limit || value > std::numeric_limits<Type>::max())
+                    return false;
+
+                *value_out = static_cast<Type>(value);
+                return true;
+            }
+
+            bool readSigned(int64_t* value_out) {
+                uint64_t value;
+
+                if (!readUnsigned(&value))
+                    return false;
+
+                *value_out = static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+                return true;
+            }
+
+            bool readReal(Real_t* value_out) {
+                uint32_t low, high;
+
+                if (!readU32(&low) || !readU32(&high))
+                    return false;
+
+                uint64_t bits = low | (static_cast<uint64_t>(high) << 32);
+                memcpy(value_out, &bits, sizeof(bits));
+                return true;
+            }
+
+            // The string is read in chunks, so that a corrupted length fails at the end of the data
+            // instead of causing a huge allocation
+            template <typename Container>
+            bool readString(Container* string_out) {
+                uint64_t length;
+
+                if (!readUnsigned(&length))
+                    return false;
+
+                string_out->clear();
+
+                while (length > 0) {
+                    uint8_t chunk[256];
+                    auto count = std::min<uint64_t>(length, sizeof(chunk));
+
+                    if (!readBytes(chunk, count))
+                        return false;
+
+                    string_out->insert(string_out->end(), chunk, chunk + count);
+                    length -= count;
+                }
+
+                return true;
+            }
+
+            bool readConstant(ValueRef* value_out) {
+                uint8_t type;
+
+                if (!readByte(&type))
+                    return false;
+
+                switch (static_cast<ValueType>(type)) {
+                    case ValueType::nil:
+                        *value_out = ValueRef::makeNil();
+                        return true;
+
+                    case ValueType::boolean: {
+                        uint8_t value;
+
+                        if (!readByte(&value) || value > 1)
+                            return false;
+
+                        *value_out = ValueRef::makeBoolean(value != 0);
+                        return true;
+                    }
+
+                    case ValueType::integer: {
+                        int64_t value;
+
+                        if (!readSigned(&value))
+                            return false;
+
+                        *value_out = ValueRef::makeInteger(value);
+                        return true;
+                    }
+
+                    case ValueType::real: {
+                        Real_t value;
+
+                        if (!readReal(&value))
+                            return false;
+
+                        *value_out = ValueRef::makeReal(value);
+                        return true;
+                    }
+
+                    case ValueType::string: {
+                        std::string value;
+
+                        if (!readString(&value))
+                            return false;
+
+                        *value_out = ValueRef::makeStringWithLength(value.c_str(), value.size());
+                        return (*value_out)->type == ValueType::string;
+                    }
+
+                    default:
+                        return false;
+                }
+            }
+
+        private:
+            bool refill() {
+                pos = 0;
+                available = read(span<std::byte>(buffer, sizeof(buffer)));
+
+                if (available > sizeof(buffer))
+                    available = 0;
+
+                return available > 0;
+            }
+
+            ReadCallback const& read;
+            std::byte buffer[4096];
+            size_t pos = 0, available = 0;
+        };
+
+        void writeOperand(ModuleWriter& writer, Instruction const& instruction) {
+            switch (InstructionDesc::getByOpcode(instruction.opcode)->operandType) {
+                case OperandType::none: break;
+                case OperandType::codeAddress: writer.writeUnsigned(instruction.codeAddr); break;
+                case OperandType::functionIndex: writer.writeUnsigned(instruction.functionIndex); break;
+                case OperandType::integer: writer.writeSigned(instruction.integer); break;
+                case OperandType::localIndex: writer.writeSigned(instruction.integer); break;
+                case OperandType::real: writer.writeReal(instruction.realValue); break;
+                case OperandType::registers: writer.writeSigned(instruction.integer); break;
+                case OperandType::string: writer.writeUnsigned(instruction.stringIndex); break;
+                case OperandType::switchTable: writer.writeUnsigned(instruction.switchTableIndex); break;
+            }
         }
 
-        case ValueType::nil:
-            *varRef_out = Variable::newNul();
-            return true;
+        bool readOperand(ModuleReader& reader, Module const& module, Instruction& instruction) {
+            switch (InstructionDesc::getByOpcode(instruction.opcode)->operandType) {
+                case OperandType::none:
+                    return true;
+
+                case OperandType::codeAddress:
+                    // The target is checked once the length of the code is known
+                    return reader.readIndex(&instruction.codeAddr, std::numeric_limits<CodeAddr_t>::max());
+
+                case OperandType::functionIndex:
+                    return reader.readIndex(&instruction.functionIndex, module.functions.size());
+
+                case OperandType::integer:
+                case OperandType::localIndex:
+                    if (!reader.readSigned(&instruction.integer))
+                        return false;
+
+                    if (instruction.opcode == Opcodes::call_ext)
+                        return instruction.integer >= 0
+                               && static_cast<uint64_t>(instruction.integer) < module.dependencies.size();
+
+                    return true;
+
+                case OperandType::real:
+                    return reader.readReal(&instruction.realValue);
 
-        case ValueType::real: {
-            double realValue;
+                case OperandType::registers:
+                    return reader.readSigned(&instruction.integer);
 
-            if (!stream->read(&realValue, sizeof(realValue)))
+                case OperandType::string:
+                    return reader.readIndex(&instruction.stringIndex, module.stringPool.size());
+
+                case OperandType::switchTable:
+                    return reader.readIndex(&instruction.switchTableIndex, module.switchTables.size());
+            }
+
+            helium_unreachable();
+        }
+
+        bool readFunction(ModuleReader& reader, ScriptFunction* function_out) {
+            uint8_t exported, argumentListType;
+            uint64_t numExceptionHandlers;
+
+            if (!reader.readString(&function_out->name)
+                    || !reader.readByte(&exported) || exported > 1
+                    || !reader.readByte(&argumentListType)
+                    || argumentListType != static_cast<uint8_t>(ScriptFunction::ArgumentListType::explicit_)
+                    || !reader.readIndex(&function_out->numExplicitArguments, LOCALS_MAX)
+                    || !reader.readIndex(&function_out->start, std::numeric_limits<CodeAddr_t>::max())
+                    || !reader.readIndex(&function_out->length, std::numeric_limits<CodeAddr_t>::max())
+                    || !reader.readUnsigned(&numExceptionHandlers))
                 return false;
 
-            *varRef_out = Variable::newReal(realValue);
+            function_out->exported = (exported != 0);
+            function_out->argumentListType = ScriptFunction::ArgumentListType::explicit_;
+
+            for (uint64_t i = 0; i < numExceptionHandlers; i++) {
+                Eh eh;
+
+                if (!reader.readIndex(&eh.start, std::numeric_limits<CodeAddr_t>::max())
+                        || !reader.readIndex(&eh.length, std::numeric_limits<CodeAddr_t>::max())
+                        || !reader.readIndex(&eh.handler, std::numeric_limits<CodeAddr_t>::max()))
+                    return false;
+
+                function_out->exceptionHandlers.push_back(eh);
+            }
+
             return true;
         }
 
-        case ValueType::object: {
-            uint16_t numMembers;
-
-            if (!stream->readLE(&numMembers))
+        bool readDebugInformation(ModuleReader& reader, Module& module) {
+            if (!reader.readString(&module.unitName))
                 return false;
 
-            AutoVariable object = Variable::newObject(nullptr);
+            for (auto& function : module.functions) {
+                uint64_t numEntries;
 
-            for (uint16_t i = 0; i < numMembers; i++) {
-                name = stream->readString();
-                Variable nextRef;
-                
-                if (!deserializeVariable(stream, &nextRef))
+                if (!reader.readIndex(&numEntries, static_cast<uint64_t>(function.length) + 1))
                     return false;
 
-                object.setMember(name, nextRef);
+                uint64_t offset = 0;
+                int64_t line = 0;
+
+                for (uint64_t i = 0; i < numEntries; i++) {
+                    uint64_t offsetDelta;
+                    int64_t lineDelta;
+
+                    // Offsets must be strictly increasing and within the function
+                    if (!reader.readUnsigned(&offsetDelta) || (i > 0 && offsetDelta == 0)
+                            || offsetDelta >= function.length - offset
+                            || !reader.readSigned(&lineDelta))
+                        return false;
+
+                    offset += offsetDelta;
+                    line += lineDelta;
+
+                    if (line < std::numeric_limits<int>::min() || line > std::numeric_limits<int>::max())
+                        return false;
+
+                    function.lineTable.entries.push_back(LineTable::Entry{static_cast<CodeAddr_t>(offset),
+                                                                          static_cast<int>(line)});
+                }
             }
 
-            *varRef_out = object.detach();
             return true;
         }
 
-        case ValueType::string: {
-            value = stream->readString();
-            *varRef_out = Variable::newString(value, value.getNumBytes());
+        // Jump targets and code ranges can only be checked once everything has been read
+        bool validateCodeAddresses(Module const& module) {
+            auto codeSize = module.code.size();
+
+            for (auto instruction : module.code) {
+                if (InstructionDesc::getByOpcode(instruction->opcode)->operandType == OperandType::codeAddress
+                        && instruction->codeAddr > codeSize)
+                    return false;
+            }
+
+            for (auto const& function : module.functions) {
+                if (static_cast<size_t>(function.start) + function.length > codeSize)
+                    return false;
+
+                for (auto const& eh : function.exceptionHandlers) {
+                    if (static_cast<size_t>(eh.start) + eh.length > codeSize || eh.handler > codeSize)
+                        return false;
+                }
+            }
+
+            for (auto const& switchTable : module.switchTables) {
+                for (auto handler : switchTable->handlers) {
+                    if (handler > codeSize)
+                        return false;
+                }
+            }
+
             return true;
         }
+    }
+
+    bool Module::isBinaryModule(span<const std::byte> header) {
+        if (header.size() < 4)
+            return false;
+
+        uint32_t magic = 0;
+
+        for (size_t i = 0; i < 4; i++)
+            magic |= static_cast<uint32_t>(header[i]) << (i * 8);
+
+        return magic == Helium_object_magic;
+    }
+
+    bool Module::save(WriteCallback const& write, bool withDebugInformation) const {
+        ModuleWriter writer;
+
+        writer.writeU32(Helium_object_magic);
+        writer.writeU16(binaryFormatVersion);
+        writer.writeU16(withDebugInformation ? moduleFlag_debugInformation : 0);
+        writer.writeU16(Opcodes::numValidOpcodes);
+
+        writer.writeUnsigned(dependencies.size());
+
+        for (auto const& dependency : dependencies)
+            writer.writeString(dependency);
+
+        writer.writeUnsigned(stringPool.size());
+
+        for (auto const& string : stringPool)
+            writer.writeString(string.data(), string.size());
+
+        writer.writeUnsigned(switchTables.size());
+
+        for (auto const& switchTable : switchTables) {
+            writer.writeUnsigned(switchTable->cases.size());
+
+            for (auto& case_ : switchTable->cases) {
+                if (!writer.writeConstant(case_))
+                    return false;
+            }
+
+            for (auto handler : switchTable->handlers)
+                writer.writeUnsigned(handler);
+        }
+
+        writer.writeUnsigned(functions.size());
+
+        for (auto const& function : functions) {
+            writer.writeString(function.name);
+            writer.writeByte(function.exported ? 1 : 0);
+            writer.writeByte(static_cast<uint8_t>(function.argumentListType));
+            writer.writeUnsigned(function.numExplicitArguments);
+            writer.writeUnsigned(function.start);
+            writer.writeUnsigned(function.length);
+            writer.writeUnsigned(function.exceptionHandlers.size());
+
+            for (auto const& eh : function.exceptionHandlers) {
+                writer.writeUnsigned(eh.start);
+                writer.writeUnsigned(eh.length);
+                writer.writeUnsigned(eh.handler);
+            }
+        }
+
+        writer.writeUnsigned(code.size());
+
+        for (auto instruction : code) {
+            writer.writeUnsigned(instruction->opcode);
+            writeOperand(writer, *instruction);
         }
+
+        if (withDebugInformation) {
+            writer.writeString(unitName);
+
+            for (auto const& function : functions) {
+                writer.writeUnsigned(function.lineTable.entries.size());
+
+                CodeAddr_t offset = 0;
+                int line = 0;
+
+                for (auto const& entry : function.lineTable.entries) {
+                    writer.writeUnsigned(entry.offset - offset);
+                    writer.writeSigned(static_cast<int64_t>(entry.line) - line);
+
+                    offset = entry.offset;
+                    line = entry.line;
+                }
+            }
+        }
+
+        return write(span<const std::byte>(writer.buffer.data(), writer.buffer.size())) == writer.buffer.size();
     }
+
+    std::unique_ptr<Module> Module::load(ReadCallback const& read) {
+#if HELIUM_TRACE_VALUES
+        ValueTraceCtx tracking_ctx("Module::load");
 #endif
 
-    Instruction::Instruction( const Instruction& other )
-            : opcode( other.opcode ),
-              codeAddr( other.codeAddr ),
-              functionIndex( other.functionIndex ),
-              integer( other.integer ),
-              realValue( other.realValue ),
-              stringIndex( other.stringIndex ),
-              switchTableIndex( other.switchTableIndex )
+        ModuleReader reader(read);
+
+        uint32_t magic;
+        uint16_t version, flags, numOpcodes;
+
+        if (!reader.readU32(&magic) || magic != Helium_object_magic
+                || !reader.readU16(&version) || version != binaryFormatVersion
+                || !reader.readU16(&flags) || (flags & ~moduleFlag_debugInformation) != 0
+                || !reader.readU16(&numOpcodes) || numOpcodes != Opcodes::numValidOpcodes)
+            return nullptr;
+
+        auto module = std::make_unique<Module>();
+        uint64_t count;
+
+        if (!reader.readUnsigned(&count))
+            return nullptr;
+
+        for (uint64_t i = 0; i < count; i++) {
+            std::string dependency;
+
+            if (!reader.readString(&dependency))
+                return nullptr;
+
+            module->dependencies.push_back(std::move(dependency));
+        }
+
+        if (!reader.readUnsigned(&count))
+            return nullptr;
+
+        for (uint64_t i = 0; i < count; i++) {
+            std::vector<uint8_t> string;
+
+            if (!reader.readString(&string))
+                return nullptr;
+
+            module->stringPool.push_back(std::move(string));
+        }
+
+        if (!reader.readUnsigned(&count))
+            return nullptr;
+
+        for (uint64_t i = 0; i < count; i++) {
+            auto switchTable = std::make_shared<SwitchTable>();
+            uint64_t numCases;
+
+            if (!reader.readUnsigned(&numCases))
+                return nullptr;
+
+            for (uint64_t j = 0; j < numCases; j++) {
+                ValueRef case_;
+
+                if (!reader.readConstant(&case_))
+                    return nullptr;
+
+                switchTable->cases.push_back(std::move(case_));
+            }
+
+            for (uint64_t j = 0; j < numCases + 1; j++) {
+                CodeAddr_t handler;
+
+                if (!reader.readIndex(&handler, std::numeric_limits<CodeAddr_t>::max()))
+                    return nullptr;
+
+                switchTable->handlers.push_back(handler);
+            }
+
+            switchTable->classify();
+            module->switchTables.push_back(std::move(switchTable));
+        }
+
+        if (!reader.readUnsigned(&count))
+            return nullptr;
+
+        for (uint64_t i = 0; i < count; i++) {
+            ScriptFunction function;
+
+            if (!readFunction(reader, &function))
+                return nullptr;
+
+            module->functions.push_back(std::move(function));
+        }
+
+        if (!reader.readIndex(&count, std::numeric_limits<CodeAddr_t>::max()))
+            return nullptr;
+
+        for (uint64_t i = 0; i < count; i++) {
+            auto instruction = std::make_unique<Instruction>();
+
+            if (!reader.readIndex(&instruction->opcode, Opcodes::numValidOpcodes)
+                    || !readOperand(reader, *module, *instruction))
+                return nullptr;
+
+            module->code.push_back(instruction.release());
+        }
+
+        // Line table offsets are checked against function lengths, which are checked here
+        if (!validateCodeAddresses(*module))
+            return nullptr;
+
+        if ((flags & moduleFlag_debugInformation) && !readDebugInformation(reader, *module))
+            return nullptr;
+
+        return module;
+    }
+
+    namespace {
+        // A dense switch table may have at most this many slots per case, i.e. at least a quarter of them is used
+        constexpr uint64_t maxDenseSlotsPerCase = 4;
+
+        bool stringEquals(Value left, Value right) {
+            return left.length == right.length && memcmp(left.string->text, right.string->text, left.length) == 0;
+        }
+    }
+
+    void SwitchTable::classify()
     {
-        origin = other.origin ? new InstructionOrigin( other.origin ) : 0;
+        kind = Kind::linear;
+        minimum = 0;
+        caseIndices.clear();
+        sortedCases.clear();
+        caseHashes.clear();
+
+        auto numCases = cases.size();
+
+        if (numCases == 0 || numCases >= std::numeric_limits<uint32_t>::max())
+            return;
+
+        // Values of different types never compare equal, so only homogeneous tables can use a typed lookup
+        auto type = static_cast<Value>(cases[0]).type;
+
+        for (auto const& case_ : cases) {
+            if (static_cast<Value>(case_).type != type)
+                return;
+        }
+
+        if (type == ValueType::integer) {
+            for (size_t i = 0; i < numCases; i++)
+                sortedCases.emplace_back(static_cast<Value>(cases[i]).integerValue, i);
+
+            // Of duplicate cases, only the first one can ever match
+            std::stable_sort(sortedCases.begin(), sortedCases.end(),
+                             [](auto const& left, auto const& right) { return left.first < right.first; });
+            sortedCases.erase(std::unique(sortedCases.begin(), sortedCases.end(),
+                                          [](auto const& left, auto const& right) { return left.first == right.first; }),
+                              sortedCases.end());
+
+            auto range = static_cast<uint64_t>(sortedCases.back().first) - static_cast<uint64_t>(sortedCases.front().first);
+
+            if (range >= maxDenseSlotsPerCase * numCases) {
+                kind = Kind::sparseInteger;
+                return;
+            }
+
+            kind = Kind::denseInteger;
+            minimum = sortedCases.front().first;
+            caseIndices.assign(range + 1, numCases);
+
+            for (auto const& [value, index] : sortedCases)
+                caseIndices[static_cast<uint64_t>(value) - static_cast<uint64_t>(minimum)] = index;
+
+            sortedCases.clear();
+        }
+        else if (type == ValueType::string) {
+            kind = Kind::stringHash;
+
+            // At most half full, so that probe sequences stay short
+            size_t numSlots = 1;
+
+            while (numSlots < 2 * numCases)
+                numSlots *= 2;
+
+            caseIndices.assign(numSlots, numCases);
+
+            for (size_t i = 0; i < numCases; i++) {
+                Value case_ = cases[i];
+                auto hash = Hash::fromString(case_.string->text, case_.length);
+                caseHashes.push_back(hash);
+
+                auto slot = hash & (numSlots - 1);
+
+                for (; caseIndices[slot] != numCases; slot = (slot + 1) & (numSlots - 1)) {
+                    if (caseHashes[caseIndices[slot]] == hash && stringEquals(cases[caseIndices[slot]], case_))
+                        break;
+                }
+
+                if (caseIndices[slot] == numCases)
+                    caseIndices[slot] = i;
+            }
+        }
     }
 
-    Instruction::~Instruction()
+    size_t SwitchTable::findCase(Value value) const
     {
-        delete origin;
+        switch (kind) {
+            case Kind::linear:
+                for (size_t i = 0; i < cases.size(); i++) {
+                    bool equals;
+
+                    if (RuntimeFunctions::operatorEquals(value, cases[i], &equals) && equals)
+                        return i;
+                }
+                break;
+
+            case Kind::denseInteger:
+                if (value.type == ValueType::integer) {
+                    // Values below the minimum wrap around and fail the range check as well
+                    auto slot = static_cast<uint64_t>(value.integerValue) - static_cast<uint64_t>(minimum);
+
+                    if (slot < caseIndices.size())
+                        return caseIndices[slot];
+                }
+                break;
+
+            case Kind::sparseInteger:
+                if (value.type == ValueType::integer) {
+                    auto iter = std::lower_bound(sortedCases.begin(), sortedCases.end(), value.integerValue,
+                                                 [](auto const& entry, Int_t value) { return entry.first < value; });
+
+                    if (iter != sortedCases.end() && iter->first == value.integerValue)
+                        return iter->second;
+                }
+                break;
+
+            case Kind::stringHash:
+                if (value.type == ValueType::string) {
+                    auto hash = Hash::fromString(value.string->text, value.length);
+                    auto mask = caseIndices.size() - 1;
+
+                    for (auto slot = hash & mask; caseIndices[slot] != cases.size(); slot = (slot + 1) & mask) {
+                        auto index = caseIndices[slot];
+
+                        if (caseHashes[index] == hash && stringEquals(cases[index], value))
+                            return index;
+                    }
+                }
+                break;
+        }
+
+        return cases.size();
     }
 
     bool Instruction::needsRelocation( Opcode_t opcode )
@@ -142,6 +804,50 @@ namespace Helium
                || opcode == Opcodes::jmp_false;
     }
 
+    void LineTable::addLine(CodeAddr_t offset, int line)
+    {
+        helium_assert_debug(entries.empty() || offset >= entries.back().offset);
+
+        if (!entries.empty() && entries.back().line == line)
+            return;
+
+        // A previous run with no instructions of its own is replaced
+        if (!entries.empty() && entries.back().offset == offset)
+            entries.back().line = line;
+        else
+            entries.push_back(Entry{offset, line});
+    }
+
+    int LineTable::getLine(CodeAddr_t offset) const
+    {
+        auto next = std::upper_bound(entries.begin(), entries.end(), offset,
+                                     [](CodeAddr_t offset, Entry const& entry) { return offset < entry.offset; });
+
+        if (next == entries.begin())
+            return -1;
+
+        return (next - 1)->line;
+    }
+
+    void LineTable::removeInstruction(CodeAddr_t offset, CodeAddr_t newFunctionLength)
+    {
+        for (auto& entry : entries) {
+            if (entry.offset > offset)
+                entry.offset--;
+        }
+
+        // Drop runs that became empty
+        for (size_t i = 1; i < entries.size(); ) {
+            if (entries[i].offset == entries[i - 1].offset)
+                entries.erase(entries.begin() + i - 1);
+            else
+                i++;
+        }
+
+        if (!entries.empty() && entries.back().offset >= newFunctionLength)
+            entries.pop_back();
+    }
+
     Module::~Module()
     {
 #if HELIUM_TRACE_VALUES
@@ -150,6 +856,9 @@ namespace Helium
 
         switchTables.clear();
 
+        for (auto instruction : code)
+            delete instruction;
+
         code.clear();
     }
 }
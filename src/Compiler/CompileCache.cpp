@@ -0,0 +1,64 @@
+#include <Helium/Compiler/CompileCache.hpp>
+#include <Helium/Compiler/Compiler.hpp>
+
+#include <fmt/format.h>
+#include <xxhash.h>
+
+#include <fstream>
+#include <random>
+
+namespace Helium
+{
+    using fmt::format;
+
+    CompileCache::CompileCache(std::filesystem::path directory, uint32_t flags)
+            : directory(std::move(directory)), flags(flags) {
+    }
+
+    std::unique_ptr<Module> CompileCache::load(std::filesystem::path const& fileName, std::string_view source) const {
+        std::ifstream file(getEntryPath(fileName, source), std::ios::binary);
+
+        if (!file)
+            return nullptr;
+
+        return Module::load([&file](span<std::byte> buffer) {
+            file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+            return static_cast<size_t>(file.gcount());
+        });
+    }
+
+    void CompileCache::store(std::filesystem::path const& fileName, std::string_view source, Module const& module) const {
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+
+        auto entryPath = getEntryPath(fileName, source);
+        auto temporaryPath = entryPath;
+        temporaryPath += format(".{:08x}.tmp", std::random_device()());
+
+        bool saved;
+
+        {
+            std::ofstream file(temporaryPath, std::ios::binary);
+
+            saved = file && module.save([&file](span<const std::byte> data) {
+                file.write(reinterpret_cast<const char*>(data.data()), data.size());
+                return file ? data.size() : 0;
+            });
+        }
+
+        if (saved)
+            std::filesystem::rename(temporaryPath, entryPath, ec);
+
+        if (!saved || ec)
+            std::filesystem::remove(temporaryPath, ec);
+    }
+
+    std::filesystem::path CompileCache::getEntryPath(std::filesystem::path const& fileName,
+                                                     std::string_view source) const {
+        // The unit name is part of the key because it is recorded in the debug information
+        auto unitName = fileName.string();
+        auto hash = XXH64(source.data(), source.size(), XXH64(unitName.data(), unitName.size(), 0));
+
+        return directory / format("{:016x}-{}-{:x}.hem", hash, static_cast<int>(Compiler::version), flags);
+    }
+}
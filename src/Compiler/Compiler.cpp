@@ -6,10 +6,12 @@
 
 #include <fmt/format.h>
 
+#include <algorithm>
 #include <fstream>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #ifdef HELIUM_ENABLE_FORMAL
 #include <Helium/Formal/FormalAnalyzer.hpp>
@@ -60,18 +62,37 @@ namespace Helium
         return compileString( fileName, source );
     }
 
-    std::unique_ptr<Module> Compiler::compileString(std::filesystem::path const& fileName, std::string_view source)
+    std::unique_ptr<Module> Compiler::compileString(std::filesystem::path const& fileName, std::string_view source,
+                                                    CompileStatistics* statistics_out)
     {
+        using Clock = std::chrono::steady_clock;
+
         auto fileNameAsString = fileName.string();
 
         currentUnitName.push( std::make_shared<string>( fileNameAsString ) );
 
+        if (statistics_out) {
+            *statistics_out = CompileStatistics{};
+
+            auto start = Clock::now();
+            Lexer lexer( this, fileNameAsString.c_str(), source );
+
+            while (lexer.readToken())
+                statistics_out->numTokens++;
+
+            statistics_out->lexerTime = Clock::now() - start;
+        }
+
+        auto parseStart = Clock::now();
+
         LinearAllocator astAllocator(LinearAllocator::kDefaultBlockSize);
         Lexer lexer( this, fileNameAsString.c_str(), source );
         Parser parser( this, &lexer, astAllocator );
 
         pool_ptr<AstNodeScript> tree = parser.parseScript();
 
+        auto parseEnd = Clock::now();
+
         // Print out the AST
         /*tree->mainFunction->body->print(0);
 
@@ -94,9 +115,18 @@ namespace Helium
         fa.verifyScript(tree.get());
 #endif
 
-        std::unique_ptr<Module> script = BytecodeCompiler::compile(*tree, true, currentUnitName.top() );
-
-        //printf("[%s] AST memory: %zu bytes (%zu including overhead)\n", unitName, astAllocator.getMemoryUsage(), astAllocator.getMemoryUsageInclOverhead());
+        auto compileStart = Clock::now();
+        auto numBytecodeThreads = numThreads ? numThreads : std::thread::hardware_concurrency();
+        std::unique_ptr<Module> script = BytecodeCompiler::compile(*tree, withDebugInformation, currentUnitName.top(),
+                                                                   numBytecodeThreads );
+
+        if (statistics_out) {
+            statistics_out->parserTime = std::max<std::chrono::nanoseconds>(
+                    parseEnd - parseStart - statistics_out->lexerTime, std::chrono::nanoseconds::zero());
+            statistics_out->bytecodeCompilerTime = Clock::now() - compileStart;
+            statistics_out->astMemoryUsage = astAllocator.getMemoryUsage();
+            statistics_out->astMemoryUsageInclOverhead = astAllocator.getMemoryUsageInclOverhead();
+        }
 
         currentUnitName.pop();
 
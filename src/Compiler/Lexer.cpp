@@ -1,13 +1,15 @@
 #include <Helium/Compiler/Lexer.hpp>
-#include <sstream>
 
+#include <charconv>
 #include <cstring>
+#include <limits>
+#include <sstream>
 
 #define charToken( char_, type_ ) else if ( read( char_ ) )\
-    return new TokenPrimitive( type_, SourceSpan(start, point), indent );
+    return newToken( type_, start );
 
 #define bicharToken( chars_, type_ ) else if ( read( chars_, 2 ) )\
-    return new TokenPrimitive( type_, SourceSpan(start, point), indent );
+    return newToken( type_, start );
 
 namespace Helium
 {
@@ -29,13 +31,36 @@ namespace Helium
         return isNumeric( c ) || ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || c == '_';
     }
 
+    // Out-of-range values saturate, as they did with strtoul
+    static Int_t parseUnsigned( const char* first, const char* last, int base )
+    {
+        uint64_t value = 0;
+
+        if ( std::from_chars( first, last, value, base ).ec == std::errc::result_out_of_range )
+            value = std::numeric_limits<uint64_t>::max();
+
+        return static_cast<Int_t>( value );
+    }
+
+    static Real_t parseReal( const char* first, const char* last )
+    {
+        Real_t value = 0;
+
+        // Overflow and underflow are rare enough to leave to strtod, which rounds them the way it always has
+        if ( std::from_chars( first, last, value ).ec == std::errc::result_out_of_range )
+            value = strtod( std::string( first, last ).c_str(), nullptr );
+
+        return value;
+    }
+
     Lexer::Lexer( Compiler* compiler, const char* fileName, std::string_view script )
             : point{fileName, 1, 0, 0},
               nextPoint{fileName, 1, 1, 0},
               source_start(script.data()),
               source(script.data()),
               indent( 0 ),
-              fixedIndent( -1 )
+              fixedIndent( -1 ),
+              numTokensRead( 0 )
     {
         end = source_start + script.size();
     }
@@ -97,6 +122,20 @@ namespace Helium
             return false;
     }
 
+    Token* Lexer::newToken( TokenType type, SourcePoint start )
+    {
+        auto token = &tokens[numTokensRead++ % tokenRingSize];
+        *token = Token{ type, SourceSpan( start, point ), indent, false, {}, 0, 0.0, false };
+        return token;
+    }
+
+    std::string& Lexer::getDecodedTextBuffer()
+    {
+        auto& buffer = decodedText[numTokensRead % tokenRingSize];
+        buffer.clear();
+        return buffer;
+    }
+
     Token* Lexer::readToken()
     {
         while ( source < end )
@@ -142,43 +181,66 @@ namespace Helium
         // Numeric values
         if ( isNumeric( *source ) )
         {
-            // TODO: a more efficient type?
-            std::stringstream number;
-            number << read();
-
+            auto digits = source;
             bool isFloating = false;
 
-			while ( ( isNumeric( *source ) || *source == '.' ) && source < end )
+            while ( source < end && ( isNumeric( *source ) || *source == '.' ) )
             {
-                char c = read();
-                number << c;
-
-                if ( c == '.' )
+                if ( read() == '.' )
                     isFloating = true;
             }
 
-			if ( isFloating )
-                return new TokenLiteralReal(Token_number, SourceSpan(start, point), indent, strtod(number.str().c_str(), 0));
-			else
-                return new TokenLiteralInteger(Token_integer, SourceSpan(start, point), indent, strtoul( number.str().c_str(), 0, 10 ));
+            // Anything following a second period is ignored, as strtod would
+            if ( isFloating )
+            {
+                auto token = newToken( Token_number, start );
+                token->realValue = parseReal( digits, source );
+                return token;
+            }
+            else
+            {
+                auto token = newToken( Token_integer, start );
+                token->integerValue = parseUnsigned( digits, source, 10 );
+                return token;
+            }
         }
 
 		// Hexadecimal numeric values
 		if ( *source == '#' )
         {
             read();
-            std::string number;
+            auto digits = source;
 
-			while ( isHexaNumeric( *source ) && source < end )
-                number += read();
+            while ( source < end && isHexaNumeric( *source ) )
+                read();
 
-            return new TokenLiteralInteger(Token_integer, SourceSpan(start, point), indent, strtoul( number.c_str(), 0, 16 ));
+            auto token = newToken( Token_integer, start );
+            token->integerValue = parseUnsigned( digits, source, 16 );
+            return token;
 		}
 
         // String constants
         if ( read( '\'' ) )
         {
-            std::string buffer = "";
+            auto text = source;
+            auto closing = source;
+
+            while ( closing < end && *closing != '\'' && *closing != '$' )
+                closing++;
+
+            // Without escapes or doubled apostrophes, the text can stay in the source
+            if ( closing < end && *closing == '\'' && ( closing + 1 >= end || closing[1] != '\'' ) )
+            {
+                while ( source <= closing )
+                    read();
+
+                auto token = newToken( Token_string, start );
+                token->usedFixedIndent = ( fixedIndent >= 0 );
+                token->text = std::string_view( text, closing - text );
+                return token;
+            }
+
+            auto& buffer = getDecodedTextBuffer();
             bool wasApostrophe = false, wasDollar = false;  //* Was the last character an apostrophe or a dollar sign?
 
             //* Read the whole string  -- we will stop when reaching an apostrophe NOT preceeded by another one.
@@ -225,7 +287,10 @@ namespace Helium
                 return nullptr;
             }
 
-            return new TokenLiteralString(Token_string, SourceSpan(start, point), indent, fixedIndent, std::move(buffer));
+            auto token = newToken( Token_string, start );
+            token->usedFixedIndent = ( fixedIndent >= 0 );
+            token->text = buffer;
+            return token;
         }
 
         //* Identifier
@@ -233,19 +298,31 @@ namespace Helium
 
         if ( ( tmp = read( "~.", 2 ) ) || isIdentifier( *source ) )
         {
-            std::string buffer = ( tmp == false ) ? "" : "~";
+            auto text = source;
 
             while ( source < end && ( isIdentifier( *source ) || *source == '~' || *source == '|' ) )
             {
-                buffer += read();
+                read();
+                read( "::", 2 );
+            }
+
+            std::string_view identifier( text, source - text );
 
-                if ( read( "::", 2 ) )
-                    buffer += "::";
+            // The "~." prefix is read as "~", so the text is no longer contiguous
+            if ( tmp )
+            {
+                auto& buffer = getDecodedTextBuffer();
+                buffer = "~";
+                buffer += identifier;
+                identifier = buffer;
             }
 
-            Token* t = new TokenLiteralString(Token_identifier, SourceSpan(start, point), indent, fixedIndent, std::move(buffer));
-            translateToken( t );
-            return t;
+            auto token = newToken( Token_identifier, start );
+            token->usedFixedIndent = ( fixedIndent >= 0 );
+            token->text = identifier;
+
+            translateToken( token );
+            return token;
         }
 
         bicharToken( "&&", Token_and )
@@ -17,12 +17,6 @@ namespace Helium
     {
     }
 
-    Parser::~Parser()
-    {
-        if ( currentToken )
-            delete currentToken;
-    }
-
     Token* Parser::accept( TokenType tt )
     {
         if ( current() && currentToken->type == tt )
@@ -126,7 +120,7 @@ namespace Helium
                 return nullptr;
             }
 
-            return make_pooled<AstNodeIdent>( tok->text.c_str(), AstNodeIdent::Namespace::local, tok->span );
+            return make_pooled<AstNodeIdent>( string(tok->text), AstNodeIdent::Namespace::local, tok->span );
         }
         else if ( Token* tok = accept( Token_myMember ) )
         {
@@ -226,7 +220,7 @@ namespace Helium
             syntaxError("Expected class name following 'class'");
 
         // TODO: better span
-        auto me = make_pooled<AstNodeClass>(name->text.c_str(), name->span);
+        auto me = make_pooled<AstNodeClass>(string(name->text), name->span);
 
         if ( !accept( Token_leftBrace ) )
             syntaxError("Expected '{' following class name");
@@ -271,7 +265,7 @@ namespace Helium
                 break;
 
             auto span = name->span;
-            auto name_ = name->text;
+            string name_( name->text );
 
             auto args = parseEnclosedDeclList();
 
@@ -354,7 +348,7 @@ namespace Helium
         }
         else if ( ( tok = accept( Token_string ) ) )
         {
-            return make_pooled<AstNodeLiteralString>(tok->text.c_str(), tok->span);
+            return make_pooled<AstNodeLiteralString>(string(tok->text), tok->span);
         }
         else
             return nullptr;
@@ -364,7 +358,6 @@ namespace Helium
     {
         if ( !currentTokenValid )
         {
-            delete currentToken;
             currentToken = 0;
             currentTokenValid = true;
         }
@@ -520,7 +513,7 @@ namespace Helium
             if (!ident)
                 break;
 
-            string name = ident->text.c_str();
+            string name( ident->text );
 
             pool_ptr<AstNodeTypeName> typeName;
 
@@ -585,7 +578,7 @@ namespace Helium
         }
 
         // BytecodeCompiler relies on anonymous functions having unique names for funcptr resolution
-        string name_ = name ? name->text.c_str() : ".anon_" + std::to_string(anonymousFunctions++);
+        string name_ = name ? string(name->text) : ".anon_" + std::to_string(anonymousFunctions++);
 
         auto args = parseEnclosedDeclList();
 
@@ -614,7 +607,7 @@ namespace Helium
         if (!tok)
             return nullptr;
 
-        return make_pooled<AstNodeIdent>(tok->text.c_str(), AstNodeIdent::Namespace::unknown, tok->span);
+        return make_pooled<AstNodeIdent>(string(tok->text), AstNodeIdent::Namespace::unknown, tok->span);
     }
 
     pool_ptr<AstNodeList> Parser::parseList(SourceSpan span) {
@@ -685,7 +678,7 @@ namespace Helium
             return nullptr;
 
         auto span = tok->span;
-        string typeName = tok->text;
+        string typeName( tok->text );
 
         bool optional = !!accept(Token_questionMark);
 
@@ -1,7 +1,13 @@
 #include <Helium/Config.hpp>
+#include <Helium/Compiler/CompileCache.hpp>
 #include <Helium/Compiler/Compiler.hpp>
 #include <Helium/Compiler/Optimizer.hpp>
+#include <Helium/Runtime/Debug/AllocationProfiler.hpp>
+#include <Helium/Runtime/Debug/CpuProfiler.hpp>
 #include <Helium/Runtime/Debug/Disassembler.hpp>
+#include <Helium/Runtime/Debug/HeapSnapshot.hpp>
+#include <Helium/Runtime/Debug/OpcodeStats.hpp>
+#include <Helium/Runtime/ModuleImage.hpp>
 #include <Helium/Runtime/RuntimeFunctions.hpp>
 #include <Helium/Runtime/VM.hpp>
 
@@ -13,11 +19,17 @@
 #include <Helium/Runtime/Debug/ValueTrace.hpp>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
 
 #ifdef _DEBUG
 #include <crtdbg.h>
@@ -33,16 +45,28 @@ namespace Helium
     void registerSDL2(VM* vm);
     void registerSDL2_ttf(VM* vm);
 
+    // Compile cache entries are only shared between runs with the same settings
+    enum {
+        compileCacheFlag_optimized = 1,
+        compileCacheFlag_debugInformation = 2,
+    };
+
     static int runProgram( int argc, char** argv )
     {
-        string output, dasmOutput, program;
+        string output, dasmOutput, heapSnapshotOutput, heapSummaryInput, allocProfileOutput, program;
+        size_t allocSampleInterval = AllocationProfiler::defaultSampleInterval;
+        string cpuProfileOutput, opcodeStatsOutput, functionStatsOutput, imageOutput, compileCacheDir;
+        size_t cpuSampleInterval = CpuProfiler::defaultSampleInterval;
+        unsigned compilerThreads = 0;
+        std::optional<unsigned> jitThreshold;
         bool printVersion = false;
-        bool optimize, disassemble, run, silent;
+        bool optimize, debugInformation, disassemble, run, silent;
 
         std::vector<fs::path> modulePaths;
         modulePaths.emplace_back( "." );
 
         optimize = true;
+        debugInformation = true;
         disassemble = false;
         run = true;
         silent = false;
@@ -63,6 +87,30 @@ namespace Helium
 
             if ( strcmp( argv[i], "--" ) == 0 )
                 parseArguments = false;
+            else if ( strncmp( argv[i], "--alloc-profile=", 16 ) == 0 )
+                allocProfileOutput = argv[i] + 16;
+            else if ( strncmp( argv[i], "--alloc-sample-interval=", 24 ) == 0 )
+                allocSampleInterval = std::stoul( argv[i] + 24 );
+            else if ( strncmp( argv[i], "--compile-cache=", 16 ) == 0 )
+                compileCacheDir = argv[i] + 16;
+            else if ( strncmp( argv[i], "--cpu-profile=", 14 ) == 0 )
+                cpuProfileOutput = argv[i] + 14;
+            else if ( strncmp( argv[i], "--cpu-sample-interval=", 22 ) == 0 )
+                cpuSampleInterval = std::stoul( argv[i] + 22 );
+            else if ( strncmp( argv[i], "--opcode-stats=", 15 ) == 0 )
+                opcodeStatsOutput = argv[i] + 15;
+            else if ( strncmp( argv[i], "--function-stats=", 17 ) == 0 )
+                functionStatsOutput = argv[i] + 17;
+            else if ( strncmp( argv[i], "--heap-snapshot=", 16 ) == 0 )
+                heapSnapshotOutput = argv[i] + 16;
+            else if ( strcmp( argv[i], "--jit" ) == 0 )
+                jitThreshold = Jit::defaultThreshold;
+            else if ( strncmp( argv[i], "--jit=", 6 ) == 0 )
+                jitThreshold = std::stoul( argv[i] + 6 );
+            else if ( strncmp( argv[i], "--heap-summary=", 15 ) == 0 )
+                heapSummaryInput = argv[i] + 15;
+            else if ( strncmp( argv[i], "--write-image=", 14 ) == 0 )
+                imageOutput = argv[i] + 14;
             else if ( strcmp( argv[i], "-c" ) == 0 )
                 run = false;
             else if ( strncmp( argv[i], "-d", 2 ) == 0 )
@@ -72,8 +120,12 @@ namespace Helium
 
                 dasmOutput = argv[i] + 2;
             }
+            else if ( strncmp( argv[i], "-g", 2 ) == 0 )
+                debugInformation = std::stoi( argv[i] + 2 ) != 0;
             else if ( strncmp( argv[i], "-I", 2 ) == 0 )
                 modulePaths.emplace_back( argv[i] + 2 );
+            else if ( strncmp( argv[i], "-j", 2 ) == 0 )
+                compilerThreads = std::stoul( argv[i] + 2 );
             else if ( strncmp( argv[i], "-o", 2 ) == 0 )
                 output = argv[i] + 2;
             else if ( strncmp( argv[i], "-O", 2 ) == 0 )
@@ -88,14 +140,41 @@ namespace Helium
                 argList.emplace_back(argv[i]);
         }
 
+        if ( !heapSummaryInput.empty() )
+        {
+            // Offline mode: no program is run
+            std::ifstream snapshotFile( heapSummaryInput, std::ios::binary );
+            auto snapshot = HeapSnapshot::load( snapshotFile );
+
+            if ( !snapshot )
+            {
+                printf( "Helium: failed to load heap snapshot '%s'.\n", heapSummaryInput.c_str() );
+                return 1;
+            }
+
+            snapshot->printSummary( std::cout, 20 );
+            return 0;
+        }
+
         if ( program.empty() )
             printVersion = true;
 
         if ( printVersion )
             printf( "Helium HEAD\n  Copyright (c) 2008-2020\n\n" );
 
+        // Created before the VM so that its allocations are covered as well
+        std::unique_ptr<AllocationProfiler> allocProfiler;
+
+        if ( !allocProfileOutput.empty() )
+            allocProfiler = std::make_unique<AllocationProfiler>( allocSampleInterval );
+
         std::unique_ptr<Helium::VM> vm;
         std::unique_ptr<Helium::Module> script;
+        std::shared_ptr<Helium::ModuleImage> image;
+
+        std::unique_ptr<CompileCache> compileCache;
+        string source;
+        bool storeInCompileCache = false;
 
         try
         {
@@ -126,11 +205,89 @@ namespace Helium
             return 1;
         }
 
+        {
+            std::ifstream programFile( program, std::ios::binary );
+            std::byte header[4] {};
+            programFile.read( reinterpret_cast<char*>( header ), sizeof( header ) );
+
+            if ( Module::isBinaryModule( span<const std::byte>( header, programFile.gcount() ) ) )
+            {
+                programFile.seekg( 0 );
+
+                script = Module::load( [&programFile]( span<std::byte> buffer ) {
+                    programFile.read( reinterpret_cast<char*>( buffer.data() ), buffer.size() );
+                    return static_cast<size_t>( programFile.gcount() );
+                } );
+
+                if ( !script )
+                {
+                    printf( "Helium: '%s' is not a valid binary module for this version.\n", program.c_str() );
+                    return 1;
+                }
+
+                // Binary modules are saved after optimization
+                optimize = false;
+            }
+            else if ( ModuleImage::isModuleImage( span<const std::byte>( header, programFile.gcount() ) ) )
+            {
+                image = ModuleImage::map( program );
+
+                if ( !image )
+                {
+                    printf( "Helium: '%s' is not a valid module image for this build.\n", program.c_str() );
+                    return 1;
+                }
+
+                // Images are executed as they are; there is no Module to optimize, save or disassemble
+                if ( !output.empty() || !imageOutput.empty() || disassemble )
+                {
+                    printf( "Helium: '%s' is a module image and can only be run.\n", program.c_str() );
+                    return 1;
+                }
+
+                optimize = false;
+            }
+        }
+
         try
         {
             Helium::Compiler compiler;
+            compiler.setDebugInformation( debugInformation );
+            compiler.setNumThreads( compilerThreads );
+
+            if ( !script && !image && !compileCacheDir.empty() )
+            {
+                std::ifstream sourceFile( program );
+
+                if ( sourceFile )
+                {
+                    uint32_t flags = debugInformation ? compileCacheFlag_debugInformation : 0;
+
+#ifndef helium_no_optimizer
+                    if ( optimize )
+                        flags |= compileCacheFlag_optimized;
+#endif
+
+                    compileCache = std::make_unique<CompileCache>( compileCacheDir, flags );
+
+                    std::stringstream buffer;
+                    buffer << sourceFile.rdbuf();
+                    source = buffer.str();
 
-            if ( !script )
+                    script = compileCache->load( program, source );
+
+                    if ( script )
+                        // Cache entries are stored after optimization
+                        optimize = false;
+                    else
+                    {
+                        script = compiler.compileString( program, source );
+                        storeInCompileCache = true;
+                    }
+                }
+            }
+
+            if ( !script && !image )
             //* If the program is not binary (previous load failed)
                 script = compiler.compileFile( program.c_str() );
         }
@@ -162,6 +319,41 @@ namespace Helium
 #endif
         }
 
+        if ( storeInCompileCache )
+            compileCache->store( program, source, *script );
+
+        if ( !output.empty() )
+        {
+            std::ofstream outputFile( output, std::ios::binary );
+
+            auto saved = outputFile && script->save( [&outputFile]( span<const std::byte> data ) {
+                outputFile.write( reinterpret_cast<const char*>( data.data() ), data.size() );
+                return outputFile ? data.size() : 0;
+            } );
+
+            if ( !saved )
+            {
+                printf( "Helium: failed to write module '%s'.\n", output.c_str() );
+                return 1;
+            }
+        }
+
+        if ( !imageOutput.empty() )
+        {
+            std::ofstream imageFile( imageOutput, std::ios::binary );
+
+            auto written = imageFile && ModuleImage::write( *script, [&imageFile]( span<const std::byte> data ) {
+                imageFile.write( reinterpret_cast<const char*>( data.data() ), data.size() );
+                return imageFile ? data.size() : 0;
+            } );
+
+            if ( !written )
+            {
+                printf( "Helium: failed to write module image '%s'.\n", imageOutput.c_str() );
+                return 1;
+            }
+        }
+
         if ( disassemble )
         {
             std::ofstream dasmFile;
@@ -186,7 +378,7 @@ namespace Helium
 
         if ( run )
         {
-            auto moduleIndex = vm->loadModule( script.get() );
+            auto moduleIndex = image ? vm->loadModuleImage( image ) : vm->loadModule( script.get() );
 
             Value vmArgList = Helium::Value::newList( vm.get(), argList.size() );
             helium_assert(vmArgList.type == ValueType::list);
@@ -199,11 +391,95 @@ namespace Helium
             ActivationContext ctx(vm.get());
             ActivationScope scope(ctx);
 
+            std::unique_ptr<CpuProfiler> cpuProfiler;
+            std::atomic<bool> cpuProfilerStop {false};
+            std::thread cpuProfilerCollector;
+
+            if ( !cpuProfileOutput.empty() )
+            {
+                cpuProfiler = std::make_unique<CpuProfiler>( cpuSampleInterval );
+
+                // Drain the sample buffer while the program runs, so that it never fills up
+                cpuProfilerCollector = std::thread( [&cpuProfiler, &cpuProfilerStop] {
+                    while ( !cpuProfilerStop.load() )
+                    {
+                        cpuProfiler->collect();
+                        std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+                    }
+                } );
+            }
+
+            if ( !functionStatsOutput.empty() )
+                vm->setFunctionStatsEnabled( true );
+
+            if ( jitThreshold )
+            {
+                vm->setJitThreshold( *jitThreshold );
+                vm->setJitEnabled( true );
+            }
+
             if (ctx.callMainFunction(moduleIndex)) {
                 // This is where the fun begins
                 vm->execute(ctx);
             }
 
+            if ( cpuProfiler )
+            {
+                cpuProfilerStop = true;
+                cpuProfilerCollector.join();
+                cpuProfiler->collect();
+
+                std::ofstream profileFile( cpuProfileOutput );
+                cpuProfiler->writeFoldedStacks( profileFile );
+
+                if ( cpuProfiler->getNumDroppedSamples() != 0 && !silent )
+                    printf( "Helium: %zu CPU profiler samples were dropped.\n", cpuProfiler->getNumDroppedSamples() );
+            }
+
+            if ( !functionStatsOutput.empty() )
+            {
+                auto entries = vm->getFunctionStats();
+
+                std::sort( entries.begin(), entries.end(), []( const auto& a, const auto& b ) {
+                    return a.stats.exclusiveTime > b.stats.exclusiveTime;
+                } );
+
+                // Tab-separated, times in nanoseconds
+                std::ofstream statsFile( functionStatsOutput );
+                statsFile << "name\tnative\tcalls\tinclusive\texclusive\n";
+
+                for ( const auto& entry : entries )
+                {
+                    statsFile << entry.name << '\t' << entry.isNative << '\t' << entry.stats.numCalls << '\t'
+                              << entry.stats.inclusiveTime.count() << '\t' << entry.stats.exclusiveTime.count() << '\n';
+                }
+            }
+
+            if ( !opcodeStatsOutput.empty() )
+            {
+#if HELIUM_OPCODE_STATS
+                std::ofstream statsFile( opcodeStatsOutput );
+                OpcodeStats::writeReport( statsFile, 50 );
+#else
+                if ( !silent )
+                    printf( "Helium: opcode statistics are not available (build with OPCODE_STATS=ON).\n" );
+#endif
+            }
+
+            if ( !heapSnapshotOutput.empty() )
+            {
+                std::ofstream snapshotFile( heapSnapshotOutput, std::ios::binary );
+
+                if ( !HeapSnapshot::capture( *vm ).save( snapshotFile ) && !silent )
+                    printf( "Helium: failed to write heap snapshot '%s'.\n", heapSnapshotOutput.c_str() );
+            }
+
+            if ( allocProfiler )
+            {
+                std::ofstream profileFile( allocProfileOutput );
+                allocProfiler->writeFoldedStacks( profileFile );
+            }
+
             if (ctx.getState() == ActivationContext::returnedValue) {
                 //result_out = ctx.stack.pop();
             }
@@ -249,7 +525,7 @@ int main( int argc, char *argv[] )
 
     Helium::Value::printStatistics();
 
-#ifdef HELIUM_TRACE_VALUES
+#if HELIUM_TRACE_VALUES
     vt.report();
 #endif
 
@@ -0,0 +1,144 @@
+#include <Helium/Assert.hpp>
+#include <Helium/Memory/LinearAllocator.hpp>
+#include <Helium/Memory/PoolAllocator.hpp>
+
+#include <cstdlib>
+
+namespace Helium {
+
+PoolAllocator::PoolAllocator(size_t blockSize, size_t blocksPerChunk)
+        : blockSize(align<16>(blockSize < sizeof(FreeBlock) ? sizeof(FreeBlock) : blockSize)) {
+    helium_assert(blocksPerChunk > 0);
+
+    chunkSize = 1;
+
+    while (chunkSize < chunkHeaderSize + this->blockSize * blocksPerChunk)
+        chunkSize *= 2;
+
+    this->blocksPerChunk = (chunkSize - chunkHeaderSize) / this->blockSize;
+}
+
+PoolAllocator::~PoolAllocator() {
+    for (auto list : {&availableChunks, &fullChunks}) {
+        while (list->first != nullptr) {
+            auto chunk = list->first;
+            list->remove(chunk);
+            free(chunk);
+        }
+    }
+
+    free(spareChunk);
+}
+
+void* PoolAllocator::allocate() {
+    auto chunk = availableChunks.first;
+
+    if (chunk == nullptr) {
+        chunk = newChunk();
+
+        if (chunk == nullptr)
+            return nullptr;
+    }
+
+    void* block;
+
+    if (chunk->freeList != nullptr) {
+        block = chunk->freeList;
+        chunk->freeList = chunk->freeList->next;
+    }
+    else {
+        block = chunk->bumpPointer;
+        chunk->bumpPointer += blockSize;
+    }
+
+    if (++chunk->numUsedBlocks == blocksPerChunk) {
+        availableChunks.remove(chunk);
+        fullChunks.insert(chunk);
+    }
+
+    memoryUsage += blockSize;
+    return block;
+}
+
+void PoolAllocator::deallocate(void* block) {
+    helium_assert_debug(block != nullptr);
+
+    auto chunk = getChunk(block);
+    helium_assert_debug(chunk->numUsedBlocks > 0);
+
+    auto freeBlock = static_cast<FreeBlock*>(block);
+    freeBlock->next = chunk->freeList;
+    chunk->freeList = freeBlock;
+
+    if (chunk->numUsedBlocks-- == blocksPerChunk) {
+        fullChunks.remove(chunk);
+        availableChunks.insert(chunk);
+    }
+
+    if (chunk->numUsedBlocks == 0) {
+        availableChunks.remove(chunk);
+        freeChunk(chunk);
+    }
+
+    memoryUsage -= blockSize;
+}
+
+PoolAllocator::Chunk* PoolAllocator::getChunk(void* block) const {
+    return reinterpret_cast<Chunk*>(reinterpret_cast<uintptr_t>(block) & ~(uintptr_t(chunkSize) - 1));
+}
+
+PoolAllocator::Chunk* PoolAllocator::newChunk() {
+    Chunk* chunk;
+
+    if (spareChunk != nullptr) {
+        chunk = spareChunk;
+        spareChunk = nullptr;
+    }
+    else {
+        chunk = static_cast<Chunk*>(aligned_alloc(chunkSize, chunkSize));
+
+        if (chunk == nullptr)
+            return nullptr;
+
+        memoryUsageInclOverhead += chunkSize;
+    }
+
+    chunk->freeList = nullptr;
+    chunk->bumpPointer = reinterpret_cast<uint8_t*>(chunk) + chunkHeaderSize;
+    chunk->numUsedBlocks = 0;
+
+    availableChunks.insert(chunk);
+    return chunk;
+}
+
+void PoolAllocator::freeChunk(Chunk* chunk) {
+    if (spareChunk == nullptr) {
+        spareChunk = chunk;
+        return;
+    }
+
+    free(chunk);
+    memoryUsageInclOverhead -= chunkSize;
+}
+
+void PoolAllocator::ChunkList::insert(Chunk* chunk) {
+    chunk->prev = nullptr;
+    chunk->next = first;
+
+    if (first != nullptr)
+        first->prev = chunk;
+
+    first = chunk;
+}
+
+void PoolAllocator::ChunkList::remove(Chunk* chunk) {
+    if (chunk->prev != nullptr)
+        chunk->prev->next = chunk->next;
+    else
+        first = chunk->next;
+
+    if (chunk->next != nullptr)
+        chunk->next->prev = chunk->prev;
+}
+
+}
@@ -1,5 +1,9 @@
 #include <Helium/Compiler/Optimizer.hpp>
 
+#include <algorithm>
+#include <limits>
+#include <optional>
+
 namespace Helium
 {
     using std::string;
@@ -78,8 +82,11 @@ namespace Helium
         for (auto& func : script.functions) {
             if (index < func.start)
                 func.start--;
-
-            if (index >= func.start + func.length)
+            else if (index < func.start + func.length) {
+                func.length--;
+                func.lineTable.removeInstruction(index - func.start, func.length);
+            }
+            else
                 continue;
 
             // Fixup exception handlers where needed
@@ -95,8 +102,547 @@ namespace Helium
         }
     }
 
+    /*
+     * Inlining of small functions
+     *
+     * A call_func is replaced with a copy of the callee. The arguments are popped into locals of the caller that are
+     * reserved for that one call site; the callee's `this` maps to one that is never set, so it stays undefined just
+     * like in a called function. Every `ret` becomes a jump past the copy, where the reserved locals are cleared so
+     * that they do not keep their values alive for as long as the caller runs.
+     *
+     * An inlined function has no frame of its own, so it would be missing from the stack trace of any exception it
+     * raises. Callees that assert, throw or call anything are therefore never inlined, and the instructions of an
+     * inlined body are attributed to the line of the call, so that a trace never names one function with the line of
+     * another. Callees with exception handlers or switch tables are never inlined either, and neither are those that
+     * could read a local before setting it.
+     */
+
+    // Callees longer than this (not counting the final `ret`) are always called
+    static const size_t maxInlinedLength = 20;
+
+    // Locals are tracked in a bit mask by the analysis below
+    static const size_t maxInlinedLocals = 64;
+
+    struct InlinedBody
+    {
+        std::vector<Instruction> code;      // code addresses relative to the body; the body end stands for `ret`
+        size_t numArguments, numLocals;
+    };
+
+    static std::optional<InlinedBody> getInlinedBody(Module const& script, FunctionIndex_t functionIndex)
+    {
+        auto const& function = script.functions[functionIndex];
+
+        if ( !function.exceptionHandlers.empty() || function.length == 0
+                || function.numExplicitArguments + 1 >= maxInlinedLocals )
+            return std::nullopt;
+
+        // Find the reachable instructions and the locals that are set on every path to each of them.
+        // Arguments are set on entry; `this` is never set, but reading it is fine (see above).
+        std::vector<bool> reached( function.length );
+        std::vector<uint64_t> assigned( function.length );
+        std::vector<CodeAddr_t> worklist{ 0 };
+
+        reached[0] = true;
+        assigned[0] = ( uint64_t( 1 ) << ( function.numExplicitArguments + 1 ) ) - 1;
+
+        while ( !worklist.empty() )
+        {
+            auto offset = worklist.back();
+            worklist.pop_back();
+
+            auto const& instruction = *script.code[function.start + offset];
+            auto set = assigned[offset];
+
+            CodeAddr_t successors[2];
+            size_t numSuccessors = 0;
+
+            switch ( instruction.opcode )
+            {
+                case Opcodes::assert:
+                case Opcodes::call_ext:
+                case Opcodes::call_func:
+                case Opcodes::call_var:
+                case Opcodes::invoke:
+                case Opcodes::throw_var:
+                    return std::nullopt;
+
+                case Opcodes::getLocal:
+                    if ( static_cast<uint64_t>( instruction.integer ) >= maxInlinedLocals
+                            || !( set & ( uint64_t( 1 ) << instruction.integer ) ) )
+                        return std::nullopt;
+
+                    successors[numSuccessors++] = offset + 1;
+                    break;
+
+                case Opcodes::setLocal:
+                    if ( instruction.integer <= 0 || static_cast<uint64_t>( instruction.integer ) >= maxInlinedLocals )
+                        return std::nullopt;
+
+                    set |= uint64_t( 1 ) << instruction.integer;
+                    successors[numSuccessors++] = offset + 1;
+                    break;
+
+                case Opcodes::jmp:
+                    successors[numSuccessors++] = instruction.codeAddr - function.start;
+                    break;
+
+                case Opcodes::jmp_true:
+                case Opcodes::jmp_false:
+                    successors[numSuccessors++] = offset + 1;
+                    successors[numSuccessors++] = instruction.codeAddr - function.start;
+                    break;
+
+                case Opcodes::ret:
+                    break;
+
+                case Opcodes::clearLocal:
+                case Opcodes::op_switch:
+                case Opcodes::unknownCall:
+                case Opcodes::unknownPush:
+                    return std::nullopt;
+
+                default:
+                    // Register forms only appear once a module has been optimized
+                    if ( InstructionDesc::getByOpcode( instruction.opcode )->operandType == OperandType::registers )
+                        return std::nullopt;
+
+                    successors[numSuccessors++] = offset + 1;
+            }
+
+            for ( size_t i = 0; i < numSuccessors; i++ )
+            {
+                auto next = successors[i];
+
+                if ( next >= function.length )
+                    return std::nullopt;
+
+                if ( !reached[next] )
+                {
+                    reached[next] = true;
+                    assigned[next] = set;
+                    worklist.push_back( next );
+                }
+                else if ( ( assigned[next] & set ) != assigned[next] )
+                {
+                    assigned[next] &= set;
+                    worklist.push_back( next );
+                }
+            }
+        }
+
+        // Anything past the last reachable instruction (typically the implicit `return this`) is left out
+        CodeAddr_t length = function.length;
+
+        while ( !reached[length - 1] )
+            length--;
+
+        // A final `ret` falls through to the end of the body
+        if ( script.code[function.start + length - 1]->opcode == Opcodes::ret )
+            length--;
+
+        if ( length > maxInlinedLength )
+            return std::nullopt;
+
+        InlinedBody body;
+        body.numArguments = function.numExplicitArguments;
+        body.numLocals = function.numExplicitArguments + 1;
+
+        for ( CodeAddr_t offset = 0; offset < length; offset++ )
+        {
+            auto instruction = *script.code[function.start + offset];
+
+            if ( instruction.opcode == Opcodes::ret )
+            {
+                instruction.opcode = Opcodes::jmp;
+                instruction.codeAddr = length;
+            }
+            else if ( Instruction::needsRelocation( instruction.opcode ) )
+            {
+                // Only unreachable jumps can lead past the body
+                instruction.codeAddr = std::min<CodeAddr_t>( instruction.codeAddr - function.start, length );
+            }
+            else if ( instruction.opcode == Opcodes::getLocal || instruction.opcode == Opcodes::setLocal )
+            {
+                // Unreachable instructions were not checked
+                if ( instruction.integer < 0 || static_cast<uint64_t>( instruction.integer ) >= maxInlinedLocals )
+                    return std::nullopt;
+
+                body.numLocals = std::max<size_t>( body.numLocals, instruction.integer + 1 );
+            }
+
+            body.code.push_back( instruction );
+        }
+
+        return body;
+    }
+
+    /*
+     * Rewrites the code of a module in a single sweep, for passes that insert or replace many instructions
+     * (removeInstruction relocates the whole module every time).
+     *
+     * Every old instruction is either kept or replaced by new ones; begin() must be called for each old address as
+     * it is reached. finish() relocates everything that refers to code and replaces the code of the module.
+     */
+    struct CodeRewriter
+    {
+        static constexpr size_t noFunction = std::numeric_limits<size_t>::max();
+
+        Module& script;
+
+        std::vector<size_t> owners;             // the function of every instruction, or noFunction
+        std::vector<bool> isBoundary;           // jumped to, or where a function or exception handler range starts/ends
+        std::vector<int> lines;                 // the source line of every instruction; -1 if unknown
+
+        std::vector<Instruction*> newCode;
+        std::vector<bool> isRelocated;          // new instructions whose jumps already use new addresses
+        std::vector<int> newLines;
+        std::vector<CodeAddr_t> newAddresses;
+
+        explicit CodeRewriter(Module& script)
+                : script( script ), owners( script.code.size(), noFunction ), isBoundary( script.code.size() + 1 ),
+                  lines( script.code.size(), -1 ), newAddresses( script.code.size() + 1 )
+        {
+            for ( size_t i = 0; i < script.functions.size(); i++ )
+            {
+                auto const& function = script.functions[i];
+
+                for ( CodeAddr_t offset = 0; offset < function.length; offset++ )
+                {
+                    owners[function.start + offset] = i;
+                    lines[function.start + offset] = function.lineTable.getLine( offset );
+                }
+
+                isBoundary[function.start] = true;
+                isBoundary[function.start + function.length] = true;
+
+                for ( auto const& eh : function.exceptionHandlers )
+                {
+                    isBoundary[eh.start] = true;
+                    isBoundary[eh.start + eh.length] = true;
+                    isBoundary[eh.handler] = true;
+                }
+            }
+
+            for ( auto instruction : script.code )
+            {
+                if ( Instruction::needsRelocation( instruction->opcode ) )
+                    isBoundary[instruction->codeAddr] = true;
+                else if ( instruction->opcode == Opcodes::op_switch )
+                {
+                    for ( auto handler : script.switchTables[instruction->switchTableIndex]->handlers )
+                        isBoundary[handler] = true;
+                }
+            }
+        }
+
+        void begin( size_t address )
+        {
+            newAddresses[address] = newCode.size();
+        }
+
+        void keep( size_t address )
+        {
+            newCode.push_back( script.code[address] );
+            isRelocated.push_back( false );
+            newLines.push_back( lines[address] );
+        }
+
+        void add( Instruction* instruction, int line )
+        {
+            newCode.push_back( instruction );
+            isRelocated.push_back( true );
+            newLines.push_back( line );
+        }
+
+        void finish()
+        {
+            auto& code = script.code;
+            newAddresses[code.size()] = newCode.size();
+
+            for ( size_t i = 0; i < newCode.size(); i++ )
+            {
+                if ( !isRelocated[i] && Instruction::needsRelocation( newCode[i]->opcode ) )
+                    newCode[i]->codeAddr = newAddresses[newCode[i]->codeAddr];
+            }
+
+            for ( auto& switchTable : script.switchTables )
+            {
+                for ( auto& handler : switchTable->handlers )
+                    handler = newAddresses[handler];
+            }
+
+            for ( auto& function : script.functions )
+            {
+                auto start = newAddresses[function.start];
+                auto end = newAddresses[function.start + function.length];
+
+                for ( auto& eh : function.exceptionHandlers )
+                {
+                    auto ehStart = newAddresses[eh.start];
+
+                    eh.length = newAddresses[eh.start + eh.length] - ehStart;
+                    eh.start = ehStart;
+                    eh.handler = newAddresses[eh.handler];
+                }
+
+                if ( !function.lineTable.entries.empty() )
+                {
+                    function.lineTable.entries.clear();
+
+                    for ( auto offset = start; offset < end; offset++ )
+                    {
+                        if ( newLines[offset] >= 0 )
+                            function.lineTable.addLine( offset - start, newLines[offset] );
+                    }
+                }
+
+                function.start = start;
+                function.length = end - start;
+            }
+
+            code = std::move( newCode );
+        }
+    };
+
+    // The number of locals an instruction needs in its frame
+    static size_t getNumLocalsUsed(Instruction const& instruction)
+    {
+        if ( instruction.opcode == Opcodes::getLocal || instruction.opcode == Opcodes::setLocal
+                || instruction.opcode == Opcodes::clearLocal )
+            return static_cast<size_t>( instruction.integer ) + 1;
+
+        if ( InstructionDesc::getByOpcode( instruction.opcode )->operandType == OperandType::registers )
+        {
+            auto operands = RegisterOperands::unpack( instruction.integer );
+            size_t numUsed = operands.left + 1;
+
+            if ( !operands.rightIsConstant )
+                numUsed = std::max<size_t>( numUsed, operands.right + 1 );
+
+            if ( operands.destination != RegisterOperands::toStack )
+                numUsed = std::max<size_t>( numUsed, operands.destination + 1 );
+
+            return numUsed;
+        }
+
+        return 0;
+    }
+
+    static void inlineCalls(Module& script)
+    {
+        std::vector<std::optional<InlinedBody>> bodies;
+        bool anyInlinable = false;
+
+        for ( size_t i = 0; i < script.functions.size(); i++ )
+        {
+            bodies.push_back( getInlinedBody( script, static_cast<FunctionIndex_t>( i ) ) );
+
+            if ( bodies.back() )
+                anyInlinable = true;
+        }
+
+        if ( !anyInlinable )
+            return;
+
+        auto& code = script.code;
+        CodeRewriter rewriter( script );
+
+        // Inlined locals go after all the locals and arguments of the caller
+        std::vector<size_t> nextLocals;
+
+        for ( auto const& function : script.functions )
+        {
+            size_t nextLocal = function.numExplicitArguments + 1;
+
+            for ( CodeAddr_t offset = 0; offset < function.length; offset++ )
+                nextLocal = std::max( nextLocal, getNumLocalsUsed( *code[function.start + offset] ) );
+
+            nextLocals.push_back( nextLocal );
+        }
+
+        for ( size_t i = 0; i < code.size(); i++ )
+        {
+            rewriter.begin( i );
+
+            // The caller announces the number of arguments right before the call
+            auto args = code[i];
+            auto call = ( i + 1 < code.size() ? code[i + 1] : nullptr );
+            auto caller = rewriter.owners[i];
+
+            if ( call == nullptr || args->opcode != Opcodes::args || call->opcode != Opcodes::call_func
+                    || caller == CodeRewriter::noFunction || call->functionIndex == caller
+                    || rewriter.isBoundary[i + 1] || !bodies[call->functionIndex] )
+            {
+                rewriter.keep( i );
+                continue;
+            }
+
+            auto const& body = *bodies[call->functionIndex];
+            auto base = nextLocals[caller];
+
+            // Mismatched calls are left to raise the exception
+            if ( static_cast<size_t>( args->integer ) != body.numArguments || base + body.numLocals > LOCALS_MAX )
+            {
+                rewriter.keep( i );
+                continue;
+            }
+
+            nextLocals[caller] += body.numLocals;
+            rewriter.begin( i + 1 );
+
+            auto callerLine = rewriter.lines[i];
+
+            // The first argument is on the top of the stack
+            for ( size_t argument = 1; argument <= body.numArguments; argument++ )
+            {
+                auto setLocal = new Instruction( *args );
+                setLocal->opcode = Opcodes::setLocal;
+                setLocal->integer = base + argument;
+
+                rewriter.add( setLocal, callerLine );
+            }
+
+            auto bodyStart = rewriter.newCode.size();
+
+            for ( size_t offset = 0; offset < body.code.size(); offset++ )
+            {
+                auto instruction = new Instruction( body.code[offset] );
+
+                if ( Instruction::needsRelocation( instruction->opcode ) )
+                    instruction->codeAddr += bodyStart;
+                else if ( instruction->opcode == Opcodes::getLocal || instruction->opcode == Opcodes::setLocal )
+                    instruction->integer += base;
+
+                rewriter.add( instruction, callerLine );
+            }
+
+            // Every `ret` now leads here, with the result (possibly borrowed from one of the locals) on the stack
+            for ( size_t local = 1; local < body.numLocals; local++ )
+            {
+                auto clearLocal = new Instruction( *args );
+                clearLocal->opcode = Opcodes::clearLocal;
+                clearLocal->integer = base + local;
+
+                rewriter.add( clearLocal, callerLine );
+            }
+
+            delete args;
+            delete call;
+            i++;
+        }
+
+        rewriter.finish();
+    }
+
+    /*
+     * Register forms
+     *
+     * A binary operator whose operands are locals (or a local and a small integer constant) is fused with the
+     * instructions that load them, and with the store of its result if there is one:
+     *
+     *      getLocal a; getLocal b; add; setLocal c     =>  add.r c, a, b
+     *      getLocal a; pushc.i 1; less                 =>  less.r push, a, #1
+     */
+
+    static Opcode_t getRegisterForm(Opcode_t opcode)
+    {
+        switch ( opcode )
+        {
+            case Opcodes::op_add: return Opcodes::add_r;
+            case Opcodes::op_div: return Opcodes::div_r;
+            case Opcodes::op_mod: return Opcodes::mod_r;
+            case Opcodes::op_mul: return Opcodes::mul_r;
+            case Opcodes::op_sub: return Opcodes::sub_r;
+            case Opcodes::eq: return Opcodes::eq_r;
+            case Opcodes::grtr: return Opcodes::grtr_r;
+            case Opcodes::grtrEq: return Opcodes::grtrEq_r;
+            case Opcodes::less: return Opcodes::less_r;
+            case Opcodes::lessEq: return Opcodes::lessEq_r;
+            case Opcodes::neq: return Opcodes::neq_r;
+            default: return Opcodes::nop;
+        }
+    }
+
+    static bool isRegister(Instruction const* instruction)
+    {
+        return instruction->integer >= 0 && static_cast<size_t>( instruction->integer ) <= LOCALS_MAX;
+    }
+
+    static void formRegisterInstructions(Module& script)
+    {
+        auto& code = script.code;
+        CodeRewriter rewriter( script );
+        bool changed = false;
+
+        for ( size_t i = 0; i < code.size(); i++ )
+        {
+            rewriter.begin( i );
+
+            auto left = code[i];
+            auto right = ( i + 2 < code.size() ? code[i + 1] : nullptr );
+            auto operation = ( i + 2 < code.size() ? code[i + 2] : nullptr );
+
+            if ( right == nullptr || left->opcode != Opcodes::getLocal || !isRegister( left )
+                    || rewriter.isBoundary[i + 1] || rewriter.isBoundary[i + 2]
+                    || getRegisterForm( operation->opcode ) == Opcodes::nop )
+            {
+                rewriter.keep( i );
+                continue;
+            }
+
+            RegisterOperands operands { RegisterOperands::toStack, static_cast<LocalIndex_t>( left->integer ), false, 0 };
+
+            if ( right->opcode == Opcodes::getLocal && isRegister( right ) )
+                operands.right = static_cast<int32_t>( right->integer );
+            else if ( right->opcode == Opcodes::pushc_i && right->integer >= RegisterOperands::minConstant
+                      && right->integer <= RegisterOperands::maxConstant )
+            {
+                operands.rightIsConstant = true;
+                operands.right = static_cast<int32_t>( right->integer );
+            }
+            else
+            {
+                rewriter.keep( i );
+                continue;
+            }
+
+            size_t length = 3;
+            auto store = ( i + 3 < code.size() ? code[i + 3] : nullptr );
+
+            if ( store != nullptr && store->opcode == Opcodes::setLocal && isRegister( store )
+                    && !rewriter.isBoundary[i + 3] )
+            {
+                operands.destination = static_cast<LocalIndex_t>( store->integer );
+                length = 4;
+            }
+
+            auto fused = new Instruction( *operation );
+            fused->opcode = getRegisterForm( operation->opcode );
+            fused->integer = operands.pack();
+
+            for ( size_t j = 0; j < length; j++ )
+            {
+                rewriter.begin( i + j );
+                delete code[i + j];
+            }
+
+            rewriter.add( fused, rewriter.lines[i] );
+
+            i += length - 1;
+            changed = true;
+        }
+
+        if ( changed )
+            rewriter.finish();
+        else
+            rewriter.newCode.clear();
+    }
+
     void Optimizer::optimize(Module& script)
     {
+        inlineCalls( script );
+
         for ( size_t i = 0; i < script.code.size(); i++ )
         {
             // ALWAYS remove instructions in the REVERSE ORDER!!!
@@ -120,6 +666,8 @@ namespace Helium
                 continue;
             }
         }
+
+        formRegisterInstructions( script );
     }
 
     void Optimizer::optimizeWithStatistics(Module& script)
@@ -27,9 +27,23 @@ namespace Helium
     }
 #endif
 
+    ActivationContext::ActivationContext(VM* vm) : vm(vm) {
+        vm->addActivationContext(this);
+    }
+
     ActivationContext::~ActivationContext() {
+        // The VM might have been destroyed first (both can be owned by script objects)
+        if (vm) {
+            vm->removeActivationContext(this);
+
+            // Keep function statistics consistent if we are destroyed mid-execution
+            while (!frames.empty())
+                leaveFunction();
+        }
+
+        // If an exception went unhandled, the stack may still contain borrowed slots of frames that no longer exist
         while (!stack.isEmpty())
-            stack.pop();
+            stack.drop();
     }
 
     bool ActivationContext::callMainFunction(ModuleIndex_t moduleIndex) {
@@ -63,6 +77,16 @@ namespace Helium
 
         frame->scriptFunction = &function;
         frame->stackBase = stack.getHeight();
+        frame->hotness = &activeModule->hotness[functionIndex];
+        vm->onFunctionEntered(*activeModule, *frame);
+
+        if (vm->functionStatsEnabled) {
+            frame->stats = &vm->scriptFunctionStats[&function];
+            frame->stats->numCalls++;
+            frame->stats->numActiveCalls++;
+            frame->callStartTime = std::chrono::steady_clock::now();
+            frame->calleeTime = std::chrono::nanoseconds::zero();
+        }
 
         // TODO: the goal is to pass 'self' as an argument instead
         frame->setLocal(0, std::move(self));
@@ -70,12 +94,34 @@ namespace Helium
         return enterFunction(function, numArgs);
     }
 
+    void ActivationContext::leaveFunction() {
+        auto& leaving = frames.back();
+
+        if (leaving.stats) {
+            auto elapsed = std::chrono::steady_clock::now() - leaving.callStartTime;
+
+            leaving.stats->exclusiveTime += elapsed - leaving.calleeTime;
+
+            if (--leaving.stats->numActiveCalls == 0)
+                leaving.stats->inclusiveTime += elapsed;
+
+            if (frames.size() > 1)
+                frames[frames.size() - 2].calleeTime += elapsed;
+        }
+
+        frames.pop_back();
+    }
+
     void ActivationContext::callNativeFunction(NativeFunction func, size_t numArgs) {
         NativeFunctionContext ctx{ *this, numArgs, ValueRef::makeNil() };
-        func(ctx);
+
+        if (vm->functionStatsEnabled)
+            callNativeFunctionWithStats(func, ctx);
+        else
+            func(ctx);
 
         for (size_t i = 0; i < numArgs; i++)
-            this->stack.pop();
+            this->stack.drop();
 
         this->stack.push(ctx.moveReturnValue());
     }
@@ -85,14 +131,37 @@ namespace Helium
         numArgs++;
 
         NativeFunctionContext ctx{ *this, numArgs, ValueRef::makeNil() };
-        func(ctx);
+
+        if (vm->functionStatsEnabled)
+            callNativeFunctionWithStats(func, ctx);
+        else
+            func(ctx);
 
         for (size_t i = 0; i < numArgs; i++)
-            this->stack.pop();
+            this->stack.drop();
 
         this->stack.push(ctx.moveReturnValue());
     }
 
+    void ActivationContext::callNativeFunctionWithStats(NativeFunction func, NativeFunctionContext& ctx) {
+        auto& stats = vm->nativeFunctionStats[func];
+        stats.numCalls++;
+        stats.numActiveCalls++;
+
+        auto start = std::chrono::steady_clock::now();
+        func(ctx);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        // Native functions are leaves as far as the statistics are concerned
+        stats.exclusiveTime += elapsed;
+
+        if (--stats.numActiveCalls == 0)
+            stats.inclusiveTime += elapsed;
+
+        if (!frames.empty())
+            frames.back().calleeTime += elapsed;
+    }
+
     bool ActivationContext::enterFunction(const ScriptFunction& function, size_t numArgs) {
         switch (function.argumentListType) {
         case ScriptFunction::ArgumentListType::explicit_: {
@@ -126,7 +195,7 @@ namespace Helium
         return current_ac;
     }
 
-    Instruction* ActivationContext::getLastExecutedInstruction() {
+    Instruction const* ActivationContext::getLastExecutedInstruction() {
         if (this->activeModule != nullptr && this->pc > 0) {
             return &this->activeModule->instructions[this->pc - 1];
         }
@@ -172,10 +241,8 @@ namespace Helium
             if (!NativeListFunctions::newList(5, &stacktrace))
                 return;
 
-            this->walkStack([&stacktrace, this](InstructionOrigin const& origin) {
-                const auto &function = *origin.function;
-                const auto &unit = *origin.unit;
-                auto str = function + " (" + unit + ":" + std::to_string(origin.line) + ")";
+            this->walkStack([&stacktrace](StackFrameInfo const& frameInfo) {
+                auto str = to_string(frameInfo);
                 ValueRef entry(Value::newStringWithLength(str.c_str(), str.size()));
 
                 // Might raise OOM exception. Tough shit.
@@ -200,29 +267,35 @@ namespace Helium
         return prev;
     }
 
-    void ActivationContext::walkStack(std::function<void(InstructionOrigin const&)> const& callback) {
+    void ActivationContext::walkStack(std::function<void(StackFrameInfo const&)> const& callback) {
         for (auto it = frames.rbegin(); it != frames.rend(); it++) {
-            // Current frame? Fetch instruction from activeModule
-            // TODO: Why is this a special case?
-            if (&(*it) == frame) {
-                // Dangerous
-                Instruction const* next = &this->activeModule->instructions[this->pc - 1];
-
-                if (next && next->origin) {
-                    callback(*next->origin);
-                    continue;
-                }
-            }
+            // The module and pc of the current frame are cached in the ActivationContext and only flushed on calls
+            bool isCurrent = (&(*it) == frame);
+            auto module = isCurrent ? this->activeModule : (*it).module;
+            auto pc = isCurrent ? this->pc : (*it).pc;
+
+            // pc already points to the next instruction, unless the function has only just been entered
+            auto function = (*it).scriptFunction;
+            callback(StackFrameInfo{module, function, pc > function->start ? pc - 1 : function->start});
+        }
+    }
 
-            // Previous frame? Fetch instruction from its module.
-            // Also dangerous
-            Instruction const* next = &(*it).module->instructions[(*it).pc - 1];
+    int StackFrameInfo::getLine() const {
+        return function->lineTable.getLine(pc - function->start);
+    }
 
-            if (next && next->origin) {
-                callback(*next->origin);
-                continue;
-            }
-        }
+    std::string to_string(StackFrameInfo const& frame) {
+        auto const& unit = frame.module->unitName;
+
+        if (unit.empty())
+            return frame.function->name;
+
+        auto line = frame.getLine();
+
+        if (line < 0)
+            return frame.function->name + " (" + unit + ")";
+
+        return frame.function->name + " (" + unit + ":" + std::to_string(line) + ")";
     }
 
     ActivationScope::ActivationScope(ActivationContext& ctx) {
@@ -28,6 +28,11 @@ namespace Helium
         return true;
     }
 
+    template <>
+    bool unwrap(Value var, bool* value_out) {
+        return RuntimeFunctions::asBoolean(var, value_out, true);
+    }
+
     template <>
     bool unwrap(Value var, int* value_out) {
         Int_t value;
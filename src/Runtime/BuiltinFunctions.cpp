@@ -1,5 +1,9 @@
+#include <Helium/Compiler/BatchCompiler.hpp>
+#include <Helium/Compiler/Optimizer.hpp>
 #include <Helium/Platform/ScriptContainer.hpp>
 #include <Helium/Runtime/BindingHelpers.hpp>
+#include <Helium/Runtime/Debug/HeapSnapshot.hpp>
+#include <Helium/Runtime/ModuleImage.hpp>
 #include <Helium/Runtime/NativeListFunctions.hpp>
 
 #include <filesystem>
@@ -57,9 +61,47 @@ namespace Helium
     }
 
     // Script
+
+    // Script.optimize(): void
+    static void Module_optimize(NativeFunctionContext& ctx, Module* module) {
+        Optimizer::optimize(*module);
+    }
+
+    // Script.save(fileName: string): void
+    static void Module_save(NativeFunctionContext& ctx, Module* module, StringPtr fileName) {
+        std::ofstream file(fileName.ptr, std::ios::binary);
+
+        auto saved = file && module->save([&file](span<const std::byte> data) {
+            file.write(reinterpret_cast<const char*>(data.data()), data.size());
+            return file ? data.size() : 0;
+        });
+
+        if (!saved)
+            RuntimeFunctions::raiseException("Failed to save module");
+    }
+
+    // Script.saveImage(fileName: string): void
+    static void Module_saveImage(NativeFunctionContext& ctx, Module* module, StringPtr fileName) {
+        std::ofstream file(fileName.ptr, std::ios::binary);
+
+        auto written = file && ModuleImage::write(*module, [&file](span<const std::byte> data) {
+            file.write(reinterpret_cast<const char*>(data.data()), data.size());
+            return file ? data.size() : 0;
+        });
+
+        if (!written)
+            RuntimeFunctions::raiseException("Failed to write module image");
+    }
+
     template <>
     std::pair<const std::pair<const char*, NativeFunction>*, size_t> getMethods<Module>() {
-        return {nullptr, 0};
+        static constexpr std::pair<const char*, NativeFunction> methods[]{
+            { "optimize",           wrapFunctionVoid<Module*, Module_optimize> },
+            { "save",               wrapFunctionVoid<Module*, StringPtr, Module_save> },
+            { "saveImage",          wrapFunctionVoid<Module*, StringPtr, Module_saveImage> },
+        };
+
+        return std::make_pair(methods, std::size(methods));
     }
 
     template <>
@@ -133,6 +175,36 @@ namespace Helium
         vm->execute(*activationContext);
     }
 
+    // VM.getNumCompiledFunctions(): int
+    static unsigned int VM_getNumCompiledFunctions(VM* vm) {
+        return static_cast<unsigned int>(vm->getNumCompiledFunctions());
+    }
+
+    // VM.isJitEnabled(): bool
+    static bool VM_isJitEnabled(VM* vm) {
+        return vm->isJitEnabled();
+    }
+
+    // VM.loadModuleImage(fileName: string): int
+    static void VM_loadModuleImage(NativeFunctionContext& ctx, VM* vm, StringPtr fileName) {
+        auto image = ModuleImage::map(fileName.ptr);
+
+        if (!image) {
+            RuntimeFunctions::raiseException("Failed to load module image");
+            return;
+        }
+
+        ctx.setReturnValue(ValueRef::makeInteger(vm->loadModuleImage(std::move(image))));
+    }
+
+    // VM.writeHeapSnapshot(fileName: string): void
+    static void VM_writeHeapSnapshot(NativeFunctionContext& ctx, VM* vm, StringPtr fileName) {
+        std::ofstream file(fileName.ptr, std::ios::binary);
+
+        if (!file || !HeapSnapshot::capture(*vm).save(file))
+            RuntimeFunctions::raiseException("Failed to write heap snapshot");
+    }
+
     // VM.run(): Variable
     /*static void VM_run(NativeFunctionContext& ctx, VM* vm, size_t entry) {
         Variable result;
@@ -149,7 +221,14 @@ namespace Helium
     std::pair<const std::pair<const char*, NativeFunction>*, size_t> getMethods<VM>() {
         static constexpr std::pair<const char*, NativeFunction> methods[]{
             { "execute",            wrapFunctionVoid<VM*, ActivationContext*, VM_execute> },
+            { "getNumCompiledFunctions", wrapFunction<unsigned int, VM*, VM_getNumCompiledFunctions> },
+            { "isJitEnabled",       wrapFunction<bool, VM*, VM_isJitEnabled> },
             { "loadModule",         wrapMethod<ModuleIndex_t, VM, Module*, &VM::loadModule> },
+            { "loadModuleImage",    wrapFunctionVoid<VM*, StringPtr, VM_loadModuleImage> },
+            { "setJitBackEdgeThreshold", wrapMethodVoid<VM, unsigned int, &VM::setJitBackEdgeThreshold> },
+            { "setJitEnabled",      wrapMethodVoid<VM, bool, &VM::setJitEnabled> },
+            { "setJitThreshold",    wrapMethodVoid<VM, unsigned int, &VM::setJitThreshold> },
+            { "writeHeapSnapshot",  wrapFunctionVoid<VM*, StringPtr, VM_writeHeapSnapshot> },
             //{ "run",                wrapFunction<VM*, size_t, VM_run> },
         };
 
@@ -196,12 +275,24 @@ namespace Helium
         return Compiler::version;
     }
 
+    // Compiler.setDebugInformation(enabled: bool)
+    static void Compiler_setDebugInformation(Compiler* compiler, bool enabled) {
+        compiler->setDebugInformation(enabled);
+    }
+
+    // Compiler.setNumThreads(count: int)
+    static void Compiler_setNumThreads(Compiler* compiler, unsigned int count) {
+        compiler->setNumThreads(count);
+    }
+
     template <>
     std::pair<const std::pair<const char*, NativeFunction>*, size_t> getMethods<Compiler>() {
         static constexpr std::pair<const char*, NativeFunction> methods[] {
             { "compileFile",        wrapFunctionVoid<Compiler*, StringPtr, Compiler_compileFile> },
             { "compileString",      wrapFunction<Module*,       Compiler*, StringPtr, StringPtr, Compiler_compileString> },
             { "getVersion",         wrapFunction<int,           Compiler*, Compiler_getVersion> },
+            { "setDebugInformation", wrapFunctionVoid<Compiler*, bool, Compiler_setDebugInformation> },
+            { "setNumThreads",      wrapFunctionVoid<Compiler*, unsigned int, Compiler_setNumThreads> },
         };
 
         return std::make_pair(methods, std::size(methods));
@@ -220,6 +311,110 @@ namespace Helium
         ctx.setReturnValue(move(object));
     }
 
+    // BatchCompiler
+
+    template <>
+    bool unwrap(Value var, BatchCompiler** value_out) { return unwrapClass(var, value_out); }
+
+    // BatchCompiler.addModulePath(path: string)
+    static void BatchCompiler_addModulePath(BatchCompiler* compiler, StringPtr path) {
+        compiler->addModulePath(path.ptr);
+    }
+
+    // BatchCompiler.compile(entryFiles: list of string): list of ${ fileName, module: Script?, error }
+    static void BatchCompiler_compile(NativeFunctionContext& ctx) {
+        BatchCompiler* compiler;
+
+        if (!checkNumberOfArguments<2>(ctx) || !unwrap(ctx.getArg(0), &compiler))
+            return;
+
+        auto entryList = ctx.getArg(1);
+
+        if (entryList.type != ValueType::list) {
+            RuntimeFunctions::raiseException("BatchCompiler.compile: expected a list of file names");
+            return;
+        }
+
+        std::vector<std::filesystem::path> entryFiles;
+
+        for (size_t i = 0; i < entryList.list->length; i++) {
+            StringPtr fileName;
+
+            if (!unwrap(entryList.list->items[i], &fileName))
+                return;
+
+            entryFiles.emplace_back(fileName.ptr);
+        }
+
+        std::vector<BatchCompiler::Unit> units;
+        compiler->compile(entryFiles, units);
+
+        ValueRef list;
+
+        if (!NativeListFunctions::newList(units.size(), &list))
+            return;
+
+        for (auto& unit : units) {
+            auto fileName = unit.fileName.u8string();
+            ValueRef module;
+
+            if (!wrap(unit.module.release(), &module))
+                return;
+
+            ValueRef object;
+
+            if (!NativeObjectFunctions::newObject(&object)
+                    || !NativeObjectFunctions::setProperty(object, "fileName", ValueRef::makeStringWithLength(fileName.c_str(), fileName.size()))
+                    || !NativeObjectFunctions::setProperty(object, "module", move(module))
+                    || !NativeObjectFunctions::setProperty(object, "error", ValueRef::makeStringWithLength(unit.error.c_str(), unit.error.size()))
+                    || !NativeListFunctions::addItem(list, move(object))) {
+                return;
+            }
+        }
+
+        ctx.setReturnValue(move(list));
+    }
+
+    // BatchCompiler.resolveImport(dependency: string): string?
+    static void BatchCompiler_resolveImport(NativeFunctionContext& ctx, BatchCompiler* compiler, StringPtr dependency) {
+        auto fileName = compiler->resolveImport(dependency.ptr);
+
+        if (!fileName) {
+            ctx.setReturnValue(ValueRef::makeNil());
+            return;
+        }
+
+        auto string = fileName->u8string();
+        ctx.setReturnValue(ValueRef::makeStringWithLength(string.c_str(), string.size()));
+    }
+
+    // BatchCompiler.setNumThreads(count: int)
+    static void BatchCompiler_setNumThreads(BatchCompiler* compiler, unsigned int count) {
+        compiler->setNumThreads(count);
+    }
+
+    template <>
+    std::pair<const std::pair<const char*, NativeFunction>*, size_t> getMethods<BatchCompiler>() {
+        static constexpr std::pair<const char*, NativeFunction> methods[] {
+            { "addModulePath",      wrapFunctionVoid<BatchCompiler*, StringPtr, BatchCompiler_addModulePath> },
+            { "compile",            BatchCompiler_compile },
+            { "resolveImport",      wrapFunctionVoid<BatchCompiler*, StringPtr, BatchCompiler_resolveImport> },
+            { "setNumThreads",      wrapFunctionVoid<BatchCompiler*, unsigned int, BatchCompiler_setNumThreads> },
+        };
+
+        return std::make_pair(methods, std::size(methods));
+    }
+
+    // BatchCompiler()
+    static void new_BatchCompiler(NativeFunctionContext& ctx) {
+        ValueRef object;
+
+        if (!wrapNewDelete(new BatchCompiler(), &object))
+            return;
+
+        ctx.setReturnValue(move(object));
+    }
+
     // ScriptContainer
 
     // ScriptContainer.run()
@@ -256,10 +451,51 @@ namespace Helium
             ctx.setReturnValue(move(var));
     }
 
+    // getFunctionStats(): list of ${ name, native, calls, inclusiveNs, exclusiveNs }
+    static void getFunctionStats(NativeFunctionContext& ctx) {
+        auto entries = ctx.getActivationContext().getVM()->getFunctionStats();
+
+        ValueRef list;
+
+        if (!NativeListFunctions::newList(entries.size(), &list))
+            return;
+
+        for (const auto& entry : entries) {
+            ValueRef object;
+
+            if (!NativeObjectFunctions::newObject(&object)
+                    || !NativeObjectFunctions::setProperty(object, "name", ValueRef::makeStringWithLength(entry.name.c_str(), entry.name.size()))
+                    || !NativeObjectFunctions::setProperty(object, "native", ValueRef::makeBoolean(entry.isNative))
+                    || !NativeObjectFunctions::setProperty(object, "calls", ValueRef::makeInteger(entry.stats.numCalls))
+                    || !NativeObjectFunctions::setProperty(object, "inclusiveNs", ValueRef::makeInteger(entry.stats.inclusiveTime.count()))
+                    || !NativeObjectFunctions::setProperty(object, "exclusiveNs", ValueRef::makeInteger(entry.stats.exclusiveTime.count()))
+                    || !NativeListFunctions::addItem(list, move(object))) {
+                return;
+            }
+        }
+
+        ctx.setReturnValue(move(list));
+    }
+
+    // setFunctionStatsEnabled(enabled: bool)
+    static void setFunctionStatsEnabled(NativeFunctionContext& ctx) {
+        bool enabled;
+
+        if (!checkNumberOfArguments<1>(ctx) || !RuntimeFunctions::asBoolean(ctx.getArg(0), &enabled, true))
+            return;
+
+        ctx.getActivationContext().getVM()->setFunctionStatsEnabled(enabled);
+    }
+
     // used by tests; should be probably moved
     static void functionThatAcceptsUnsignedInt(NativeFunctionContext& ctx, unsigned int) {
     }
 
+    // _getPoolMemoryUsage(): int
+    static void getPoolMemoryUsage(NativeFunctionContext& ctx) {
+        ctx.setReturnValue(ValueRef::makeInteger(Value::getPoolMemoryUsage()));
+    }
+
     static void listDirectory(NativeFunctionContext& ctx, StringPtr path) {
         std::error_code ec;
         auto iter = std::filesystem::directory_iterator(path.ptr, ec);
@@ -287,15 +523,93 @@ namespace Helium
         ctx.setReturnValue(move(list));
     }
 
+    // loadBinaryModule(fileName: string): Script
+    static void loadBinaryModule(NativeFunctionContext& ctx, StringPtr fileName) {
+        std::ifstream file(fileName.ptr, std::ios::binary);
+
+        auto module = Module::load([&file](span<std::byte> buffer) {
+            file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+            return static_cast<size_t>(file.gcount());
+        });
+
+        if (!module) {
+            RuntimeFunctions::raiseException("Failed to load binary module");
+            return;
+        }
+
+        ValueRef wrapped;
+
+        if (wrap(module.release(), &wrapped))
+            ctx.setReturnValue(move(wrapped));
+    }
+
+    // loadHeapSnapshot(fileName: string): list of ${ type, shallowSize, retainedSize, dominator, edges: list of ${ to, name } }
+    static void loadHeapSnapshot(NativeFunctionContext& ctx, StringPtr fileName) {
+        std::ifstream file(fileName.ptr, std::ios::binary);
+        auto snapshot = HeapSnapshot::load(file);
+
+        if (!snapshot) {
+            RuntimeFunctions::raiseException("Failed to load heap snapshot");
+            return;
+        }
+
+        auto const& nodes = snapshot->getNodes();
+        ValueRef list;
+
+        if (!NativeListFunctions::newList(nodes.size(), &list))
+            return;
+
+        for (const auto& node : nodes) {
+            auto type = to_string(node.type);
+            auto dominator = node.dominator != HeapSnapshot::noNode ? ValueRef::makeInteger(node.dominator) : ValueRef::makeNil();
+
+            ValueRef edges;
+
+            if (!NativeListFunctions::newList(node.edges.size(), &edges))
+                return;
+
+            for (const auto& edge : node.edges) {
+                ValueRef object;
+
+                if (!NativeObjectFunctions::newObject(&object)
+                        || !NativeObjectFunctions::setProperty(object, "to", ValueRef::makeInteger(edge.to))
+                        || !NativeObjectFunctions::setProperty(object, "name", ValueRef::makeStringWithLength(edge.name.c_str(), edge.name.size()))
+                        || !NativeListFunctions::addItem(edges, move(object))) {
+                    return;
+                }
+            }
+
+            ValueRef object;
+
+            if (!NativeObjectFunctions::newObject(&object)
+                    || !NativeObjectFunctions::setProperty(object, "type", ValueRef::makeStringWithLength(type.data(), type.size()))
+                    || !NativeObjectFunctions::setProperty(object, "shallowSize", ValueRef::makeInteger(node.shallowSize))
+                    || !NativeObjectFunctions::setProperty(object, "retainedSize", ValueRef::makeInteger(node.retainedSize))
+                    || !NativeObjectFunctions::setProperty(object, "dominator", move(dominator))
+                    || !NativeObjectFunctions::setProperty(object, "edges", move(edges))
+                    || !NativeListFunctions::addItem(list, move(object))) {
+                return;
+            }
+        }
+
+        ctx.setReturnValue(move(list));
+    }
+
     void registerBuiltinFunctions(VM* vm) {
+        vm->registerCallback("getFunctionStats", &getFunctionStats);
         vm->registerCallback("getVM", &getVM);
+        vm->registerCallback("loadBinaryModule", &wrapFunctionVoid<StringPtr, loadBinaryModule>);
+        vm->registerCallback("loadHeapSnapshot", &wrapFunctionVoid<StringPtr, loadHeapSnapshot>);
         vm->registerCallback("print", &print);
+        vm->registerCallback("setFunctionStatsEnabled", &setFunctionStatsEnabled);
 
         vm->registerCallback("ActivationContext", &wrapFunctionVoid<VM*, new_ActivationContext>);
+        vm->registerCallback("BatchCompiler", &new_BatchCompiler);
         vm->registerCallback("Compiler", &new_Compiler);
         vm->registerCallback("VM", &new_VM);
 
         vm->registerCallback("_functionThatAcceptsUnsignedInt", &wrapFunctionVoid<unsigned int, functionThatAcceptsUnsignedInt>);
+        vm->registerCallback("_getPoolMemoryUsage", &getPoolMemoryUsage);
         vm->registerCallback("_listDirectory", &wrapFunctionVoid<StringPtr, listDirectory>);
 
         //vm->registerCallback("ScriptContainer", &new_ScriptContainer);
@@ -0,0 +1,61 @@
+#include <Helium/Assert.hpp>
+#include <Helium/Runtime/ActivationContext.hpp>
+#include <Helium/Runtime/Code.hpp>
+#include <Helium/Runtime/Debug/AllocationProfiler.hpp>
+
+#include <fmt/format.h>
+
+#include <ostream>
+#include <vector>
+
+namespace Helium {
+
+using fmt::format;
+
+AllocationProfiler* AllocationProfiler::active = nullptr;
+
+AllocationProfiler::AllocationProfiler(size_t sampleInterval)
+        : sampleInterval(static_cast<int64_t>(sampleInterval)), bytesUntilNextSample(static_cast<int64_t>(sampleInterval)) {
+    helium_assert(sampleInterval > 0);
+    helium_assert(active == nullptr);
+
+    active = this;
+}
+
+AllocationProfiler::~AllocationProfiler() {
+    active = nullptr;
+}
+
+void AllocationProfiler::takeSample(ValueType type) {
+    // A large allocation may span more than one interval
+    auto numIntervals = 1 + (-bytesUntilNextSample) / sampleInterval;
+    bytesUntilNextSample += numIntervals * sampleInterval;
+
+    std::vector<StackFrameInfo> frames;
+
+    if (auto ctx = ActivationContext::getCurrentOrNull()) {
+        ctx->walkStack([&frames](StackFrameInfo const& frame) {
+            frames.push_back(frame);
+        });
+    }
+
+    std::string stack;
+
+    // walkStack goes from the innermost frame outwards
+    for (auto iter = frames.rbegin(); iter != frames.rend(); iter++)
+        stack += to_string(*iter) + ';';
+
+    if (frames.empty())
+        stack += "(native);";
+
+    stack += to_string(type);
+
+    bytesByStack[stack] += numIntervals * sampleInterval;
+}
+
+void AllocationProfiler::writeFoldedStacks(std::ostream& os) const {
+    for (auto const& [stack, bytes] : bytesByStack)
+        os << stack << ' ' << bytes << '\n';
+}
+
+}
@@ -0,0 +1,85 @@
+#include <Helium/Assert.hpp>
+#include <Helium/Runtime/ActivationContext.hpp>
+#include <Helium/Runtime/Code.hpp>
+#include <Helium/Runtime/Debug/CpuProfiler.hpp>
+
+#include <fmt/format.h>
+
+#include <ostream>
+
+namespace Helium {
+
+using fmt::format;
+
+CpuProfiler* CpuProfiler::active = nullptr;
+
+CpuProfiler::CpuProfiler(size_t sampleInterval, size_t capacity)
+        : sampleInterval(sampleInterval), instructionsUntilNextSample(sampleInterval),
+          capacity(capacity), ring(std::make_unique<Sample[]>(capacity)) {
+    helium_assert(sampleInterval > 0);
+    helium_assert(capacity > 0);
+    helium_assert(active == nullptr);
+
+    active = this;
+}
+
+CpuProfiler::~CpuProfiler() {
+    active = nullptr;
+}
+
+void CpuProfiler::takeSample(ActivationContext& ctx) {
+    instructionsUntilNextSample = sampleInterval;
+
+    // Indices grow monotonically; the slot is index % capacity
+    auto write = writeIndex.load(std::memory_order_relaxed);
+
+    if (write - readIndex.load(std::memory_order_acquire) == capacity) {
+        numDroppedSamples.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto& sample = ring[write % capacity];
+    sample.depth = 0;
+    sample.truncated = false;
+
+    ctx.walkStack([&sample](StackFrameInfo const& frame) {
+        if (sample.depth < maxStackDepth)
+            sample.frames[sample.depth++] = frame;
+        else
+            sample.truncated = true;
+    });
+
+    writeIndex.store(write + 1, std::memory_order_release);
+}
+
+void CpuProfiler::collect() {
+    auto read = readIndex.load(std::memory_order_relaxed);
+    auto write = writeIndex.load(std::memory_order_acquire);
+
+    for (; read != write; read++) {
+        auto const& sample = ring[read % capacity];
+
+        std::string stack = sample.truncated ? "(truncated)" : "";
+
+        for (size_t i = sample.depth; i-- > 0; ) {
+            if (!stack.empty())
+                stack += ';';
+
+            stack += to_string(sample.frames[i]);
+        }
+
+        if (stack.empty())
+            stack = "(unknown)";
+
+        samplesByStack[stack]++;
+    }
+
+    readIndex.store(read, std::memory_order_release);
+}
+
+void CpuProfiler::writeFoldedStacks(std::ostream& os) const {
+    for (auto const& [stack, count] : samplesByStack)
+        os << stack << ' ' << count << '\n';
+}
+
+}
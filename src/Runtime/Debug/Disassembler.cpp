@@ -21,6 +21,19 @@ namespace Helium
         return {};
     }
 
+    static const char* switchTableKindAsString( SwitchTable::Kind kind )
+    {
+        switch ( kind )
+        {
+            case SwitchTable::Kind::linear: return "linear";
+            case SwitchTable::Kind::denseInteger: return "dense integer";
+            case SwitchTable::Kind::sparseInteger: return "sparse integer";
+            case SwitchTable::Kind::stringHash: return "string hash";
+        }
+
+        return "?";
+    }
+
     static std::string variableAsString( Value var )
     {
         switch ( var.type )
@@ -62,6 +75,9 @@ namespace Helium
 
         output("");
 
+        // Line of the last annotated instruction, so that only changes are printed
+        int currentLine = -1;
+
         for ( size_t pc = 0; pc < script.code.size(); pc++ )
         {
             Instruction* current = script.code[pc];
@@ -97,6 +113,17 @@ namespace Helium
                     snprintf(buffer, sizeof(buffer), "; eh %zu: <%04X; %04X) => %04X", i, eh.start, eh.start + eh.length, eh.handler);
                     output(buffer);
                 }
+
+                currentLine = -1;
+            }
+
+            if (maybeFunc) {
+                auto line = maybeFunc->lineTable.getLine(pc - maybeFunc->start);
+
+                if (line >= 0 && line != currentLine) {
+                    output(format("; line {}", line));
+                    currentLine = line;
+                }
             }
 
             std::stringstream ss;
@@ -145,6 +172,18 @@ namespace Helium
                     ss << " " << current->realValue;
                     break;
 
+                case OperandType::registers: {
+                    auto operands = RegisterOperands::unpack(current->integer);
+
+                    if (operands.destination == RegisterOperands::toStack)
+                        ss << " push, ";
+                    else
+                        ss << " " << operands.destination << ", ";
+
+                    ss << operands.left << (operands.rightIsConstant ? ", #" : ", ") << operands.right;
+                    break;
+                }
+
                 case OperandType::string: {
                     ss << " " << current->stringIndex << "\t; '";
                     const auto& string = script.stringPool[current->stringIndex];
@@ -155,11 +194,12 @@ namespace Helium
 
                 case OperandType::switchTable:
                 {
+                    auto switchTable = script.switchTables[current->switchTableIndex];
+
+                    ss << "\t; " << switchTableKindAsString( switchTable->kind );
                     output(ss.str());
                     std::stringstream().swap(ss);
 
-                    auto switchTable = script.switchTables[current->switchTableIndex];
-
                     for ( unsigned i = 0; i < switchTable->handlers.size(); i++ )
                     {
                         ss << "              " ;
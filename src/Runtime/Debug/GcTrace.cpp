@@ -33,7 +33,8 @@ GcTrace::~GcTrace() {
     logfile.close();
 }
 
-void GcTrace::beginCollectGarbage(GarbageCollectReason reason, int numInstructionsSinceLastCollect) {
+#if HELIUM_TRACE_GC
+void GcTrace::beginCollectGarbage(GarbageCollectReason reason, uint64_t numInstructionsSinceLastCollect) {
     logfile << "[";
     printTimestamp(logfile, std::time(nullptr));
     logfile << format("] GC_TRACE: start; reason={} numInstructionsSinceLastCollect={} numExistingValues={}\n",
@@ -52,4 +53,6 @@ void GcTrace::endCollectGarbage(int numValuesCollected) {
             numValuesCollected, end - startTime, Value::getNumExistingValues());
 }
 
+#endif
+
 }
@@ -0,0 +1,484 @@
+#include <Helium/Assert.hpp>
+#include <Helium/Runtime/Debug/HeapSnapshot.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+
+/*
+ * Snapshot file format (all integers little-endian):
+ *
+ *   char[4]    magic "HEHS"
+ *   u32        version
+ *   u32        number of nodes
+ *   per node:
+ *     u8       type
+ *     u64      shallow size
+ *     u64      retained size
+ *     u32      dominator
+ *     u32      number of edges
+ *     per edge:
+ *       u32    target node
+ *       u32    name length
+ *       char[] name
+ */
+
+namespace Helium {
+
+using fmt::format;
+
+namespace {
+
+constexpr char magic[4] = {'H', 'E', 'H', 'S'};
+constexpr uint32_t formatVersion = 1;
+
+using NodeType = HeapSnapshot::NodeType;
+
+class GraphBuilder {
+public:
+    explicit GraphBuilder(std::vector<HeapSnapshot::Node>& nodes) : nodes(nodes) {}
+
+    uint32_t addNode(NodeType type, uint64_t shallowSize) {
+        nodes.push_back(HeapSnapshot::Node {type, shallowSize, 0, HeapSnapshot::noNode, {}});
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    void addEdge(uint32_t from, uint32_t to, std::string name) {
+        nodes[from].edges.push_back(HeapSnapshot::Edge {to, std::move(name)});
+    }
+
+    void addEdge(uint32_t from, Value to, std::string name) {
+        auto index = getNodeForValue(to);
+
+        if (index != HeapSnapshot::noNode)
+            addEdge(from, index, std::move(name));
+    }
+
+    bool isKnown(Value value) const {
+        return nodeIndices.find(value.pointer) != nodeIndices.end();
+    }
+
+    // Walk everything reachable from the values discovered so far
+    void expandAll() {
+        while (!worklist.empty()) {
+            auto [index, value] = worklist.back();
+            worklist.pop_back();
+
+            if (value.type == ValueType::list) {
+                for (size_t i = 0; i < value.list->length; i++)
+                    addEdge(index, value.list->items[i], format("[{}]", i));
+            }
+            else if (value.type == ValueType::object) {
+                for (size_t i = 0; i < value.object->numMembers; i++)
+                    addEdge(index, value.object->members[i].value, value.object->members[i].key);
+            }
+        }
+    }
+
+private:
+    // Returns noNode for values which are not heap-allocated
+    uint32_t getNodeForValue(Value value) {
+        NodeType type;
+        uint64_t shallowSize;
+
+        switch (value.type) {
+        case ValueType::list:
+            type = NodeType::list;
+            shallowSize = sizeof(ListInfo) + value.list->capacity * sizeof(Value);
+            break;
+
+        case ValueType::object:
+            type = NodeType::object;
+            shallowSize = sizeof(ObjectInfo) + value.object->capacity * sizeof(Member);
+
+            for (size_t i = 0; i < value.object->numMembers; i++)
+                shallowSize += strlen(value.object->members[i].key) + 1;
+            break;
+
+        case ValueType::string:
+            type = NodeType::string;
+            shallowSize = sizeof(unsigned) + value.length + 1;
+            break;
+
+        default:
+            return HeapSnapshot::noNode;
+        }
+
+        auto [iter, inserted] = nodeIndices.emplace(value.pointer, static_cast<uint32_t>(nodes.size()));
+
+        if (inserted) {
+            addNode(type, shallowSize);
+            worklist.emplace_back(iter->second, value);
+        }
+
+        return iter->second;
+    }
+
+    std::vector<HeapSnapshot::Node>& nodes;
+    std::unordered_map<void const*, uint32_t> nodeIndices;
+    std::vector<std::pair<uint32_t, Value>> worklist;
+};
+
+void writeU8(std::ostream& os, uint8_t value) {
+    os.put(static_cast<char>(value));
+}
+
+void writeU32(std::ostream& os, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        os.put(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+void writeU64(std::ostream& os, uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        os.put(static_cast<char>((value >> (i * 8)) & 0xff));
+}
+
+template <typename T>
+bool readUnsigned(std::istream& is, T* value_out) {
+    unsigned char bytes[sizeof(T)];
+
+    if (!is.read(reinterpret_cast<char*>(bytes), sizeof(bytes)))
+        return false;
+
+    T value = 0;
+
+    for (size_t i = 0; i < sizeof(T); i++)
+        value |= static_cast<T>(bytes[i]) << (i * 8);
+
+    *value_out = value;
+    return true;
+}
+
+// Reads a string in bounded pieces, so that a corrupt length fails at the end of the stream instead of allocating it
+bool readString(std::istream& is, size_t length, std::string* string_out) {
+    constexpr size_t pieceSize = 4096;
+
+    string_out->clear();
+
+    while (string_out->size() < length) {
+        auto offset = string_out->size();
+        string_out->resize(offset + std::min(pieceSize, length - offset));
+
+        if (!is.read(string_out->data() + offset, string_out->size() - offset))
+            return false;
+    }
+
+    return true;
+}
+
+}
+
+HeapSnapshot HeapSnapshot::capture(VM& vm) {
+    HeapSnapshot snapshot;
+    GraphBuilder builder(snapshot.nodes);
+
+    auto root = builder.addNode(NodeType::root, 0);
+    builder.addEdge(root, vm.global, "global");
+
+    for (size_t i = 0; i < vm.activationContexts.size(); i++) {
+        auto& ctx = *vm.activationContexts[i];
+
+        auto ctxNode = builder.addNode(NodeType::activationContext, sizeof(ActivationContext));
+        builder.addEdge(root, ctxNode, format("context #{}", i));
+
+        for (size_t j = 0; j < ctx.frames.size(); j++) {
+            auto& frame = ctx.frames[j];
+
+            auto frameNode = builder.addNode(NodeType::frame, sizeof(Frame) + frame.locals.capacity() * sizeof(ValueRef));
+            builder.addEdge(ctxNode, frameNode, format("frame #{} `{}`", j, frame.scriptFunction->name));
+
+            for (size_t k = 0; k < frame.locals.size(); k++)
+                builder.addEdge(frameNode, frame.locals[k], k == 0 ? std::string("self") : format("local #{}", k));
+        }
+
+        // Without any frames, the stack might hold borrowed references to locals which no longer exist
+        if (!ctx.frames.empty()) {
+            auto height = ctx.stack.getHeight();
+
+            for (size_t j = 0; j < height; j++)
+                builder.addEdge(ctxNode, ctx.stack.getBelowTop(height - 1 - j), format("stack[{}]", j));
+        }
+
+        builder.addEdge(ctxNode, ctx.exception, "exception");
+    }
+
+    builder.expandAll();
+
+    // Whatever is buffered as a possible root but was not reached yet is garbage awaiting collection
+    for (size_t i = 0; i < vm.possibleRoots.size(); i++) {
+        auto value = vm.possibleRoots[i];
+
+        if (value.gc->numReferences != 0 && !builder.isKnown(value))
+            builder.addEdge(root, value, format("(uncollected cycle) #{}", i));
+    }
+
+    builder.expandAll();
+
+    snapshot.computeRetainedSizes();
+    return snapshot;
+}
+
+void HeapSnapshot::computeRetainedSizes() {
+    const auto numNodes = nodes.size();
+
+    // Depth-first post-order numbering from the root
+    std::vector<uint32_t> postOrder;
+    std::vector<uint32_t> postOrderIndex(numNodes, noNode);
+    std::vector<bool> visited(numNodes, false);
+    std::vector<std::pair<uint32_t, size_t>> dfsStack;
+
+    postOrder.reserve(numNodes);
+    dfsStack.emplace_back(0, 0);
+    visited[0] = true;
+
+    while (!dfsStack.empty()) {
+        auto node = dfsStack.back().first;
+        auto nextEdge = dfsStack.back().second;
+
+        if (nextEdge < nodes[node].edges.size()) {
+            dfsStack.back().second++;
+            auto to = nodes[node].edges[nextEdge].to;
+
+            if (!visited[to]) {
+                visited[to] = true;
+                dfsStack.emplace_back(to, 0);
+            }
+        }
+        else {
+            postOrderIndex[node] = static_cast<uint32_t>(postOrder.size());
+            postOrder.push_back(node);
+            dfsStack.pop_back();
+        }
+    }
+
+    std::vector<std::vector<uint32_t>> predecessors(numNodes);
+
+    for (auto node : postOrder) {
+        for (auto const& edge : nodes[node].edges)
+            predecessors[edge.to].push_back(node);
+    }
+
+    // Immediate dominators; see Cooper, Harvey & Kennedy: A Simple, Fast Dominance Algorithm
+    std::vector<uint32_t> dominators(numNodes, noNode);
+    dominators[0] = 0;
+
+    auto intersect = [&](uint32_t a, uint32_t b) {
+        while (a != b) {
+            while (postOrderIndex[a] < postOrderIndex[b])
+                a = dominators[a];
+            while (postOrderIndex[b] < postOrderIndex[a])
+                b = dominators[b];
+        }
+
+        return a;
+    };
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+
+        // Reverse post-order, skipping the root (which is always last)
+        for (size_t i = postOrder.size() - 1; i-- > 0; ) {
+            auto node = postOrder[i];
+            auto newDominator = noNode;
+
+            for (auto pred : predecessors[node]) {
+                if (dominators[pred] == noNode)
+                    continue;
+
+                newDominator = (newDominator == noNode) ? pred : intersect(pred, newDominator);
+            }
+
+            if (dominators[node] != newDominator) {
+                dominators[node] = newDominator;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < numNodes; i++) {
+        nodes[i].dominator = (i == 0) ? noNode : dominators[i];
+        nodes[i].retainedSize = nodes[i].shallowSize;
+    }
+
+    // Every node comes after all the nodes it dominates
+    for (size_t i = 0; i + 1 < postOrder.size(); i++) {
+        auto node = postOrder[i];
+        nodes[nodes[node].dominator].retainedSize += nodes[node].retainedSize;
+    }
+}
+
+bool HeapSnapshot::save(std::ostream& os) const {
+    os.write(magic, sizeof(magic));
+    writeU32(os, formatVersion);
+    writeU32(os, static_cast<uint32_t>(nodes.size()));
+
+    for (auto const& node : nodes) {
+        writeU8(os, static_cast<uint8_t>(node.type));
+        writeU64(os, node.shallowSize);
+        writeU64(os, node.retainedSize);
+        writeU32(os, node.dominator);
+        writeU32(os, static_cast<uint32_t>(node.edges.size()));
+
+        for (auto const& edge : node.edges) {
+            writeU32(os, edge.to);
+            writeU32(os, static_cast<uint32_t>(edge.name.size()));
+            os.write(edge.name.data(), edge.name.size());
+        }
+    }
+
+    return os.good();
+}
+
+std::optional<HeapSnapshot> HeapSnapshot::load(std::istream& is) {
+    char fileMagic[sizeof(magic)];
+    uint32_t version, numNodes;
+
+    if (!is.read(fileMagic, sizeof(fileMagic)) || memcmp(fileMagic, magic, sizeof(magic)) != 0
+            || !readUnsigned(is, &version) || version != formatVersion
+            || !readUnsigned(is, &numNodes) || numNodes == 0) {
+        return {};
+    }
+
+    // The counts come from the file, so nothing is allocated for records before they have actually been read
+    HeapSnapshot snapshot;
+
+    for (uint32_t index = 0; index < numNodes; index++) {
+        Node node;
+        uint8_t type;
+        uint32_t numEdges;
+
+        if (!readUnsigned(is, &type) || type > static_cast<uint8_t>(NodeType::string)
+                || !readUnsigned(is, &node.shallowSize)
+                || !readUnsigned(is, &node.retainedSize)
+                || !readUnsigned(is, &node.dominator)
+                || (node.dominator >= numNodes && node.dominator != noNode)
+                || !readUnsigned(is, &numEdges)) {
+            return {};
+        }
+
+        node.type = static_cast<NodeType>(type);
+
+        for (uint32_t i = 0; i < numEdges; i++) {
+            Edge edge;
+            uint32_t nameLength;
+
+            if (!readUnsigned(is, &edge.to) || edge.to >= numNodes || !readUnsigned(is, &nameLength))
+                return {};
+
+            if (!readString(is, nameLength, &edge.name))
+                return {};
+
+            node.edges.push_back(std::move(edge));
+        }
+
+        snapshot.nodes.push_back(std::move(node));
+    }
+
+    return snapshot;
+}
+
+void HeapSnapshot::printSummary(std::ostream& os, size_t maxEntries) const {
+    constexpr size_t numTypes = static_cast<size_t>(NodeType::string) + 1;
+
+    size_t numEdges = 0;
+    uint64_t totalSize = 0;
+    size_t countByType[numTypes] {};
+    uint64_t sizeByType[numTypes] {};
+
+    for (auto const& node : nodes) {
+        numEdges += node.edges.size();
+        totalSize += node.shallowSize;
+        countByType[static_cast<size_t>(node.type)]++;
+        sizeByType[static_cast<size_t>(node.type)] += node.shallowSize;
+    }
+
+    os << format("Heap snapshot: {} nodes, {} edges, {} bytes\n\n", nodes.size(), numEdges, totalSize);
+    os << format("{:<20} {:>10} {:>14}\n", "type", "count", "shallow size");
+
+    for (size_t i = 0; i < numTypes; i++) {
+        if (countByType[i] != 0)
+            os << format("{:<20} {:>10} {:>14}\n", to_string(static_cast<NodeType>(i)), countByType[i], sizeByType[i]);
+    }
+
+    // Shortest retaining path of each node, as (parent, edge index)
+    std::vector<std::pair<uint32_t, size_t>> parents(nodes.size(), {noNode, 0});
+    std::deque<uint32_t> queue {0};
+    parents[0] = {0, 0};
+
+    while (!queue.empty()) {
+        auto node = queue.front();
+        queue.pop_front();
+
+        for (size_t i = 0; i < nodes[node].edges.size(); i++) {
+            auto to = nodes[node].edges[i].to;
+
+            if (parents[to].first == noNode) {
+                parents[to] = {node, i};
+                queue.push_back(to);
+            }
+        }
+    }
+
+    auto getPath = [&](uint32_t node) {
+        std::vector<uint32_t> chain;
+
+        for (; node != 0 && parents[node].first != noNode; node = parents[node].first)
+            chain.push_back(node);
+
+        std::string path;
+
+        for (auto iter = chain.rbegin(); iter != chain.rend(); iter++) {
+            auto parent = parents[*iter].first;
+            auto const& name = nodes[parent].edges[parents[*iter].second].name;
+
+            if (path.empty() || name[0] == '[')
+                path += name;
+            else if (nodes[parent].type == NodeType::object)
+                path += "." + name;
+            else
+                path += " / " + name;
+        }
+
+        return path;
+    };
+
+    std::vector<uint32_t> order;
+
+    for (uint32_t i = 1; i < nodes.size(); i++)
+        order.push_back(i);
+
+    auto numEntries = std::min(maxEntries, order.size());
+
+    std::partial_sort(order.begin(), order.begin() + numEntries, order.end(), [this](uint32_t a, uint32_t b) {
+        return nodes[a].retainedSize > nodes[b].retainedSize;
+    });
+
+    os << format("\nLargest retained sizes:\n");
+    os << format("{:>14} {:>14}  {:<20} {}\n", "retained size", "shallow size", "type", "path");
+
+    for (size_t i = 0; i < numEntries; i++) {
+        auto const& node = nodes[order[i]];
+        os << format("{:>14} {:>14}  {:<20} {}\n", node.retainedSize, node.shallowSize, to_string(node.type),
+                     getPath(order[i]));
+    }
+}
+
+std::string_view to_string(HeapSnapshot::NodeType t) {
+    switch (t) {
+    case HeapSnapshot::NodeType::root: return "root";
+    case HeapSnapshot::NodeType::activationContext: return "activationContext";
+    case HeapSnapshot::NodeType::frame: return "frame";
+    case HeapSnapshot::NodeType::list: return "list";
+    case HeapSnapshot::NodeType::object: return "object";
+    case HeapSnapshot::NodeType::string: return "string";
+    }
+
+    helium_unreachable();
+}
+
+}
@@ -0,0 +1,96 @@
+#include <Helium/Runtime/Debug/OpcodeStats.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+namespace Helium {
+
+using fmt::format;
+
+uint64_t OpcodeStats::counts[Opcodes::numValidOpcodes];
+uint64_t OpcodeStats::totalCycles[Opcodes::numValidOpcodes];
+uint64_t OpcodeStats::pairCounts[Opcodes::numValidOpcodes][Opcodes::numValidOpcodes];
+Opcode_t OpcodeStats::previousOpcode = Opcodes::numValidOpcodes;
+
+uint64_t OpcodeStats::readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void OpcodeStats::reset() {
+    memset(counts, 0, sizeof(counts));
+    memset(totalCycles, 0, sizeof(totalCycles));
+    memset(pairCounts, 0, sizeof(pairCounts));
+    previousOpcode = Opcodes::numValidOpcodes;
+}
+
+void OpcodeStats::writeReport(std::ostream& os, size_t maxPairs) {
+    uint64_t totalCount = 0;
+
+    for (auto count : counts)
+        totalCount += count;
+
+    std::vector<Opcode_t> opcodes;
+
+    for (Opcode_t opcode = 0; opcode < Opcodes::numValidOpcodes; opcode++) {
+        if (counts[opcode] != 0)
+            opcodes.push_back(opcode);
+    }
+
+    std::sort(opcodes.begin(), opcodes.end(), [](Opcode_t a, Opcode_t b) { return counts[a] > counts[b]; });
+
+    os << format("{} instructions executed\n\n", totalCount);
+    os << format("{:<16} {:>14} {:>8} {:>16} {:>12}\n", "opcode", "count", "%", "cycles", "cycles/op");
+
+    for (auto opcode : opcodes) {
+        os << format("{:<16} {:>14} {:>8.2f} {:>16} {:>12.1f}\n",
+                     InstructionDesc::getByOpcode(opcode)->name,
+                     counts[opcode],
+                     100.0 * counts[opcode] / totalCount,
+                     totalCycles[opcode],
+                     static_cast<double>(totalCycles[opcode]) / counts[opcode]);
+    }
+
+    std::vector<std::pair<Opcode_t, Opcode_t>> pairs;
+
+    for (Opcode_t first = 0; first < Opcodes::numValidOpcodes; first++) {
+        for (Opcode_t second = 0; second < Opcodes::numValidOpcodes; second++) {
+            if (pairCounts[first][second] != 0)
+                pairs.emplace_back(first, second);
+        }
+    }
+
+    auto numPairs = std::min(maxPairs, pairs.size());
+
+    std::partial_sort(pairs.begin(), pairs.begin() + numPairs, pairs.end(), [](auto const& a, auto const& b) {
+        return pairCounts[a.first][a.second] > pairCounts[b.first][b.second];
+    });
+
+    os << format("\n{:<34} {:>14} {:>8}\n", "opcode pair", "count", "%");
+
+    for (size_t i = 0; i < numPairs; i++) {
+        auto [first, second] = pairs[i];
+        auto name = format("{} -> {}", InstructionDesc::getByOpcode(first)->name,
+                           InstructionDesc::getByOpcode(second)->name);
+
+        os << format("{:<34} {:>14} {:>8.2f}\n", name, pairCounts[first][second],
+                     100.0 * pairCounts[first][second] / totalCount);
+    }
+}
+
+}
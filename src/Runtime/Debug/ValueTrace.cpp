@@ -1,4 +1,5 @@
 #include <Helium/Assert.hpp>
+#include <Helium/Config.hpp>
 #include <Helium/Runtime/ActivationContext.hpp>
 #include <Helium/Runtime/Code.hpp>
 #include <Helium/Runtime/Debug/ValueTrace.hpp>
@@ -9,6 +10,8 @@
 #include <iostream>
 #include <unordered_map>
 
+#if HELIUM_TRACE_VALUES
+
 // TODO: it might be useful to give an option to exclude primitive types from the tracking
 
 namespace Helium {
@@ -26,8 +29,8 @@ struct ValueInfo {
 };
 
 namespace {
-    // FIXME: make thread-local
-    ValueTraceCtx *s_current = nullptr;
+    // Compilers may run on several threads at once (see BatchCompiler)
+    thread_local ValueTraceCtx *s_current = nullptr;
     std::unordered_map<VarId_t, ValueInfo> s_values;
     int s_numFatalErrors = 0;
 
@@ -43,9 +46,16 @@ namespace {
                 auto instr = context->ctx->getLastExecutedInstruction();
 
                 if (instr) {
-                    auto origin = instr->origin;
                     auto id = InstructionDesc::getByOpcode(instr->opcode);
-                    logfile << format("instruction {} in `{}`\t({}:{})", id->name, origin->function->c_str(), origin->unit->c_str(), origin->line);
+                    std::string location;
+
+                    // Only the innermost frame is of interest
+                    context->ctx->walkStack([&location](StackFrameInfo const& frame) {
+                        if (location.empty())
+                            location = to_string(frame);
+                    });
+
+                    logfile << format("instruction {} in {}", id->name, location);
                 }
                 else {
                     logfile << "unknown instruction";
@@ -174,3 +184,5 @@ ValueTraceCtx::~ValueTraceCtx() {
 }
 
 }
+
+#endif
@@ -50,6 +50,7 @@ static const InstructionDesc descs[] = {
     {Opcodes::dup1,         "dup1",         OperandType::none},
     {Opcodes::getLocal,     "getLocal",     OperandType::localIndex},
     {Opcodes::setLocal,     "setLocal",     OperandType::localIndex},
+    {Opcodes::clearLocal,   "clearLocal",   OperandType::localIndex},
 
     {Opcodes::getIndexed,   "getIndexed",   OperandType::none},
     {Opcodes::setIndexed,   "setIndexed",   OperandType::none},
@@ -60,6 +61,18 @@ static const InstructionDesc descs[] = {
     {Opcodes::assert,       "assert",       OperandType::string},
     {Opcodes::new_list,     "new.list",     OperandType::integer},
     {Opcodes::new_obj,      "new.obj",      OperandType::none},
+
+    {Opcodes::add_r,        "add.r",        OperandType::registers},
+    {Opcodes::div_r,        "div.r",        OperandType::registers},
+    {Opcodes::mod_r,        "mod.r",        OperandType::registers},
+    {Opcodes::mul_r,        "mul.r",        OperandType::registers},
+    {Opcodes::sub_r,        "sub.r",        OperandType::registers},
+    {Opcodes::eq_r,         "eq.r",         OperandType::registers},
+    {Opcodes::grtr_r,       "grtr.r",       OperandType::registers},
+    {Opcodes::grtrEq_r,     "grtreq.r",     OperandType::registers},
+    {Opcodes::less_r,       "less.r",       OperandType::registers},
+    {Opcodes::lessEq_r,     "lesseq.r",     OperandType::registers},
+    {Opcodes::neq_r,        "neq.r",        OperandType::registers},
 };
 
 const InstructionDesc* InstructionDesc::getByOpcode(Opcode_t opcode) {
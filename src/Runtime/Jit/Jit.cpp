@@ -0,0 +1,1298 @@
+#include <Helium/Assert.hpp>
+#include <Helium/Config.hpp>
+#include <Helium/Runtime/ActivationContext.hpp>
+#include <Helium/Runtime/Jit.hpp>
+#include <Helium/Runtime/RuntimeFunctions.hpp>
+#include <Helium/Runtime/VM.hpp>
+
+#if HELIUM_WITH_JIT
+#include "X86Assembler.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+#endif
+
+namespace Helium
+{
+#if HELIUM_WITH_JIT
+namespace {
+    using BinaryOperator = ValueRef (*)(Value left, Value right);
+    using UnaryOperator = ValueRef (*)(Value value);
+    using Comparison = bool (*)(Value left, Value right, bool* result_out);
+
+    // Helpers called from compiled code. Each one does what the interpreter does for an instruction;
+    // those returning bool return false if an exception was raised.
+
+    void growStack(InlineStack<Value>* stack) {
+        stack->reserveOne();
+    }
+
+    void pushConstant(InlineStack<Value>* stack, Instruction const* instruction) {
+        switch (instruction->opcode) {
+            case Opcodes::pushc_b: stack->push(ValueRef::makeBoolean(instruction->integer != 0)); break;
+            case Opcodes::pushc_f: stack->push(ValueRef::makeReal(instruction->realValue)); break;
+            case Opcodes::pushc_i: stack->push(ValueRef::makeInteger(instruction->integer)); break;
+            default: stack->push(ValueRef::makeNil()); break;
+        }
+    }
+
+    void pushString(InlineStack<Value>* stack, VMString const* string) {
+        stack->push(ValueRef::makeStringWithLength(string->text, string->length));
+    }
+
+    void setLocal(ValueRef* locals, InlineStack<Value>* stack, size_t index) {
+        locals[index] = stack->pop();
+    }
+
+    void clearLocal(ValueRef* locals, InlineStack<Value>* stack, size_t index) {
+        stack->takeOwnershipOfTop();
+        locals[index].reset();
+    }
+
+    void drop(InlineStack<Value>* stack) {
+        stack->drop();
+    }
+
+    bool binaryOperator(InlineStack<Value>* stack, BinaryOperator apply) {
+        auto right = stack->popForReading();
+        auto left = stack->popForReading();
+
+        ValueRef result = apply(left, right);
+
+        if (result->isUndefined())
+            return false;
+
+        stack->push(std::move(result));
+        return true;
+    }
+
+    // land and lor pop their operands the other way round
+    bool logicalOperator(InlineStack<Value>* stack, BinaryOperator apply) {
+        auto left = stack->popForReading();
+        auto right = stack->popForReading();
+
+        ValueRef result = apply(left, right);
+
+        if (result->isUndefined())
+            return false;
+
+        stack->push(std::move(result));
+        return true;
+    }
+
+    bool unaryOperator(InlineStack<Value>* stack, UnaryOperator apply) {
+        auto value = stack->popForReading();
+
+        ValueRef result = apply(value);
+
+        if (result->isUndefined())
+            return false;
+
+        stack->push(std::move(result));
+        return true;
+    }
+
+    bool comparison(InlineStack<Value>* stack, Comparison compare, bool negate) {
+        auto right = stack->popForReading();
+        auto left = stack->popForReading();
+        bool result;
+
+        if (!compare(left, right, &result))
+            return false;
+
+        stack->push(ValueRef::makeBoolean(result != negate));
+        return true;
+    }
+
+    template <typename Operator>
+    bool registerForm(ValueRef* locals, InlineStack<Value>* stack, int64_t packed, Operator apply) {
+        auto operands = RegisterOperands::unpack(packed);
+
+        ValueRef constant;
+
+        if (operands.rightIsConstant)
+            constant = ValueRef::makeInteger(operands.right);
+
+        Value right = operands.rightIsConstant ? static_cast<Value>(constant) : static_cast<Value>(locals[operands.right]);
+
+        ValueRef result = apply(locals[operands.left], right);
+
+        if (result->isUndefined())
+            return false;
+
+        if (operands.destination == RegisterOperands::toStack)
+            stack->push(std::move(result));
+        else
+            locals[operands.destination] = std::move(result);
+
+        return true;
+    }
+
+    bool registerOperator(ValueRef* locals, InlineStack<Value>* stack, int64_t packed, BinaryOperator apply) {
+        return registerForm(locals, stack, packed, apply);
+    }
+
+    bool registerComparison(ValueRef* locals, InlineStack<Value>* stack, int64_t packed, Comparison compare,
+                            bool negate) {
+        return registerForm(locals, stack, packed, [compare, negate](Value left, Value right) {
+            bool result;
+
+            if (!compare(left, right, &result))
+                return ValueRef();
+
+            return ValueRef::makeBoolean(result != negate);
+        });
+    }
+
+    // Pops a condition; returns -1 if an exception was raised
+    int condition(InlineStack<Value>* stack) {
+        auto value = stack->popForReading();
+        bool boolValue;
+
+        if (!RuntimeFunctions::asBoolean(value, &boolValue, true))
+            return -1;
+
+        return boolValue ? 1 : 0;
+    }
+
+    bool checkAssertion(InlineStack<Value>* stack, VMString const* expression) {
+        auto value = stack->popForReading();
+        bool boolValue;
+
+        if (!RuntimeFunctions::asBoolean(value, &boolValue, true))
+            return false;
+
+        if (!boolValue) {
+            auto string = std::string("failed assertion `") + expression->text + "`";
+            RuntimeFunctions::raiseException(string.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    bool getIndexed(InlineStack<Value>* stack) {
+        auto index = stack->popForReading();
+        auto range = stack->popForReading();
+
+        ValueRef item;
+
+        if (!RuntimeFunctions::getIndexed(range, index, &item))
+            return false;
+
+        stack->push(std::move(item));
+        return true;
+    }
+
+    bool setIndexed(InlineStack<Value>* stack) {
+        auto index = stack->popForReading();
+        auto list = stack->popForReading();
+
+        return RuntimeFunctions::setIndexed(list, index, stack->pop());
+    }
+
+    bool getProperty(InlineStack<Value>* stack, VMString const* name) {
+        auto object = stack->popForReading();
+
+        ValueRef member;
+
+        if (!RuntimeFunctions::getProperty(object, *name, &member, true))
+            return false;
+
+        stack->push(std::move(member));
+        return true;
+    }
+
+    bool setMember(InlineStack<Value>* stack, VMString const* name) {
+        auto object = stack->popForReading();
+
+        return RuntimeFunctions::setMember(object, *name, stack->pop());
+    }
+
+    // Called on backward jumps, which is where the interpreter would have checked at every instruction
+    void safepoint(VM* vm) {
+        vm->collectGarbageIfNeeded();
+    }
+
+    using Reg = X86Assembler::Reg;
+    using Mem = X86Assembler::Mem;
+    using Label = X86Assembler::Label;
+    using Condition = X86Assembler::Condition;
+
+    constexpr Reg rax = X86Assembler::rax, rcx = X86Assembler::rcx, rdx = X86Assembler::rdx,
+            rsi = X86Assembler::rsi, rdi = X86Assembler::rdi, rsp = X86Assembler::rsp, r8 = X86Assembler::r8,
+            r9 = X86Assembler::r9;
+
+    // Fixed for the whole of compiled code. All of them are callee-saved, so they survive calls to the helpers.
+    constexpr Reg pcReg = X86Assembler::rbx;                // &ctx.pc
+    constexpr Reg localsReg = X86Assembler::r12;            // the frame's locals
+    constexpr Reg stackReg = X86Assembler::r13;             // &ctx.stack
+    constexpr Reg numInstructionsReg = X86Assembler::r14;   // &VM::numInstructionsSinceLastCollect
+    constexpr Reg numValuesReg = X86Assembler::r15;         // the number of existing values (see Value::register_)
+
+    constexpr Reg calleeSaved[] = {X86Assembler::rbx, X86Assembler::rbp, X86Assembler::r12, X86Assembler::r13,
+                                   X86Assembler::r14, X86Assembler::r15};
+
+    // Between loadStackView() and the next helper call: rax = pos, rsi = &data[pos], rdx = &borrowed[pos]
+    constexpr Reg posReg = rax, dataReg = rsi, borrowedReg = rdx;
+
+    static_assert(sizeof(ValueRef) == sizeof(Value), "locals are accessed as an array of Values");
+    static_assert(sizeof(ValueType) == 4, "compiled code compares types as 32-bit integers");
+    static_assert(sizeof(Value) == 16 || sizeof(Value) == 32, "unexpected size of Value");
+
+    constexpr int32_t valueSize = sizeof(Value);
+    constexpr uint8_t valueSizeShift = (valueSize == 16) ? 4 : 5;
+    constexpr int32_t typeOffset = offsetof(Value, type);
+    constexpr int32_t payloadOffset = offsetof(Value, integerValue);
+
+    // Scalars can only be created and released inline while values are not being traced
+    constexpr bool inlineValues = !HELIUM_TRACE_VALUES;
+
+    // Offsets of the private fields of InlineStack<Value>
+    struct StackLayout
+    {
+        int32_t data, borrowed, pos, size;
+    };
+
+    struct ComparisonDesc
+    {
+        Comparison compare;
+        bool negate;                    // grtrEq and lessEq are implemented as not-less-than and not-greater-than
+        Condition condition;            // on integers
+    };
+
+    bool isStackComparison(Opcode_t opcode) {
+        return opcode == Opcodes::eq || opcode == Opcodes::grtr || opcode == Opcodes::grtrEq || opcode == Opcodes::less
+                || opcode == Opcodes::lessEq || opcode == Opcodes::neq;
+    }
+
+    bool isRegisterForm(Opcode_t opcode) {
+        return opcode >= Opcodes::add_r && opcode <= Opcodes::neq_r;
+    }
+
+    bool isRegisterComparison(Opcode_t opcode) {
+        return opcode >= Opcodes::eq_r && opcode <= Opcodes::neq_r;
+    }
+
+    ComparisonDesc getComparison(Opcode_t opcode) {
+        switch (opcode) {
+            case Opcodes::eq: case Opcodes::eq_r:
+                return {RuntimeFunctions::operatorEquals, false, X86Assembler::equal};
+            case Opcodes::grtr: case Opcodes::grtr_r:
+                return {RuntimeFunctions::operatorGreaterThan, false, X86Assembler::greater};
+            case Opcodes::grtrEq: case Opcodes::grtrEq_r:
+                return {RuntimeFunctions::operatorLessThan, true, X86Assembler::greaterOrEqual};
+            case Opcodes::less: case Opcodes::less_r:
+                return {RuntimeFunctions::operatorLessThan, false, X86Assembler::less};
+            case Opcodes::lessEq: case Opcodes::lessEq_r:
+                return {RuntimeFunctions::operatorGreaterThan, true, X86Assembler::lessOrEqual};
+            default:
+                helium_assert(opcode == Opcodes::neq || opcode == Opcodes::neq_r);
+                return {RuntimeFunctions::operatorEquals, true, X86Assembler::notEqual};
+        }
+    }
+
+    BinaryOperator getOperator(Opcode_t opcode) {
+        switch (opcode) {
+            case Opcodes::op_add: case Opcodes::add_r: return RuntimeFunctions::operatorAdd;
+            case Opcodes::op_div: case Opcodes::div_r: return RuntimeFunctions::operatorDiv;
+            case Opcodes::op_mod: case Opcodes::mod_r: return RuntimeFunctions::operatorMod;
+            case Opcodes::op_mul: case Opcodes::mul_r: return RuntimeFunctions::operatorMul;
+            case Opcodes::land: return RuntimeFunctions::operatorLogAnd;
+            case Opcodes::lor: return RuntimeFunctions::operatorLogOr;
+            default:
+                helium_assert(opcode == Opcodes::op_sub || opcode == Opcodes::sub_r);
+                return RuntimeFunctions::operatorSub;
+        }
+    }
+
+    Mem offset(Mem mem, int32_t displacement) {
+        mem.displacement += displacement;
+        return mem;
+    }
+
+    // Translates a single script function
+    class FunctionCompiler
+    {
+        public:
+            FunctionCompiler(VMModule const& module, ScriptFunction const& function, StackLayout const& stackLayout,
+                             VM* vm, Value const* global)
+                    : module(module), start(function.start), length(function.length), stackLayout(stackLayout),
+                      vm(vm), global(global) {
+                minNumLocals = function.numExplicitArguments + 1;
+                exceptionHandlers = function.exceptionHandlers;
+            }
+
+            // Returns false if there is nothing worth compiling
+            bool compile(JitFunction& compiled);
+
+        private:
+            Instruction const& instruction(size_t index) const { return module.instructions[start + index]; }
+
+            std::optional<size_t> getIndex(CodeAddr_t address) const {
+                if (address >= start && address - start < length)
+                    return address - start;
+                else
+                    return {};
+            }
+
+            bool isSupported(Instruction const& instruction) const;
+            void analyze();
+            int32_t getBlockLength(size_t index) const;
+            bool canFuseWithBranch(size_t index) const;
+
+            void compileInstruction(size_t index);
+
+            // Emitters
+            Mem local(size_t index, int32_t field = 0) const {
+                return Mem{localsReg, static_cast<int32_t>(index) * valueSize + field};
+            }
+
+            // Slot `k` below the top (0 being the top); -1 is the slot a push goes into
+            Mem slot(int k, int32_t field = 0) const { return Mem{dataReg, -(k + 1) * valueSize + field}; }
+            Mem flag(int k) const { return Mem{borrowedReg, -1 - k}; }
+            Mem stackPos() const { return Mem{stackReg, stackLayout.pos}; }
+
+            template <typename Function>
+            void callHelper(Function* function, size_t index);
+
+            void copyValue(Mem dst, Mem src);
+            void exitIfFailed(size_t index);
+            Label exitTo(CodeAddr_t address);
+            void jumpTo(size_t index, size_t target, std::optional<Condition> condition);
+            void loadStackView();
+            void reserveSlot(size_t index);
+            void pushCopy(Mem source);
+            void adjustNumValues(int numPopped, int numPushed);
+            void storeConstant(Mem dst, uint64_t value);
+            void defer(std::function<void()> code) { deferred.push_back(std::move(code)); }
+
+            void compileArithmetic(size_t index);
+            void compileComparison(size_t index);
+            void compileConditionalJump(size_t index);
+            void compileDrop(size_t index);
+            void compilePushConstant(size_t index);
+            void compileRegisterForm(size_t index);
+            void compileSetLocal(size_t index);
+
+            void callBinaryOperator(size_t index);
+            void callComparison(size_t index);
+            void callCondition(size_t index);
+            void callRegisterForm(size_t index);
+
+            VMModule const& module;
+            CodeAddr_t start;
+            size_t length;
+            std::vector<Eh> exceptionHandlers;
+            StackLayout stackLayout;
+            VM* vm;
+            Value const* global;
+
+            size_t minNumLocals, numLocals = 0;
+            std::vector<bool> supported, isLeader;
+            size_t numSupported = 0;
+
+            X86Assembler a;
+            std::vector<Label> labels;
+            std::vector<std::optional<Label>> exits;
+            Label epilogue = 0;
+
+            // Out-of-line code (slow paths and exits), emitted after the body of the function
+            std::vector<std::function<void()>> deferred;
+    };
+
+    bool FunctionCompiler::isSupported(Instruction const& instruction) const {
+        switch (instruction.opcode) {
+            case Opcodes::jmp:
+            case Opcodes::jmp_true:
+            case Opcodes::jmp_false:
+                return getIndex(instruction.codeAddr).has_value();
+
+            case Opcodes::pushc_b:
+                return instruction.integer == 0 || instruction.integer == 1;
+
+            case Opcodes::getLocal:
+            case Opcodes::setLocal:
+            case Opcodes::clearLocal:
+                return instruction.integer >= 0 && static_cast<size_t>(instruction.integer) <= LOCALS_MAX;
+
+            case Opcodes::nop:
+            case Opcodes::op_add: case Opcodes::op_div: case Opcodes::op_mod: case Opcodes::op_mul:
+            case Opcodes::neg: case Opcodes::op_sub:
+            case Opcodes::eq: case Opcodes::grtr: case Opcodes::grtrEq: case Opcodes::less: case Opcodes::lessEq:
+            case Opcodes::neq:
+            case Opcodes::land: case Opcodes::lnot: case Opcodes::lor:
+            case Opcodes::pushnil: case Opcodes::pushc_f: case Opcodes::pushc_i: case Opcodes::pushc_s:
+            case Opcodes::pushglobal:
+            case Opcodes::drop: case Opcodes::dup: case Opcodes::dup1:
+            case Opcodes::getIndexed: case Opcodes::setIndexed:
+            case Opcodes::getProperty: case Opcodes::setMember:
+            case Opcodes::assert:
+            case Opcodes::add_r: case Opcodes::div_r: case Opcodes::mod_r: case Opcodes::mul_r: case Opcodes::sub_r:
+            case Opcodes::eq_r: case Opcodes::grtr_r: case Opcodes::grtrEq_r: case Opcodes::less_r:
+            case Opcodes::lessEq_r: case Opcodes::neq_r:
+                return true;
+
+            // Calls, returns, throws, switches and allocations are left to the interpreter
+            default:
+                return false;
+        }
+    }
+
+    void FunctionCompiler::analyze() {
+        supported.resize(length);
+        isLeader.resize(length + 1);
+        numLocals = minNumLocals;
+
+        auto useLocal = [this](size_t index) {
+            numLocals = std::max(numLocals, index + 1);
+        };
+
+        isLeader[0] = true;
+
+        for (size_t i = 0; i < length; i++) {
+            auto const& ins = instruction(i);
+
+            supported[i] = isSupported(ins);
+
+            if (!supported[i]) {
+                // The interpreter comes back at the next instruction
+                isLeader[i + 1] = true;
+
+                if (ins.opcode == Opcodes::op_switch) {
+                    for (auto handler : module.switchTables[ins.switchTableIndex]->handlers) {
+                        if (auto target = getIndex(handler))
+                            isLeader[*target] = true;
+                    }
+                }
+
+                continue;
+            }
+
+            numSupported++;
+
+            switch (ins.opcode) {
+                case Opcodes::jmp:
+                case Opcodes::jmp_true:
+                case Opcodes::jmp_false:
+                    isLeader[*getIndex(ins.codeAddr)] = true;
+                    isLeader[i + 1] = true;
+                    break;
+
+                case Opcodes::getLocal:
+                case Opcodes::setLocal:
+                case Opcodes::clearLocal:
+                    useLocal(static_cast<size_t>(ins.integer));
+                    break;
+
+                default:
+                    if (isRegisterForm(ins.opcode)) {
+                        auto operands = RegisterOperands::unpack(ins.integer);
+
+                        useLocal(operands.left);
+
+                        if (!operands.rightIsConstant)
+                            useLocal(static_cast<size_t>(operands.right));
+
+                        if (operands.destination != RegisterOperands::toStack)
+                            useLocal(operands.destination);
+                    }
+            }
+        }
+
+        for (auto const& eh : exceptionHandlers) {
+            if (auto target = getIndex(eh.handler))
+                isLeader[*target] = true;
+        }
+    }
+
+    int32_t FunctionCompiler::getBlockLength(size_t index) const {
+        int32_t blockLength = 1;
+
+        for (size_t i = index + 1; i < length && supported[i] && !isLeader[i]; i++)
+            blockLength++;
+
+        return blockLength;
+    }
+
+    // A comparison whose result is only used by the branch right after it compiles to cmp + jcc
+    bool FunctionCompiler::canFuseWithBranch(size_t index) const {
+        if (!inlineValues || index + 1 >= length || !supported[index + 1] || isLeader[index + 1])
+            return false;
+
+        auto const& ins = instruction(index);
+        auto branch = instruction(index + 1).opcode;
+
+        if (branch != Opcodes::jmp_true && branch != Opcodes::jmp_false)
+            return false;
+
+        if (isStackComparison(ins.opcode))
+            return true;
+
+        return isRegisterComparison(ins.opcode)
+                && RegisterOperands::unpack(ins.integer).destination == RegisterOperands::toStack;
+    }
+
+    template <typename Function>
+    void FunctionCompiler::callHelper(Function* function, size_t index) {
+        // The interpreter would be past the instruction by now; stack traces depend on this
+        a.mov32(Mem{pcReg}, start + index + 1);
+        a.movImm(rax, reinterpret_cast<uintptr_t>(function));
+        a.call(rax);
+    }
+
+    void FunctionCompiler::copyValue(Mem dst, Mem src) {
+        for (int32_t i = 0; i < valueSize; i += 16) {
+            a.movups(0, offset(src, i));
+            a.movups(offset(dst, i), 0);
+        }
+    }
+
+    void FunctionCompiler::exitIfFailed(size_t index) {
+        a.movzx8(rax, rax);
+        a.test32(rax, rax);
+        a.jcc(X86Assembler::equal, exitTo(start + index + 1));
+    }
+
+    X86Assembler::Label FunctionCompiler::exitTo(CodeAddr_t address) {
+        auto& exit = exits[address - start];
+
+        if (!exit) {
+            exit = a.newLabel();
+
+            defer([this, address, label = *exit] {
+                a.bind(label);
+                a.movImm(rax, address);
+                a.jmp(epilogue);
+            });
+        }
+
+        return *exit;
+    }
+
+    void FunctionCompiler::jumpTo(size_t index, size_t target, std::optional<Condition> condition) {
+        Label destination = labels[target];
+
+        if (target <= index) {
+            destination = a.newLabel();
+
+            defer([this, index, target, destination] {
+                a.bind(destination);
+                a.movImm(rdi, reinterpret_cast<uintptr_t>(vm));
+                callHelper(safepoint, index);
+                a.jmp(labels[target]);
+            });
+        }
+
+        if (condition)
+            a.jcc(*condition, destination);
+        else
+            a.jmp(destination);
+    }
+
+    void FunctionCompiler::loadStackView() {
+        a.mov(posReg, stackPos());
+        a.mov(dataReg, posReg);
+        a.shl(dataReg, valueSizeShift);
+        a.add(dataReg, Mem{stackReg, stackLayout.data});
+        a.mov(borrowedReg, posReg);
+        a.add(borrowedReg, Mem{stackReg, stackLayout.borrowed});
+    }
+
+    // Makes room for one more slot and loads the stack view
+    void FunctionCompiler::reserveSlot(size_t index) {
+        auto retry = a.newLabel(), grow = a.newLabel();
+
+        a.bind(retry);
+        loadStackView();
+        a.cmp(posReg, Mem{stackReg, stackLayout.size});
+        a.jcc(X86Assembler::aboveOrEqual, grow);
+
+        defer([this, retry, grow, index] {
+            a.bind(grow);
+            a.mov(rdi, stackReg);
+            callHelper(growStack, index);
+            a.jmp(retry);
+        });
+    }
+
+    // Pushes a borrowed copy, like InlineStack::pushBorrowed
+    void FunctionCompiler::pushCopy(Mem source) {
+        copyValue(slot(-1), source);
+        a.mov8(flag(-1), 1);
+        a.add(stackPos(), 1);
+    }
+
+    // Keeps the count of existing values in step with the interpreter, for the scalars popped and pushed inline.
+    // Owned slots are released when popped; borrowed ones never held a reference.
+    void FunctionCompiler::adjustNumValues(int numPopped, int numPushed) {
+        if (numPushed != numPopped)
+            a.add(Mem{numValuesReg}, numPushed - numPopped);
+
+        for (int k = 0; k < numPopped; k++) {
+            a.movzx8(rcx, flag(k));
+            a.add(Mem{numValuesReg}, rcx);
+        }
+    }
+
+    void FunctionCompiler::storeConstant(Mem dst, uint64_t value) {
+        auto asSigned = static_cast<int64_t>(value);
+
+        if (asSigned >= INT32_MIN && asSigned <= INT32_MAX)
+            a.mov(dst, static_cast<int32_t>(asSigned));
+        else {
+            a.movImm(rcx, value);
+            a.mov(dst, rcx);
+        }
+    }
+
+    bool FunctionCompiler::compile(JitFunction& compiled) {
+        analyze();
+
+        if (numSupported == 0)
+            return false;
+
+        // System V: (entry, pc, locals, stack, numInstructions, numValues) in rdi, rsi, rdx, rcx, r8, r9
+        for (auto reg : calleeSaved)
+            a.push(reg);
+
+        a.sub(rsp, 8);                  // keep the stack aligned for calls
+        a.mov(pcReg, rsi);
+        a.mov(localsReg, rdx);
+        a.mov(stackReg, rcx);
+        a.mov(numInstructionsReg, r8);
+        a.mov(numValuesReg, r9);
+        a.jmp(rdi);
+
+        epilogue = a.newLabel();
+
+        for (size_t i = 0; i <= length; i++)
+            labels.push_back(a.newLabel());
+
+        exits.resize(length + 1);
+
+        for (size_t i = 0; i < length; i++) {
+            a.bind(labels[i]);
+
+            if (!supported[i]) {
+                a.movImm(rax, start + i);
+                a.jmp(epilogue);
+                continue;
+            }
+
+            if (isLeader[i])
+                a.add(Mem{numInstructionsReg}, getBlockLength(i));
+
+            compileInstruction(i);
+        }
+
+        a.bind(labels[length]);
+        a.movImm(rax, start + length);
+        a.jmp(epilogue);
+
+        // Deferred code can defer more code
+        for (size_t i = 0; i < deferred.size(); i++) {
+            auto code = std::move(deferred[i]);
+            code();
+        }
+
+        a.bind(epilogue);
+        a.add(rsp, 8);
+
+        for (size_t i = std::size(calleeSaved); i > 0; i--)
+            a.pop(calleeSaved[i - 1]);
+
+        a.ret();
+        a.finish();
+
+        compiled.start = start;
+        compiled.numLocals = numLocals;
+        compiled.entries.assign(length, 0);
+
+        for (size_t i = 0; i < length; i++) {
+            if (supported[i])
+                compiled.entries[i] = static_cast<uint32_t>(a.getOffset(labels[i]));
+        }
+
+        auto const& code = a.getCode();
+        auto memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (memory == MAP_FAILED)
+            return false;
+
+        memcpy(memory, code.data(), code.size());
+
+        compiled.memory = static_cast<uint8_t*>(memory);
+        compiled.memorySize = code.size();
+
+        return mprotect(memory, code.size(), PROT_READ | PROT_EXEC) == 0;
+    }
+
+    void FunctionCompiler::compileInstruction(size_t index) {
+        auto const& ins = instruction(index);
+
+        switch (ins.opcode) {
+            case Opcodes::nop:
+                break;
+
+            case Opcodes::jmp:
+                jumpTo(index, *getIndex(ins.codeAddr), {});
+                break;
+
+            case Opcodes::jmp_true:
+            case Opcodes::jmp_false:
+                compileConditionalJump(index);
+                break;
+
+            case Opcodes::getLocal:
+                reserveSlot(index);
+                pushCopy(local(ins.integer));
+                break;
+
+            case Opcodes::setLocal:
+                compileSetLocal(index);
+                break;
+
+            case Opcodes::clearLocal:
+                a.mov(rdi, localsReg);
+                a.mov(rsi, stackReg);
+                a.movImm(rdx, static_cast<size_t>(ins.integer));
+                callHelper(clearLocal, index);
+                break;
+
+            case Opcodes::dup:
+                reserveSlot(index);
+                pushCopy(slot(0));
+                break;
+
+            case Opcodes::dup1:
+                reserveSlot(index);
+                pushCopy(slot(1));
+                break;
+
+            case Opcodes::pushglobal:
+                reserveSlot(index);
+                a.movImm(rcx, reinterpret_cast<uintptr_t>(global));
+                pushCopy(Mem{rcx});
+                break;
+
+            case Opcodes::drop:
+                compileDrop(index);
+                break;
+
+            case Opcodes::pushnil:
+            case Opcodes::pushc_b:
+            case Opcodes::pushc_f:
+            case Opcodes::pushc_i:
+                compilePushConstant(index);
+                break;
+
+            case Opcodes::pushc_s:
+                a.mov(rdi, stackReg);
+                a.movImm(rsi, reinterpret_cast<uintptr_t>(&module.strings[ins.stringIndex]));
+                callHelper(pushString, index);
+                break;
+
+            case Opcodes::op_add:
+            case Opcodes::op_mul:
+            case Opcodes::op_sub:
+                compileArithmetic(index);
+                break;
+
+            case Opcodes::op_div:
+            case Opcodes::op_mod:
+                callBinaryOperator(index);
+                break;
+
+            case Opcodes::land:
+            case Opcodes::lor:
+                a.mov(rdi, stackReg);
+                a.movImm(rsi, reinterpret_cast<uintptr_t>(getOperator(ins.opcode)));
+                callHelper(logicalOperator, index);
+                exitIfFailed(index);
+                break;
+
+            case Opcodes::lnot:
+            case Opcodes::neg:
+            {
+                UnaryOperator apply = (ins.opcode == Opcodes::lnot) ? RuntimeFunctions::operatorLogNot
+                                                                      : RuntimeFunctions::operatorNeg;
+
+                a.mov(rdi, stackReg);
+                a.movImm(rsi, reinterpret_cast<uintptr_t>(apply));
+                callHelper(unaryOperator, index);
+                exitIfFailed(index);
+                break;
+            }
+
+            case Opcodes::getIndexed:
+                a.mov(rdi, stackReg);
+                callHelper(getIndexed, index);
+                exitIfFailed(index);
+                break;
+
+            case Opcodes::setIndexed:
+                a.mov(rdi, stackReg);
+                callHelper(setIndexed, index);
+                exitIfFailed(index);
+                break;
+
+            case Opcodes::getProperty:
+            case Opcodes::setMember:
+            case Opcodes::assert:
+                a.mov(rdi, stackReg);
+                a.movImm(rsi, reinterpret_cast<uintptr_t>(&module.strings[ins.stringIndex]));
+
+                if (ins.opcode == Opcodes::getProperty)
+                    callHelper(getProperty, index);
+                else if (ins.opcode == Opcodes::setMember)
+                    callHelper(setMember, index);
+                else
+                    callHelper(checkAssertion, index);
+
+                exitIfFailed(index);
+                break;
+
+            default:
+                if (isStackComparison(ins.opcode))
+                    compileComparison(index);
+                else {
+                    helium_assert(isRegisterForm(ins.opcode));
+                    compileRegisterForm(index);
+                }
+        }
+    }
+
+    void FunctionCompiler::compilePushConstant(size_t index) {
+        auto const& ins = instruction(index);
+
+        if (!inlineValues) {
+            a.mov(rdi, stackReg);
+            a.movImm(rsi, reinterpret_cast<uintptr_t>(&ins));
+            callHelper(pushConstant, index);
+            return;
+        }
+
+        ValueType type;
+        uint64_t payload = 0;
+
+        switch (ins.opcode) {
+            case Opcodes::pushc_b: type = ValueType::boolean; payload = static_cast<uint64_t>(ins.integer); break;
+            case Opcodes::pushc_f: type = ValueType::real; memcpy(&payload, &ins.realValue, sizeof(payload)); break;
+            case Opcodes::pushc_i: type = ValueType::integer; payload = static_cast<uint64_t>(ins.integer); break;
+            default: type = ValueType::nil; break;
+        }
+
+        reserveSlot(index);
+        a.mov32(slot(-1, typeOffset), static_cast<uint32_t>(type));
+        storeConstant(slot(-1, payloadOffset), payload);
+        a.mov8(flag(-1), 0);
+        a.add(stackPos(), 1);
+        a.add(Mem{numValuesReg}, 1);
+    }
+
+    void FunctionCompiler::compileSetLocal(size_t index) {
+        auto localIndex = static_cast<size_t>(instruction(index).integer);
+
+        auto callSetLocal = [this, index, localIndex] {
+            a.mov(rdi, localsReg);
+            a.mov(rsi, stackReg);
+            a.movImm(rdx, localIndex);
+            callHelper(setLocal, index);
+        };
+
+        if (!inlineValues) {
+            callSetLocal();
+            return;
+        }
+
+        auto slow = a.newLabel(), owned = a.newLabel(), wasInvalid = a.newLabel();
+
+        // The old value must be a scalar (or nothing) to be released inline
+        loadStackView();
+        a.mov32(rcx, local(localIndex, typeOffset));
+        a.cmp32(rcx, static_cast<int32_t>(ValueType::list));
+        a.jcc(X86Assembler::aboveOrEqual, slow);
+
+        // An owned slot is simply moved; a borrowed one is referenced, which only copies a scalar
+        a.cmp8(flag(0), 0);
+        a.jcc(X86Assembler::equal, owned);
+        a.mov32(rdi, slot(0, typeOffset));
+        a.cmp32(rdi, static_cast<int32_t>(ValueType::list));
+        a.jcc(X86Assembler::aboveOrEqual, slow);
+        a.test32(rdi, rdi);
+        a.jcc(X86Assembler::equal, slow);
+        a.add(Mem{numValuesReg}, 1);
+
+        a.bind(owned);
+        a.test32(rcx, rcx);
+        a.jcc(X86Assembler::equal, wasInvalid);
+        a.sub(Mem{numValuesReg}, 1);
+        a.bind(wasInvalid);
+
+        copyValue(local(localIndex), slot(0));
+        a.sub(stackPos(), 1);
+
+        defer([this, index, slow, callSetLocal] {
+            a.bind(slow);
+            callSetLocal();
+            a.jmp(labels[index + 1]);
+        });
+    }
+
+    void FunctionCompiler::compileDrop(size_t index) {
+        if (!inlineValues) {
+            a.mov(rdi, stackReg);
+            callHelper(drop, index);
+            return;
+        }
+
+        auto borrowed = a.newLabel(), slow = a.newLabel();
+
+        loadStackView();
+        a.cmp8(flag(0), 0);
+        a.jcc(X86Assembler::notEqual, borrowed);
+        a.mov32(rcx, slot(0, typeOffset));
+        a.test32(rcx, rcx);
+        a.jcc(X86Assembler::equal, slow);
+        a.cmp32(rcx, static_cast<int32_t>(ValueType::list));
+        a.jcc(X86Assembler::aboveOrEqual, slow);
+        a.sub(Mem{numValuesReg}, 1);
+        a.bind(borrowed);
+        a.sub(stackPos(), 1);
+
+        defer([this, index, slow] {
+            a.bind(slow);
+            a.mov(rdi, stackReg);
+            callHelper(drop, index);
+            a.jmp(labels[index + 1]);
+        });
+    }
+
+    void FunctionCompiler::callCondition(size_t index) {
+        auto const& ins = instruction(index);
+
+        a.mov(rdi, stackReg);
+        callHelper(condition, index);
+        a.test32(rax, rax);
+        a.jcc(X86Assembler::sign, exitTo(start + index + 1));
+        jumpTo(index, *getIndex(ins.codeAddr),
+               ins.opcode == Opcodes::jmp_true ? X86Assembler::notEqual : X86Assembler::equal);
+    }
+
+    void FunctionCompiler::compileConditionalJump(size_t index) {
+        auto const& ins = instruction(index);
+
+        if (!inlineValues) {
+            callCondition(index);
+            return;
+        }
+
+        auto slow = a.newLabel();
+
+        loadStackView();
+        a.cmp32(slot(0, typeOffset), static_cast<int32_t>(ValueType::boolean));
+        a.jcc(X86Assembler::notEqual, slow);
+        adjustNumValues(1, 0);
+        a.sub(stackPos(), 1);
+        a.cmp8(slot(0, payloadOffset), 0);
+        jumpTo(index, *getIndex(ins.codeAddr),
+               ins.opcode == Opcodes::jmp_true ? X86Assembler::notEqual : X86Assembler::equal);
+
+        defer([this, index, slow] {
+            a.bind(slow);
+            callCondition(index);
+            a.jmp(labels[index + 1]);
+        });
+    }
+
+    void FunctionCompiler::callBinaryOperator(size_t index) {
+        a.mov(rdi, stackReg);
+        a.movImm(rsi, reinterpret_cast<uintptr_t>(getOperator(instruction(index).opcode)));
+        callHelper(binaryOperator, index);
+        exitIfFailed(index);
+    }
+
+    void FunctionCompiler::compileArithmetic(size_t index) {
+        if (!inlineValues) {
+            callBinaryOperator(index);
+            return;
+        }
+
+        auto opcode = instruction(index).opcode;
+        auto slow = a.newLabel();
+
+        // Both operands must be integers; the result replaces the left one
+        loadStackView();
+        a.cmp32(slot(0, typeOffset), static_cast<int32_t>(ValueType::integer));
+        a.jcc(X86Assembler::notEqual, slow);
+        a.cmp32(slot(1, typeOffset), static_cast<int32_t>(ValueType::integer));
+        a.jcc(X86Assembler::notEqual, slow);
+        adjustNumValues(2, 1);
+
+        a.mov(rcx, slot(1, payloadOffset));
+
+        if (opcode == Opcodes::op_add)
+            a.add(rcx, slot(0, payloadOffset));
+        else if (opcode == Opcodes::op_sub)
+            a.sub(rcx, slot(0, payloadOffset));
+        else
+            a.imul(rcx, slot(0, payloadOffset));
+
+        a.mov(slot(1, payloadOffset), rcx);
+        a.mov8(flag(1), 0);
+        a.sub(stackPos(), 1);
+
+        defer([this, index, slow] {
+            a.bind(slow);
+            callBinaryOperator(index);
+            a.jmp(labels[index + 1]);
+        });
+    }
+
+    void FunctionCompiler::callComparison(size_t index) {
+        auto desc = getComparison(instruction(index).opcode);
+
+        a.mov(rdi, stackReg);
+        a.movImm(rsi, reinterpret_cast<uintptr_t>(desc.compare));
+        a.movImm(rdx, desc.negate ? 1 : 0);
+        callHelper(comparison, index);
+        exitIfFailed(index);
+    }
+
+    void FunctionCompiler::compileComparison(size_t index) {
+        if (!inlineValues) {
+            callComparison(index);
+            return;
+        }
+
+        auto desc = getComparison(instruction(index).opcode);
+        bool fused = canFuseWithBranch(index);
+        auto slow = a.newLabel();
+
+        loadStackView();
+        a.cmp32(slot(0, typeOffset), static_cast<int32_t>(ValueType::integer));
+        a.jcc(X86Assembler::notEqual, slow);
+        a.cmp32(slot(1, typeOffset), static_cast<int32_t>(ValueType::integer));
+        a.jcc(X86Assembler::notEqual, slow);
+
+        if (fused) {
+            auto const& branch = instruction(index + 1);
+
+            adjustNumValues(2, 0);
+            a.sub(stackPos(), 2);
+            a.mov(rcx, slot(1, payloadOffset));
+            a.cmp(rcx, slot(0, payloadOffset));
+            jumpTo(index + 1, *getIndex(branch.codeAddr), branch.opcode == Opcodes::jmp_true
+                    ? desc.condition : X86Assembler::negate(desc.condition));
+            a.jmp(labels[index + 2]);
+        }
+        else {
+            adjustNumValues(2, 1);
+            a.mov(rcx, slot(1, payloadOffset));
+            a.cmp(rcx, slot(0, payloadOffset));
+            a.setcc(desc.condition, rcx);
+            a.movzx8(rcx, rcx);
+            a.mov32(slot(1, typeOffset), static_cast<uint32_t>(ValueType::boolean));
+            a.mov(slot(1, payloadOffset), rcx);
+            a.mov8(flag(1), 0);
+            a.sub(stackPos(), 1);
+        }
+
+        defer([this, index, slow] {
+            a.bind(slow);
+            callComparison(index);
+            a.jmp(labels[index + 1]);
+        });
+    }
+
+    void FunctionCompiler::callRegisterForm(size_t index) {
+        auto const& ins = instruction(index);
+
+        a.mov(rdi, localsReg);
+        a.mov(rsi, stackReg);
+        a.movImm(rdx, static_cast<uint64_t>(ins.integer));
+
+        if (isRegisterComparison(ins.opcode)) {
+            auto desc = getComparison(ins.opcode);
+
+            a.movImm(rcx, reinterpret_cast<uintptr_t>(desc.compare));
+            a.movImm(r8, desc.negate ? 1 : 0);
+            callHelper(registerComparison, index);
+        }
+        else {
+            a.movImm(rcx, reinterpret_cast<uintptr_t>(getOperator(ins.opcode)));
+            callHelper(registerOperator, index);
+        }
+
+        exitIfFailed(index);
+    }
+
+    void FunctionCompiler::compileRegisterForm(size_t index) {
+        auto const& ins = instruction(index);
+        auto operands = RegisterOperands::unpack(ins.integer);
+        bool isComparison = isRegisterComparison(ins.opcode);
+
+        if (!inlineValues || ins.opcode == Opcodes::div_r || ins.opcode == Opcodes::mod_r) {
+            callRegisterForm(index);
+            return;
+        }
+
+        bool fused = canFuseWithBranch(index);
+        auto slow = a.newLabel();
+
+        a.cmp32(local(operands.left, typeOffset), static_cast<int32_t>(ValueType::integer));
+        a.jcc(X86Assembler::notEqual, slow);
+
+        if (!operands.rightIsConstant) {
+            a.cmp32(local(operands.right, typeOffset), static_cast<int32_t>(ValueType::integer));
+            a.jcc(X86Assembler::notEqual, slow);
+        }
+
+        auto applyRight = [&](auto withConstant, auto withLocal) {
+            if (operands.rightIsConstant)
+                withConstant(operands.right);
+            else
+                withLocal(local(operands.right, payloadOffset));
+        };
+
+        if (fused) {
+            auto const& branch = instruction(index + 1);
+            auto condition = getComparison(ins.opcode).condition;
+
+            a.mov(rcx, local(operands.left, payloadOffset));
+            applyRight([&](int32_t value) { a.cmp(rcx, value); }, [&](Mem mem) { a.cmp(rcx, mem); });
+            jumpTo(index + 1, *getIndex(branch.codeAddr), branch.opcode == Opcodes::jmp_true
+                    ? condition : X86Assembler::negate(condition));
+            a.jmp(labels[index + 2]);
+        }
+        else {
+            bool toStack = (operands.destination == RegisterOperands::toStack);
+
+            if (toStack)
+                reserveSlot(index);
+            else {
+                // The old value of the destination must be a scalar (or nothing) to be released inline
+                a.mov32(r8, local(operands.destination, typeOffset));
+                a.cmp32(r8, static_cast<int32_t>(ValueType::list));
+                a.jcc(X86Assembler::aboveOrEqual, slow);
+            }
+
+            a.mov(rcx, local(operands.left, payloadOffset));
+
+            if (isComparison) {
+                applyRight([&](int32_t value) { a.cmp(rcx, value); }, [&](Mem mem) { a.cmp(rcx, mem); });
+                a.setcc(getComparison(ins.opcode).condition, rcx);
+                a.movzx8(rcx, rcx);
+            }
+            else if (ins.opcode == Opcodes::add_r)
+                applyRight([&](int32_t value) { a.add(rcx, value); }, [&](Mem mem) { a.add(rcx, mem); });
+            else if (ins.opcode == Opcodes::sub_r)
+                applyRight([&](int32_t value) { a.sub(rcx, value); }, [&](Mem mem) { a.sub(rcx, mem); });
+            else {
+                applyRight([&](int32_t value) {
+                    a.movImm(rdi, static_cast<uint64_t>(static_cast<int64_t>(value)));
+                    a.imul(rcx, rdi);
+                }, [&](Mem mem) { a.imul(rcx, mem); });
+            }
+
+            auto type = static_cast<uint32_t>(isComparison ? ValueType::boolean : ValueType::integer);
+
+            if (toStack) {
+                a.mov32(slot(-1, typeOffset), type);
+                a.mov(slot(-1, payloadOffset), rcx);
+                a.mov8(flag(-1), 0);
+                a.add(stackPos(), 1);
+                a.add(Mem{numValuesReg}, 1);
+            }
+            else {
+                // Replacing a scalar keeps the count the same
+                auto wasValid = a.newLabel();
+
+                a.test32(r8, r8);
+                a.jcc(X86Assembler::notEqual, wasValid);
+                a.add(Mem{numValuesReg}, 1);
+                a.bind(wasValid);
+
+                a.mov32(local(operands.destination, typeOffset), type);
+                a.mov(local(operands.destination, payloadOffset), rcx);
+            }
+        }
+
+        defer([this, index, slow] {
+            a.bind(slow);
+            callRegisterForm(index);
+            a.jmp(labels[index + 1]);
+        });
+    }
+}
+#endif
+
+    JitFunction::~JitFunction() {
+#if HELIUM_WITH_JIT
+        if (memory != nullptr)
+            munmap(memory, memorySize);
+#endif
+    }
+
+    JitFunction* Jit::getCode(VMModule const& module, ScriptFunction const& function, FunctionHotness& hotness) {
+        if (!hotness.compiled && !hotness.compilationFailed) {
+            hotness.compiled = compile(module, function);
+            hotness.compilationFailed = !hotness.compiled;
+        }
+
+        return hotness.compiled.get();
+    }
+
+    void Jit::run(ActivationContext& ctx) {
+#if HELIUM_WITH_JIT
+        auto& function = *ctx.frame->jitFunction;
+        size_t index = ctx.pc - function.start;
+
+        if (ctx.pc < function.start || index >= function.entries.size() || function.entries[index] == 0)
+            return;
+
+        auto& locals = ctx.frame->locals;
+
+        if (locals.size() < function.numLocals)
+            locals.resize(function.numLocals);
+
+        auto code = reinterpret_cast<JitFunction::Code>(function.memory);
+        ctx.pc = code(function.memory + function.entries[index], &ctx.pc, locals.data(), &ctx.stack,
+                      &vm->numInstructionsSinceLastCollect, Value::getNumExistingValuesCounter());
+#else
+        (void) ctx;
+#endif
+    }
+
+    std::unique_ptr<JitFunction> Jit::compile(VMModule const& module, ScriptFunction const& function) {
+#if HELIUM_WITH_JIT
+        StackLayout stackLayout {
+            static_cast<int32_t>(offsetof(InlineStack<Value>, data)),
+            static_cast<int32_t>(offsetof(InlineStack<Value>, borrowed)),
+            static_cast<int32_t>(offsetof(InlineStack<Value>, pos)),
+            static_cast<int32_t>(offsetof(InlineStack<Value>, size)),
+        };
+
+        auto compiled = std::make_unique<JitFunction>();
+        FunctionCompiler compiler(module, function, stackLayout, vm, reinterpret_cast<Value const*>(&vm->global));
+
+        if (!compiler.compile(*compiled))
+            return nullptr;
+
+        numCompiledFunctions++;
+        return compiled;
+#else
+        (void) module;
+        (void) function;
+        return nullptr;
+#endif
+    }
+}
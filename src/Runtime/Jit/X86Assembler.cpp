@@ -0,0 +1,247 @@
+#include "X86Assembler.hpp"
+
+#include <Helium/Assert.hpp>
+
+#include <cstring>
+#include <limits>
+
+namespace Helium
+{
+    static bool fitsInt8(int64_t value) {
+        return value >= std::numeric_limits<int8_t>::min() && value <= std::numeric_limits<int8_t>::max();
+    }
+
+    X86Assembler::Label X86Assembler::newLabel() {
+        labels.push_back(-1);
+        return labels.size() - 1;
+    }
+
+    void X86Assembler::bind(Label label) {
+        helium_assert(!isBound(label));
+        labels[label] = static_cast<int64_t>(code.size());
+    }
+
+    void X86Assembler::finish() {
+        for (auto const& fixup : fixups) {
+            helium_assert(isBound(fixup.target));
+
+            auto displacement = static_cast<int32_t>(labels[fixup.target] - static_cast<int64_t>(fixup.position + 4));
+            memcpy(&code[fixup.position], &displacement, sizeof(displacement));
+        }
+
+        fixups.clear();
+    }
+
+    void X86Assembler::emit32(uint32_t value) {
+        for (int i = 0; i < 4; i++)
+            emit8(static_cast<uint8_t>(value >> (i * 8)));
+    }
+
+    void X86Assembler::emit64(uint64_t value) {
+        emit32(static_cast<uint32_t>(value));
+        emit32(static_cast<uint32_t>(value >> 32));
+    }
+
+    void X86Assembler::rex(bool wide, uint8_t reg, uint8_t index, uint8_t base, bool always) {
+        uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+
+        if (prefix != 0x40 || always)
+            emit8(prefix);
+    }
+
+    void X86Assembler::modrm(uint8_t reg, Mem const& mem) {
+        uint8_t base = mem.base & 7;
+        bool needsSib = mem.index != noReg || base == rsp;
+
+        // [rbp] and [r13] can only be encoded with a displacement
+        uint8_t mod = (mem.displacement == 0 && base != rbp) ? 0 : fitsInt8(mem.displacement) ? 1 : 2;
+
+        emit8((mod << 6) | ((reg & 7) << 3) | (needsSib ? 4 : base));
+
+        if (needsSib)
+            emit8((((mem.index != noReg) ? (mem.index & 7) : 4) << 3) | base);
+
+        if (mod == 1)
+            emit8(static_cast<uint8_t>(mem.displacement));
+        else if (mod == 2)
+            emit32(static_cast<uint32_t>(mem.displacement));
+    }
+
+    void X86Assembler::modrm(uint8_t reg, Reg rm) {
+        emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void X86Assembler::op(bool wide, bool escape, uint8_t opcode, uint8_t reg, Mem const& mem) {
+        helium_assert(mem.index != rsp);
+
+        rex(wide, reg, mem.index != noReg ? mem.index : 0, mem.base);
+
+        if (escape)
+            emit8(0x0F);
+
+        emit8(opcode);
+        modrm(reg, mem);
+    }
+
+    void X86Assembler::op(bool wide, bool escape, uint8_t opcode, uint8_t reg, Reg rm) {
+        rex(wide, reg, 0, rm);
+
+        if (escape)
+            emit8(0x0F);
+
+        emit8(opcode);
+        modrm(reg, rm);
+    }
+
+    void X86Assembler::arith(bool wide, uint8_t ext, Mem const& mem, int32_t imm) {
+        if (fitsInt8(imm)) {
+            op(wide, false, 0x83, ext, mem);
+            emit8(static_cast<uint8_t>(imm));
+        }
+        else {
+            op(wide, false, 0x81, ext, mem);
+            emit32(static_cast<uint32_t>(imm));
+        }
+    }
+
+    void X86Assembler::arith(bool wide, uint8_t ext, Reg reg, int32_t imm) {
+        if (fitsInt8(imm)) {
+            op(wide, false, 0x83, ext, reg);
+            emit8(static_cast<uint8_t>(imm));
+        }
+        else {
+            op(wide, false, 0x81, ext, reg);
+            emit32(static_cast<uint32_t>(imm));
+        }
+    }
+
+    void X86Assembler::push(Reg reg) {
+        rex(false, 0, 0, reg);
+        emit8(0x50 | (reg & 7));
+    }
+
+    void X86Assembler::pop(Reg reg) {
+        rex(false, 0, 0, reg);
+        emit8(0x58 | (reg & 7));
+    }
+
+    void X86Assembler::ret() {
+        emit8(0xC3);
+    }
+
+    void X86Assembler::mov(Reg dst, Reg src) { op(true, false, 0x89, src, dst); }
+    void X86Assembler::mov(Reg dst, Mem src) { op(true, false, 0x8B, dst, src); }
+    void X86Assembler::mov(Mem dst, Reg src) { op(true, false, 0x89, src, dst); }
+
+    void X86Assembler::mov(Mem dst, int32_t imm) {
+        op(true, false, 0xC7, 0, dst);
+        emit32(static_cast<uint32_t>(imm));
+    }
+
+    void X86Assembler::movImm(Reg dst, uint64_t imm) {
+        if (imm <= std::numeric_limits<uint32_t>::max()) {
+            // Writing a 32-bit register clears the upper half
+            rex(false, 0, 0, dst);
+            emit8(0xB8 | (dst & 7));
+            emit32(static_cast<uint32_t>(imm));
+        }
+        else if (static_cast<int64_t>(imm) >= std::numeric_limits<int32_t>::min()
+                && static_cast<int64_t>(imm) < 0) {
+            op(true, false, 0xC7, 0, dst);
+            emit32(static_cast<uint32_t>(imm));
+        }
+        else {
+            rex(true, 0, 0, dst);
+            emit8(0xB8 | (dst & 7));
+            emit64(imm);
+        }
+    }
+
+    void X86Assembler::mov32(Reg dst, Mem src) { op(false, false, 0x8B, dst, src); }
+
+    void X86Assembler::mov32(Mem dst, uint32_t imm) {
+        op(false, false, 0xC7, 0, dst);
+        emit32(imm);
+    }
+
+    void X86Assembler::mov8(Mem dst, uint8_t imm) {
+        op(false, false, 0xC6, 0, dst);
+        emit8(imm);
+    }
+
+    void X86Assembler::movzx8(Reg dst, Mem src) { op(false, true, 0xB6, dst, src); }
+
+    void X86Assembler::movzx8(Reg dst, Reg src) {
+        // Without a REX prefix, 4-7 would mean ah, ch, dh and bh
+        rex(false, dst, 0, src, src >= rsp);
+        emit8(0x0F);
+        emit8(0xB6);
+        modrm(dst, src);
+    }
+
+    void X86Assembler::lea(Reg dst, Mem src) { op(true, false, 0x8D, dst, src); }
+
+    void X86Assembler::add(Reg dst, Reg src) { op(true, false, 0x01, src, dst); }
+    void X86Assembler::add(Reg dst, Mem src) { op(true, false, 0x03, dst, src); }
+    void X86Assembler::add(Reg dst, int32_t imm) { arith(true, 0, dst, imm); }
+    void X86Assembler::add(Mem dst, Reg src) { op(true, false, 0x01, src, dst); }
+    void X86Assembler::add(Mem dst, int32_t imm) { arith(true, 0, dst, imm); }
+    void X86Assembler::sub(Reg dst, Mem src) { op(true, false, 0x2B, dst, src); }
+    void X86Assembler::sub(Reg dst, int32_t imm) { arith(true, 5, dst, imm); }
+    void X86Assembler::sub(Mem dst, int32_t imm) { arith(true, 5, dst, imm); }
+
+    void X86Assembler::shl(Reg dst, uint8_t count) {
+        op(true, false, 0xC1, 4, dst);
+        emit8(count);
+    }
+
+    void X86Assembler::imul(Reg dst, Mem src) { op(true, true, 0xAF, dst, src); }
+    void X86Assembler::imul(Reg dst, Reg src) { op(true, true, 0xAF, dst, src); }
+    void X86Assembler::cmp(Reg left, Reg right) { op(true, false, 0x39, right, left); }
+    void X86Assembler::cmp(Reg left, Mem right) { op(true, false, 0x3B, left, right); }
+    void X86Assembler::cmp(Reg left, int32_t imm) { arith(true, 7, left, imm); }
+    void X86Assembler::cmp32(Reg left, int32_t imm) { arith(false, 7, left, imm); }
+    void X86Assembler::cmp32(Mem left, int32_t imm) { arith(false, 7, left, imm); }
+
+    void X86Assembler::cmp8(Mem left, uint8_t imm) {
+        op(false, false, 0x80, 7, left);
+        emit8(imm);
+    }
+
+    void X86Assembler::test32(Reg left, Reg right) { op(false, false, 0x85, right, left); }
+
+    void X86Assembler::setcc(Condition condition, Reg dst) {
+        rex(false, 0, 0, dst, dst >= rsp);
+        emit8(0x0F);
+        emit8(0x90 | condition);
+        modrm(0, dst);
+    }
+
+    void X86Assembler::movups(uint8_t xmm, Mem src) { op(false, true, 0x10, xmm, src); }
+    void X86Assembler::movups(Mem dst, uint8_t xmm) { op(false, true, 0x11, xmm, dst); }
+
+    void X86Assembler::jmp(Label target) {
+        emit8(0xE9);
+        fixups.push_back(Fixup{code.size(), target});
+        emit32(0);
+    }
+
+    void X86Assembler::jmp(Reg target) {
+        rex(false, 0, 0, target);
+        emit8(0xFF);
+        modrm(4, target);
+    }
+
+    void X86Assembler::jcc(Condition condition, Label target) {
+        emit8(0x0F);
+        emit8(0x80 | condition);
+        fixups.push_back(Fixup{code.size(), target});
+        emit32(0);
+    }
+
+    void X86Assembler::call(Reg target) {
+        rex(false, 0, 0, target);
+        emit8(0xFF);
+        modrm(2, target);
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Helium
+{
+    /**
+     * Emits x86-64 machine code into a buffer. Only the instruction forms needed by the JIT are supported.
+     *
+     * Operands are in Intel order (destination first). Plain instructions operate on 64-bit registers; the width of
+     * memory operands that are not 64-bit is part of the instruction name (cmp32, mov8 and so on).
+     * Jumps to labels always use 32-bit displacements, which are patched by finish().
+     */
+    class X86Assembler
+    {
+        public:
+            enum Reg : uint8_t { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15, noReg };
+
+            // The low nibble of the Jcc/SETcc opcodes; flipping the lowest bit negates a condition
+            enum Condition : uint8_t {
+                below = 0x2, aboveOrEqual = 0x3, equal = 0x4, notEqual = 0x5, sign = 0x8, notSign = 0x9,
+                less = 0xC, greaterOrEqual = 0xD, lessOrEqual = 0xE, greater = 0xF,
+            };
+
+            // [base + index + displacement]
+            struct Mem
+            {
+                Reg base;
+                int32_t displacement = 0;
+                Reg index = noReg;
+            };
+
+            using Label = size_t;
+
+            static Condition negate(Condition condition) { return static_cast<Condition>(condition ^ 1); }
+
+            Label newLabel();
+            void bind(Label label);
+            bool isBound(Label label) const { return labels[label] >= 0; }
+            size_t getOffset(Label label) const { return static_cast<size_t>(labels[label]); }
+
+            size_t getSize() const { return code.size(); }
+            std::vector<uint8_t> const& getCode() const { return code; }
+
+            // Resolves all jumps; every label that was jumped to must be bound by then
+            void finish();
+
+            void push(Reg reg);
+            void pop(Reg reg);
+            void ret();
+
+            void mov(Reg dst, Reg src);
+            void mov(Reg dst, Mem src);
+            void mov(Mem dst, Reg src);
+            void mov(Mem dst, int32_t imm);                 // sign-extended
+            void movImm(Reg dst, uint64_t imm);
+            void mov32(Reg dst, Mem src);
+            void mov32(Mem dst, uint32_t imm);
+            void mov8(Mem dst, uint8_t imm);
+            void movzx8(Reg dst, Mem src);
+            void movzx8(Reg dst, Reg src);
+            void lea(Reg dst, Mem src);
+
+            void add(Reg dst, Reg src);
+            void add(Reg dst, Mem src);
+            void add(Reg dst, int32_t imm);
+            void add(Mem dst, Reg src);
+            void add(Mem dst, int32_t imm);
+            void sub(Reg dst, Mem src);
+            void sub(Reg dst, int32_t imm);
+            void sub(Mem dst, int32_t imm);
+            void shl(Reg dst, uint8_t count);
+            void imul(Reg dst, Mem src);
+            void imul(Reg dst, Reg src);
+            void cmp(Reg left, Reg right);
+            void cmp(Reg left, Mem right);
+            void cmp(Reg left, int32_t imm);
+            void cmp32(Reg left, int32_t imm);
+            void cmp32(Mem left, int32_t imm);
+            void cmp8(Mem left, uint8_t imm);
+            void test32(Reg left, Reg right);
+            void setcc(Condition condition, Reg dst);
+
+            // 128-bit unaligned moves through an SSE register (0-15)
+            void movups(uint8_t xmm, Mem src);
+            void movups(Mem dst, uint8_t xmm);
+
+            void jmp(Label target);
+            void jmp(Reg target);
+            void jcc(Condition condition, Label target);
+            void call(Reg target);
+
+        private:
+            void emit8(uint8_t byte) { code.push_back(byte); }
+            void emit32(uint32_t value);
+            void emit64(uint64_t value);
+
+            void rex(bool wide, uint8_t reg, uint8_t index, uint8_t base, bool always = false);
+            void modrm(uint8_t reg, Mem const& mem);
+            void modrm(uint8_t reg, Reg rm);
+
+            // One-byte opcode (or 0x0F-prefixed, if `escape`) with a register and a memory/register operand
+            void op(bool wide, bool escape, uint8_t opcode, uint8_t reg, Mem const& mem);
+            void op(bool wide, bool escape, uint8_t opcode, uint8_t reg, Reg rm);
+
+            // The 0x81/0x83 group with an /ext opcode extension
+            void arith(bool wide, uint8_t ext, Mem const& mem, int32_t imm);
+            void arith(bool wide, uint8_t ext, Reg reg, int32_t imm);
+
+            struct Fixup
+            {
+                size_t position;            // of the 32-bit displacement
+                Label target;
+            };
+
+            std::vector<uint8_t> code;
+            std::vector<int64_t> labels;    // offsets, or -1 while unbound
+            std::vector<Fixup> fixups;
+    };
+}
@@ -0,0 +1,623 @@
+#include <Helium/Config.hpp>
+#include <Helium/Runtime/Hash.hpp>
+#include <Helium/Runtime/ModuleImage.hpp>
+
+#if HELIUM_TRACE_VALUES
+#include <Helium/Runtime/Debug/ValueTrace.hpp>
+#endif
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HELIUM_MODULE_IMAGE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Helium
+{
+    /*
+     * Module image layout (native byte order and alignment; see ModuleImage.hpp)
+     *
+     *   ImageHeader            magic "HEMI", version, the writer's instruction layout and the section table
+     *   code                   Instruction[], exactly as executed
+     *   strings                ImageString[]; the module string pool comes first, followed by the unit name,
+     *                          function names, dependency names and switch case strings
+     *   string data            NUL-terminated text referenced by `strings`
+     *   dependencies           u32[] string indices
+     *   functions              ImageFunction[]
+     *   exception handlers     ImageEh[], referenced by functions
+     *   line entries           LineTable::Entry[], referenced by functions; none without debug information
+     *   switch tables          ImageSwitchTable[]
+     *   switch cases           ImageSwitchCase[], referenced by switch tables
+     *
+     * Every section starts at a multiple of sectionAlignment from the start of the image.
+     */
+    namespace {
+        constexpr char imageMagic[4] {'H', 'E', 'M', 'I'};
+        constexpr uint16_t imageVersion = 2;
+        constexpr uint32_t byteOrderMark = 0x01020304;
+        constexpr size_t sectionAlignment = 16;
+
+        enum {
+            section_code,
+            section_strings,
+            section_stringData,
+            section_dependencies,
+            section_functions,
+            section_exceptionHandlers,
+            section_switchTables,
+            section_switchCases,
+            section_lineEntries,
+            numSections
+        };
+
+        struct ImageSection {
+            uint64_t offset;
+            uint64_t count;         // in elements, not bytes
+        };
+
+        struct ImageHeader {
+            char magic[4];
+            uint16_t version;
+            uint16_t numValidOpcodes;
+            uint32_t instructionSize;
+            uint32_t byteOrderMark;
+            uint32_t numPoolStrings;
+            uint32_t unitName;      // string index; an empty string without debug information
+            ImageSection sections[numSections];
+        };
+
+        struct ImageString {
+            uint64_t offset;
+            uint32_t length;
+            Hash_t hash;
+        };
+
+        struct ImageFunction {
+            uint32_t name;
+            CodeAddr_t start, length;
+            uint32_t numExplicitArguments;
+            uint32_t firstEh, numEh;
+            uint32_t firstLine, numLines;
+            uint8_t exported;
+            uint8_t reserved[3];
+        };
+
+        struct ImageEh {
+            CodeAddr_t start, length, handler;
+        };
+
+        struct ImageSwitchTable {
+            uint32_t firstCase, numCases;
+            CodeAddr_t defaultHandler;
+            uint32_t reserved;
+        };
+
+        struct ImageSwitchCase {
+            uint8_t type;           // ValueType
+            uint8_t reserved[3];
+            CodeAddr_t handler;
+            uint64_t value;         // integer or real bits, boolean, or a string index
+        };
+
+        constexpr size_t elementSizes[numSections] {
+            sizeof(Instruction),
+            sizeof(ImageString),
+            sizeof(char),
+            sizeof(uint32_t),
+            sizeof(ImageFunction),
+            sizeof(ImageEh),
+            sizeof(ImageSwitchTable),
+            sizeof(ImageSwitchCase),
+            sizeof(LineTable::Entry),
+        };
+
+        static_assert(alignof(Instruction) <= sectionAlignment);
+
+        class ImageWriter {
+        public:
+            ImageWriter() : buffer(sizeof(ImageHeader)) {
+            }
+
+            uint32_t addString(const void* text, size_t length) {
+                auto offset = stringData.size();
+                auto bytes = static_cast<const char*>(text);
+
+                stringData.insert(stringData.end(), bytes, bytes + length);
+                stringData.push_back(0);
+
+                strings.push_back(ImageString{offset, static_cast<uint32_t>(length),
+                                              Hash::fromString(bytes, length)});
+                return strings.size() - 1;
+            }
+
+            template <typename Type>
+            void addSection(ImageHeader& header, size_t sectionIndex, std::vector<Type> const& elements) {
+                buffer.resize((buffer.size() + sectionAlignment - 1) / sectionAlignment * sectionAlignment);
+
+                header.sections[sectionIndex] = ImageSection{buffer.size(), elements.size()};
+
+                auto bytes = reinterpret_cast<const std::byte*>(elements.data());
+                buffer.insert(buffer.end(), bytes, bytes + elements.size() * sizeof(Type));
+            }
+
+            std::vector<std::byte> buffer;
+            std::vector<ImageString> strings;
+            std::vector<char> stringData;
+        };
+
+        // Produces the in-memory representation of an instruction, with every byte (including padding) defined
+        std::vector<std::byte> makeImageInstruction(Instruction const& instruction) {
+            std::vector<std::byte> bytes(sizeof(Instruction));
+            auto copy = new(bytes.data()) Instruction();
+
+            copy->opcode = instruction.opcode;
+
+            switch (InstructionDesc::getByOpcode(instruction.opcode)->operandType) {
+                case OperandType::codeAddress: copy->codeAddr = instruction.codeAddr; break;
+                case OperandType::functionIndex: copy->functionIndex = instruction.functionIndex; break;
+                case OperandType::integer:
+                case OperandType::localIndex: copy->integer = instruction.integer; break;
+                case OperandType::none: break;
+                case OperandType::real: copy->realValue = instruction.realValue; break;
+                case OperandType::registers: copy->integer = instruction.integer; break;
+                case OperandType::string: copy->stringIndex = instruction.stringIndex; break;
+                case OperandType::switchTable: copy->switchTableIndex = instruction.switchTableIndex; break;
+            }
+
+            // Instruction is trivially destructible; ending its lifetime explicitly would let the compiler drop the
+            // stores above
+            return bytes;
+        }
+
+        bool isValidSwitchCaseType(uint8_t type) {
+            switch (static_cast<ValueType>(type)) {
+                case ValueType::nil:
+                case ValueType::boolean:
+                case ValueType::integer:
+                case ValueType::real:
+                case ValueType::string:
+                    return true;
+
+                default:
+                    return false;
+            }
+        }
+    }
+
+    ModuleImage::~ModuleImage() {
+#if HELIUM_MODULE_IMAGE_MMAP
+        if (isMapped)
+            munmap(const_cast<std::byte*>(data), size);
+#endif
+    }
+
+    bool ModuleImage::isModuleImage(span<const std::byte> header) {
+        return header.size() >= sizeof(imageMagic) && memcmp(header.data(), imageMagic, sizeof(imageMagic)) == 0;
+    }
+
+    bool ModuleImage::write(Module const& module, WriteCallback const& write) {
+        ImageWriter writer;
+        ImageHeader header {};
+
+        memcpy(header.magic, imageMagic, sizeof(imageMagic));
+        header.version = imageVersion;
+        header.numValidOpcodes = Opcodes::numValidOpcodes;
+        header.instructionSize = sizeof(Instruction);
+        header.byteOrderMark = byteOrderMark;
+        header.numPoolStrings = module.stringPool.size();
+
+        std::vector<std::byte> code;
+        code.reserve(module.code.size() * sizeof(Instruction));
+
+        for (auto instruction : module.code) {
+            if (instruction->opcode >= Opcodes::numValidOpcodes)
+                return false;
+
+            auto bytes = makeImageInstruction(*instruction);
+            code.insert(code.end(), bytes.begin(), bytes.end());
+        }
+
+        for (auto const& string : module.stringPool) {
+            if (string.size() > std::numeric_limits<uint32_t>::max())
+                return false;
+
+            writer.addString(string.data(), string.size());
+        }
+
+        header.unitName = writer.addString(module.unitName.data(), module.unitName.size());
+
+        std::vector<ImageFunction> functions;
+        std::vector<ImageEh> exceptionHandlers;
+        std::vector<LineTable::Entry> lineEntries;
+
+        for (auto const& function : module.functions) {
+            ImageFunction imageFunction {};
+            imageFunction.name = writer.addString(function.name.data(), function.name.size());
+            imageFunction.start = function.start;
+            imageFunction.length = function.length;
+            imageFunction.numExplicitArguments = function.numExplicitArguments;
+            imageFunction.firstEh = exceptionHandlers.size();
+            imageFunction.numEh = function.exceptionHandlers.size();
+            imageFunction.firstLine = lineEntries.size();
+            imageFunction.numLines = function.lineTable.entries.size();
+            imageFunction.exported = function.exported ? 1 : 0;
+            functions.push_back(imageFunction);
+
+            for (auto const& eh : function.exceptionHandlers)
+                exceptionHandlers.push_back(ImageEh{eh.start, eh.length, eh.handler});
+
+            lineEntries.insert(lineEntries.end(), function.lineTable.entries.begin(), function.lineTable.entries.end());
+        }
+
+        std::vector<uint32_t> dependencies;
+
+        for (auto const& dependency : module.dependencies)
+            dependencies.push_back(writer.addString(dependency.data(), dependency.size()));
+
+        std::vector<ImageSwitchTable> switchTables;
+        std::vector<ImageSwitchCase> switchCases;
+
+        for (auto const& switchTable : module.switchTables) {
+            ImageSwitchTable imageSwitchTable {};
+            imageSwitchTable.firstCase = switchCases.size();
+            imageSwitchTable.numCases = switchTable->cases.size();
+            imageSwitchTable.defaultHandler = switchTable->handlers.back();
+            switchTables.push_back(imageSwitchTable);
+
+            for (size_t i = 0; i < switchTable->cases.size(); i++) {
+                Value case_ = switchTable->cases[i];
+
+                if (!isValidSwitchCaseType(static_cast<uint8_t>(case_.type)))
+                    return false;
+
+                ImageSwitchCase imageCase {};
+                imageCase.type = static_cast<uint8_t>(case_.type);
+                imageCase.handler = switchTable->handlers[i];
+
+                switch (case_.type) {
+                    case ValueType::boolean: imageCase.value = case_.booleanValue ? 1 : 0; break;
+                    case ValueType::integer: imageCase.value = static_cast<uint64_t>(case_.integerValue); break;
+                    case ValueType::real: memcpy(&imageCase.value, &case_.realValue, sizeof(imageCase.value)); break;
+                    case ValueType::string: imageCase.value = writer.addString(case_.string->text, case_.length); break;
+                    default: break;
+                }
+
+                switchCases.push_back(imageCase);
+            }
+        }
+
+        writer.addSection(header, section_code, code);
+        header.sections[section_code].count = module.code.size();
+
+        writer.addSection(header, section_strings, writer.strings);
+        writer.addSection(header, section_stringData, writer.stringData);
+        writer.addSection(header, section_dependencies, dependencies);
+        writer.addSection(header, section_functions, functions);
+        writer.addSection(header, section_exceptionHandlers, exceptionHandlers);
+        writer.addSection(header, section_switchTables, switchTables);
+        writer.addSection(header, section_switchCases, switchCases);
+        writer.addSection(header, section_lineEntries, lineEntries);
+
+        memcpy(writer.buffer.data(), &header, sizeof(header));
+
+        return write(span<const std::byte>(writer.buffer)) == writer.buffer.size();
+    }
+
+    std::shared_ptr<ModuleImage> ModuleImage::map(std::filesystem::path const& path) {
+        std::shared_ptr<ModuleImage> image(new ModuleImage());
+
+#if HELIUM_MODULE_IMAGE_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return nullptr;
+
+        struct stat status;
+
+        if (fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(ImageHeader))) {
+            close(fd);
+            return nullptr;
+        }
+
+        // Read-only pages of the same file are shared by every process that maps it
+        auto mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (mapping == MAP_FAILED)
+            return nullptr;
+
+        image->data = static_cast<const std::byte*>(mapping);
+        image->size = status.st_size;
+        image->isMapped = true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+        if (!file)
+            return nullptr;
+
+        image->size = file.tellg();
+        image->buffer.reset(new std::byte[image->size]);
+        image->data = image->buffer.get();
+
+        file.seekg(0);
+
+        if (!file.read(reinterpret_cast<char*>(image->buffer.get()), image->size))
+            return nullptr;
+#endif
+
+        if (!image->validate())
+            return nullptr;
+
+        return image;
+    }
+
+    span<const Instruction> ModuleImage::getInstructions() const {
+        auto header = reinterpret_cast<const ImageHeader*>(data);
+        return span<const Instruction>(getSection<Instruction>(section_code), header->sections[section_code].count);
+    }
+
+    size_t ModuleImage::getNumPoolStrings() const {
+        return reinterpret_cast<const ImageHeader*>(data)->numPoolStrings;
+    }
+
+    VMString ModuleImage::getString(size_t index) const {
+        auto const& string = getSection<ImageString>(section_strings)[index];
+        return VMString{getSection<char>(section_stringData) + string.offset, string.length, string.hash};
+    }
+
+    size_t ModuleImage::getNumDependencies() const {
+        return reinterpret_cast<const ImageHeader*>(data)->sections[section_dependencies].count;
+    }
+
+    std::string_view ModuleImage::getDependency(size_t index) const {
+        auto string = getString(getSection<uint32_t>(section_dependencies)[index]);
+        return std::string_view(string.text, string.length);
+    }
+
+    size_t ModuleImage::getNumFunctions() const {
+        return reinterpret_cast<const ImageHeader*>(data)->sections[section_functions].count;
+    }
+
+    ScriptFunction ModuleImage::getFunction(size_t index) const {
+        auto const& imageFunction = getSection<ImageFunction>(section_functions)[index];
+        auto name = getString(imageFunction.name);
+
+        ScriptFunction function;
+        function.name.assign(name.text, name.length);
+        function.exported = (imageFunction.exported != 0);
+        function.argumentListType = ScriptFunction::ArgumentListType::explicit_;
+        function.numExplicitArguments = imageFunction.numExplicitArguments;
+        function.start = imageFunction.start;
+        function.length = imageFunction.length;
+
+        auto exceptionHandlers = getSection<ImageEh>(section_exceptionHandlers) + imageFunction.firstEh;
+
+        for (size_t i = 0; i < imageFunction.numEh; i++)
+            function.exceptionHandlers.push_back(Eh{exceptionHandlers[i].start, exceptionHandlers[i].length,
+                                                    exceptionHandlers[i].handler});
+
+        auto lineEntries = getSection<LineTable::Entry>(section_lineEntries) + imageFunction.firstLine;
+        function.lineTable.entries.assign(lineEntries, lineEntries + imageFunction.numLines);
+
+        return function;
+    }
+
+    std::string_view ModuleImage::getUnitName() const {
+        auto string = getString(reinterpret_cast<const ImageHeader*>(data)->unitName);
+        return std::string_view(string.text, string.length);
+    }
+
+    size_t ModuleImage::getNumSwitchTables() const {
+        return reinterpret_cast<const ImageHeader*>(data)->sections[section_switchTables].count;
+    }
+
+    std::shared_ptr<SwitchTable> ModuleImage::createSwitchTable(size_t index) const {
+#if HELIUM_TRACE_VALUES
+        ValueTraceCtx tracking_ctx("ModuleImage::createSwitchTable");
+#endif
+
+        auto const& imageSwitchTable = getSection<ImageSwitchTable>(section_switchTables)[index];
+        auto cases = getSection<ImageSwitchCase>(section_switchCases) + imageSwitchTable.firstCase;
+
+        auto switchTable = std::make_shared<SwitchTable>();
+
+        for (size_t i = 0; i < imageSwitchTable.numCases; i++) {
+            auto const& case_ = cases[i];
+
+            switch (static_cast<ValueType>(case_.type)) {
+                case ValueType::boolean:
+                    switchTable->cases.push_back(ValueRef::makeBoolean(case_.value != 0));
+                    break;
+
+                case ValueType::integer:
+                    switchTable->cases.push_back(ValueRef::makeInteger(static_cast<int64_t>(case_.value)));
+                    break;
+
+                case ValueType::real: {
+                    Real_t value;
+                    memcpy(&value, &case_.value, sizeof(value));
+                    switchTable->cases.push_back(ValueRef::makeReal(value));
+                    break;
+                }
+
+                case ValueType::string: {
+                    auto string = getString(case_.value);
+                    switchTable->cases.push_back(ValueRef::makeStringWithLength(string.text, string.length));
+                    break;
+                }
+
+                default:
+                    switchTable->cases.push_back(ValueRef::makeNil());
+                    break;
+            }
+
+            switchTable->handlers.push_back(case_.handler);
+        }
+
+        switchTable->handlers.push_back(imageSwitchTable.defaultHandler);
+        switchTable->classify();
+        return switchTable;
+    }
+
+    template <typename Type>
+    Type const* ModuleImage::getSection(size_t sectionIndex) const {
+        auto header = reinterpret_cast<const ImageHeader*>(data);
+        return reinterpret_cast<Type const*>(data + header->sections[sectionIndex].offset);
+    }
+
+    bool ModuleImage::validate() const {
+        if (size < sizeof(ImageHeader))
+            return false;
+
+        auto header = reinterpret_cast<const ImageHeader*>(data);
+
+        if (memcmp(header->magic, imageMagic, sizeof(imageMagic)) != 0
+                || header->version != imageVersion
+                || header->numValidOpcodes != Opcodes::numValidOpcodes
+                || header->instructionSize != sizeof(Instruction)
+                || header->byteOrderMark != byteOrderMark)
+            return false;
+
+        for (size_t i = 0; i < numSections; i++) {
+            auto const& section = header->sections[i];
+
+            if (section.offset % sectionAlignment != 0 || section.offset > size
+                    || section.count > (size - section.offset) / elementSizes[i])
+                return false;
+        }
+
+        auto count = [header](size_t sectionIndex) { return header->sections[sectionIndex].count; };
+
+        auto numInstructions = count(section_code);
+        auto numStrings = count(section_strings);
+        auto numExceptionHandlers = count(section_exceptionHandlers);
+
+        if (header->numPoolStrings > numStrings || header->unitName >= numStrings)
+            return false;
+
+        auto stringData = getSection<char>(section_stringData);
+        auto strings = getSection<ImageString>(section_strings);
+
+        for (size_t i = 0; i < numStrings; i++) {
+            if (strings[i].offset >= count(section_stringData)
+                    || strings[i].length >= count(section_stringData) - strings[i].offset
+                    || stringData[strings[i].offset + strings[i].length] != 0)
+                return false;
+        }
+
+        auto dependencies = getSection<uint32_t>(section_dependencies);
+
+        for (size_t i = 0; i < count(section_dependencies); i++) {
+            if (dependencies[i] >= numStrings)
+                return false;
+        }
+
+        auto exceptionHandlers = getSection<ImageEh>(section_exceptionHandlers);
+
+        for (size_t i = 0; i < numExceptionHandlers; i++) {
+            auto const& eh = exceptionHandlers[i];
+
+            if (static_cast<size_t>(eh.start) + eh.length > numInstructions || eh.handler > numInstructions)
+                return false;
+        }
+
+        auto functions = getSection<ImageFunction>(section_functions);
+        auto lineEntries = getSection<LineTable::Entry>(section_lineEntries);
+
+        for (size_t i = 0; i < count(section_functions); i++) {
+            auto const& function = functions[i];
+
+            if (function.name >= numStrings
+                    || static_cast<size_t>(function.start) + function.length > numInstructions
+                    || function.numExplicitArguments > LOCALS_MAX
+                    || function.firstEh > numExceptionHandlers
+                    || function.numEh > numExceptionHandlers - function.firstEh
+                    || function.firstLine > count(section_lineEntries)
+                    || function.numLines > count(section_lineEntries) - function.firstLine
+                    || function.exported > 1)
+                return false;
+
+            // Offsets must be strictly increasing and within the function, as LineTable::getLine expects
+            for (size_t j = 0; j < function.numLines; j++) {
+                auto const& entry = lineEntries[function.firstLine + j];
+
+                if (entry.offset >= function.length
+                        || (j > 0 && entry.offset <= lineEntries[function.firstLine + j - 1].offset))
+                    return false;
+            }
+        }
+
+        auto switchTables = getSection<ImageSwitchTable>(section_switchTables);
+
+        for (size_t i = 0; i < count(section_switchTables); i++) {
+            auto const& switchTable = switchTables[i];
+
+            if (switchTable.firstCase > count(section_switchCases)
+                    || switchTable.numCases > count(section_switchCases) - switchTable.firstCase
+                    || switchTable.defaultHandler > numInstructions)
+                return false;
+        }
+
+        auto switchCases = getSection<ImageSwitchCase>(section_switchCases);
+
+        for (size_t i = 0; i < count(section_switchCases); i++) {
+            auto const& case_ = switchCases[i];
+
+            if (!isValidSwitchCaseType(case_.type) || case_.handler > numInstructions)
+                return false;
+
+            if ((static_cast<ValueType>(case_.type) == ValueType::boolean && case_.value > 1)
+                    || (static_cast<ValueType>(case_.type) == ValueType::string && case_.value >= numStrings))
+                return false;
+        }
+
+        for (auto const& instruction : getInstructions()) {
+            if (instruction.opcode >= Opcodes::numValidOpcodes)
+                return false;
+
+            bool valid = true;
+
+            switch (InstructionDesc::getByOpcode(instruction.opcode)->operandType) {
+                case OperandType::codeAddress:
+                    valid = instruction.codeAddr <= numInstructions;
+                    break;
+
+                case OperandType::functionIndex:
+                    valid = instruction.functionIndex < count(section_functions);
+                    break;
+
+                case OperandType::integer:
+                case OperandType::localIndex:
+                    if (instruction.opcode == Opcodes::call_ext)
+                        valid = instruction.integer >= 0
+                                && static_cast<uint64_t>(instruction.integer) < count(section_dependencies);
+                    break;
+
+                case OperandType::none:
+                case OperandType::real:
+                case OperandType::registers:
+                    break;
+
+                case OperandType::string:
+                    valid = instruction.stringIndex < header->numPoolStrings;
+                    break;
+
+                case OperandType::switchTable:
+                    valid = instruction.switchTableIndex < count(section_switchTables);
+                    break;
+            }
+
+            if (!valid)
+                return false;
+        }
+
+        return true;
+    }
+}
@@ -1,16 +1,23 @@
 #include <Helium/Assert.hpp>
 #include <Helium/Config.hpp>
+#include <Helium/Runtime/ModuleImage.hpp>
 #include <Helium/Runtime/NativeListFunctions.hpp>
 #include <Helium/Runtime/RuntimeFunctions.hpp>
 #include <Helium/Runtime/NativeStringFunctions.hpp>
 #include <Helium/Runtime/VM.hpp>
 
+#include <Helium/Runtime/Debug/CpuProfiler.hpp>
 #include <Helium/Runtime/Debug/GcTrace.hpp>
 
+#if HELIUM_OPCODE_STATS
+#include <Helium/Runtime/Debug/OpcodeStats.hpp>
+#endif
+
 #if HELIUM_TRACE_VALUES
 #include <Helium/Runtime/Debug/ValueTrace.hpp>
 #endif
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
@@ -44,6 +51,10 @@ namespace {
     {
         global.reset(Value::newObject( this ));
 
+        // The buffer is cleared (but never shrunk) after each collection, so after this it only grows
+        // when a burst of releases overshoots the threshold between two instructions
+        possibleRoots.reserve(GC_NUM_POSSIBLE_ROOTS_THRESHOLD * 2);
+
         //registerStringFunctions( stringFunctions );
 
         // TODO: we can do better
@@ -56,7 +67,12 @@ namespace {
 
     VM::~VM()
     {
+#if HELIUM_TRACE_VALUES
         ValueTraceCtx tracking_ctx("~VM");
+#endif
+
+        for (auto ctx : activationContexts)
+            ctx->vm = nullptr;
 
         global.reset();
         loadedModules.clear();
@@ -64,6 +80,14 @@ namespace {
         collectGarbage( GarbageCollectReason::vmShutdown );
     }
 
+    void VM::removeActivationContext(ActivationContext* ctx)
+    {
+        auto it = std::find(activationContexts.begin(), activationContexts.end(), ctx);
+        helium_assert_debug(it != activationContexts.end());
+
+        activationContexts.erase(it);
+    }
+
     /*void VM::addCode( size_t module, Instruction** code, size_t length )
     {
         if ( instructions == nullptr )
@@ -82,17 +106,26 @@ namespace {
 
     void VM::collectGarbage(GarbageCollectReason reason)
     {
+#if HELIUM_TRACE_VALUES
         ValueTraceCtx tracking_ctx("VM::collectGarbage");
+#endif
 
         GcTrace::beginCollectGarbage(reason, numInstructionsSinceLastCollect);
 
-        for (size_t i = possibleRoots.size(); i > 0; )
+        auto startTime = std::chrono::steady_clock::now();
+
+        // Mark phase. Roots that are no longer purple get dropped from the buffer; the survivors are compacted
+        // in place, so this is a single linear pass regardless of how many roots change colour.
+        size_t numRemaining = 0;
+
+        for (size_t i = 0; i < possibleRoots.size(); i++)
         {
-            --i;
-            if (possibleRoots[i].gc_mark() )
-                possibleRoots.erase(possibleRoots.begin() + i );
+            if (!possibleRoots[i].gc_mark())
+                possibleRoots[numRemaining++] = possibleRoots[i];
         }
 
+        possibleRoots.erase(possibleRoots.begin() + numRemaining, possibleRoots.end());
+
         for ( auto& var : possibleRoots )
             var.gc_scan();
 
@@ -107,15 +140,110 @@ namespace {
 
         possibleRoots.clear();
 
+        gcStats.numCollections++;
+        gcStats.numValuesCollected += numValuesCollected;
+        gcStats.totalTime += std::chrono::steady_clock::now() - startTime;
+
         GcTrace::endCollectGarbage(numValuesCollected);
+        numInstructionsBeforeLastCollect += numInstructionsSinceLastCollect;
         numInstructionsSinceLastCollect = 0;
     }
+
+    void VM::collectGarbageIfNeeded()
+    {
+        if (possibleRoots.size() > GC_NUM_POSSIBLE_ROOTS_THRESHOLD)
+            collectGarbage( GarbageCollectReason::numPossibleRoots );
+    }
+
+    void VM::setJitEnabled(bool enabled)
+    {
+#if HELIUM_WITH_JIT
+        if (enabled) {
+            if (!jit)
+                jit = std::make_unique<Jit>(this);
+
+            return;
+        }
+#else
+        (void) enabled;
+#endif
+
+        // Frames that are still running go back to the interpreter
+        for (auto ctx : activationContexts) {
+            for (auto& frame : ctx->frames)
+                frame.jitFunction = nullptr;
+        }
+
+        // The counters are kept, so that hot functions get compiled again soon if the JIT is re-enabled
+        for (auto& module : loadedModules) {
+            for (auto& hotness : module->hotness) {
+                hotness.compilationFailed = false;
+                hotness.compiled.reset();
+            }
+        }
+
+        jit.reset();
+    }
+
+    void VM::onFunctionEntered(VMModule& module, Frame& frame)
+    {
+        if (++frame.hotness->numCalls >= jitThreshold && jit)
+            frame.jitFunction = jit->getCode(module, *frame.scriptFunction, *frame.hotness);
+    }
+
+    void VM::onBackEdge(ActivationContext& ctx)
+    {
+        auto& frame = *ctx.frame;
+
+        // Loaded code cannot be rewritten in place (it may well be a read-only mapping), so the JIT is the only tier
+        // to go up to. Its code can be entered at any instruction, hence this is all it takes to replace the frame
+        // on the stack: execution continues in compiled code at the loop header.
+        if (++frame.hotness->numBackEdges >= jitBackEdgeThreshold && jit && !frame.jitFunction)
+            frame.jitFunction = jit->getCode(*ctx.activeModule, *frame.scriptFunction, *frame.hotness);
+    }
 }
 
 #define STRING_OPERAND(next) (ctx.activeModule->strings[next->stringIndex])
 
 namespace Helium
 {
+    // Executes the register form of a binary operator, with the same effect as the stack sequence it replaces.
+    // `apply` returns an undefined value if the operator raised an exception.
+    template <typename Operator>
+    static void executeRegisterForm(Frame& frame, InlineStack<Value>& stack, Instruction const& instruction,
+                                    Operator apply)
+    {
+        auto operands = RegisterOperands::unpack(instruction.integer);
+
+        Value left = frame.getLocal(operands.left);
+        ValueRef constant;
+
+        if (operands.rightIsConstant)
+            constant = ValueRef::makeInteger(operands.right);
+
+        Value right = operands.rightIsConstant ? static_cast<Value>(constant) : frame.getLocal(operands.right);
+
+        ValueRef result = apply(left, right);
+
+        if (result->isUndefined())
+            return;
+
+        if (operands.destination == RegisterOperands::toStack)
+            stack.push(move(result));
+        else
+            frame.setLocal(operands.destination, move(result));
+    }
+
+    static ValueRef compareRegisters(bool (*compare)(Value, Value, bool*), Value left, Value right, bool negate)
+    {
+        bool result;
+
+        if (!compare(left, right, &result))
+            return ValueRef();
+
+        return ValueRef::makeBoolean(result != negate);
+    }
+
 /*    ActivationContext::State VM::run( size_t entry, Variable* result_out )
     {
         ActivationContext ctx(this);
@@ -147,16 +275,33 @@ namespace Helium
             // This includes STRING_OPERAND
             helium_assert( ctx.pc < ctx.activeModule->instructions.size() );
 
-            if (possibleRoots.size() > GC_NUM_POSSIBLE_ROOTS_THRESHOLD)
-                collectGarbage( GarbageCollectReason::numPossibleRoots );
+            collectGarbageIfNeeded();
+
+            if (CpuProfiler::isActive())
+                CpuProfiler::tick(ctx);
+#if HELIUM_WITH_JIT
+            // The profiler samples instructions one at a time, so compiled code is not used while it is active
+            else if (ctx.frame->jitFunction != nullptr) {
+                jit->run(ctx);
+
+                if (ctx.state == ActivationContext::raisedException) {
+                    unwindToExceptionHandler(ctx);
+                    continue;
+                }
+            }
+#endif
 
             auto next = &ctx.activeModule->instructions[ctx.pc++];
 
+#if HELIUM_OPCODE_STATS
+            auto opcodeStartCycles = OpcodeStats::readCycleCounter();
+#endif
+
             switch ( next->opcode )
             {
                 case Opcodes::op_add: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorAdd(left, right);
 
@@ -172,7 +317,7 @@ namespace Helium
             case Opcodes::assert: {
                 auto& expression = STRING_OPERAND(next);
 
-                ValueRef value = ctx.stack.pop();
+                auto value = ctx.stack.popForReading();
                 bool boolValue;
 
                 if (!RuntimeFunctions::asBoolean(value, &boolValue, true))
@@ -191,14 +336,14 @@ namespace Helium
 
                 case Opcodes::call_var:
                 {
-                    ValueRef callable = ctx.stack.pop();
+                    auto callable = ctx.stack.popForReading();
                     ctx.invoke(callable, numArgs);
                     break;
                 }
 
                 // Call External
                 case Opcodes::call_ext: {
-                    ctx.callNativeFunction(externals[next->integer].callback, numArgs);
+                    ctx.callNativeFunction(externals[ctx.activeModule->externalIndices[next->integer]].callback, numArgs);
                     break;
                 }
 
@@ -213,8 +358,8 @@ namespace Helium
                 }
 
                 case Opcodes::op_div: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorDiv(left, right);
 
@@ -224,24 +369,22 @@ namespace Helium
                 }
 
                 case Opcodes::drop:
-                    ctx.stack.pop();
+                    ctx.stack.drop();
                     break;
 
                 case Opcodes::dup: {
-                    Value val = ctx.stack.top();
-                    ctx.stack.push(ValueRef::makeReference(val));
+                    ctx.stack.pushBorrowed(ctx.stack.top());
                     break;
                 }
 
                 case Opcodes::dup1: {
-                    Value val = ctx.stack.getBelowTop(1);
-                    ctx.stack.push(ValueRef::makeReference(val));
+                    ctx.stack.pushBorrowed(ctx.stack.getBelowTop(1));
                     break;
                 }
 
                 case Opcodes::eq: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
                     bool result;
 
                     if (RuntimeFunctions::operatorEquals(left, right, &result))
@@ -250,8 +393,8 @@ namespace Helium
                 }
 
                 case Opcodes::grtr: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
                     bool result;
 
                     if (RuntimeFunctions::operatorGreaterThan(left, right, &result))
@@ -260,8 +403,8 @@ namespace Helium
                 }
 
                 case Opcodes::grtrEq: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
                     bool result;
 
                     // implemented as not-less-than
@@ -272,7 +415,7 @@ namespace Helium
 
                 case Opcodes::invoke:
                 {
-                    ValueRef object = ctx.stack.pop();
+                    auto object = ctx.stack.popForReading();
 
                     auto& methodName = STRING_OPERAND(next);
 
@@ -310,39 +453,54 @@ namespace Helium
                     break;
                 }
 
-                case Opcodes::jmp:
+                case Opcodes::jmp: {
+                    bool backward = next->codeAddr < ctx.pc;
                     ctx.pc = next->codeAddr;
+
+                    if (backward)
+                        onBackEdge(ctx);
                     break;
+                }
 
                 case Opcodes::jmp_true: {
-                    ValueRef value = ctx.stack.pop();
+                    auto value = ctx.stack.popForReading();
                     bool boolValue;
 
                     if (!RuntimeFunctions::asBoolean(value, &boolValue, true))
                         break;
 
-                    if (boolValue)
+                    if (boolValue) {
+                        bool backward = next->codeAddr < ctx.pc;
                         ctx.pc = next->codeAddr;
 
+                        if (backward)
+                            onBackEdge(ctx);
+                    }
+
                     break;
                 }
 
                 case Opcodes::jmp_false: {
-                    ValueRef value = ctx.stack.pop();
+                    auto value = ctx.stack.popForReading();
                     bool boolValue;
 
                     if (!RuntimeFunctions::asBoolean(value, &boolValue, true))
                         break;
 
-                    if (!boolValue)
+                    if (!boolValue) {
+                        bool backward = next->codeAddr < ctx.pc;
                         ctx.pc = next->codeAddr;
 
+                        if (backward)
+                            onBackEdge(ctx);
+                    }
+
                     break;
                 }
 
                 case Opcodes::land: {
-                    ValueRef left = ctx.stack.pop();
-                    ValueRef right = ctx.stack.pop();
+                    auto left = ctx.stack.popForReading();
+                    auto right = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorLogAnd(left, right);
 
@@ -352,8 +510,8 @@ namespace Helium
                 }
 
                 case Opcodes::less: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
                     bool result;
 
                     if (RuntimeFunctions::operatorLessThan(left, right, &result))
@@ -362,8 +520,8 @@ namespace Helium
                 }
 
                 case Opcodes::lessEq: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
                     bool result;
 
                     // implemented as not-greater-than
@@ -393,7 +551,7 @@ namespace Helium
                 }
 
                 case Opcodes::lnot: {
-                    ValueRef left = ctx.stack.pop();
+                    auto left = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorLogNot(left);
 
@@ -403,8 +561,8 @@ namespace Helium
                 }
 
                 case Opcodes::lor: {
-                    ValueRef left = ctx.stack.pop();
-                    ValueRef right = ctx.stack.pop();
+                    auto left = ctx.stack.popForReading();
+                    auto right = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorLogOr(left, right);
 
@@ -416,8 +574,8 @@ namespace Helium
                 //logical( Opcodes::lxor, xor );
 
                 case Opcodes::op_mod: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorMod(left, right);
 
@@ -427,8 +585,8 @@ namespace Helium
                 }
 
                 case Opcodes::op_mul: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorMul(left, right);
 
@@ -438,7 +596,7 @@ namespace Helium
                 }
 
                 case Opcodes::neg: {
-                    ValueRef left = ctx.stack.pop();
+                    auto left = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorNeg(left);
 
@@ -448,8 +606,8 @@ namespace Helium
                 }
 
                 case Opcodes::neq: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
                     bool result;
 
                     if (RuntimeFunctions::operatorEquals(left, right, &result))
@@ -462,10 +620,8 @@ namespace Helium
 
                 case Opcodes::setIndexed:
 				{
-					ValueRef list, index;
-
-                    index = ctx.stack.pop();
-                    list = ctx.stack.pop();
+                    auto index = ctx.stack.popForReading();
+                    auto list = ctx.stack.popForReading();
 
                     RuntimeFunctions::setIndexed(list, index, ctx.stack.pop());
                     break;
@@ -476,9 +632,14 @@ namespace Helium
                     ctx.frame->setLocal( next->integer, ctx.stack.pop() );
                     break;
 
+                case Opcodes::clearLocal:
+                    ctx.stack.takeOwnershipOfTop();
+                    ctx.frame->setLocal( next->integer, ValueRef() );
+                    break;
+
                 case Opcodes::setMember:
                 {
-                    ValueRef object = ctx.stack.pop();
+                    auto object = ctx.stack.popForReading();
                     auto memberName = STRING_OPERAND(next);
 
                     RuntimeFunctions::setMember(object, memberName, ctx.stack.pop());
@@ -516,8 +677,8 @@ namespace Helium
 
                 case Opcodes::getIndexed:
                 {
-                    ValueRef index = ctx.stack.pop();
-                    ValueRef range = ctx.stack.pop();
+                    auto index = ctx.stack.popForReading();
+                    auto range = ctx.stack.popForReading();
 
                     ValueRef item;
 
@@ -528,16 +689,16 @@ namespace Helium
 
                 // Push the Global Object
                 case Opcodes::pushglobal:
-                    ctx.stack.push(global.reference());
+                    ctx.stack.pushBorrowed(global);
                     break;
 
                 case Opcodes::getLocal:
-                    ctx.stack.push( ValueRef::makeReference(ctx.frame->getLocal( next->integer )) );
+                    ctx.stack.pushBorrowed(ctx.frame->getLocal( next->integer ));
                     break;
 
                 case Opcodes::getProperty:
                 {
-                    ValueRef object = ctx.stack.pop();
+                    auto object = ctx.stack.popForReading();
 
                     ValueRef member;
 
@@ -553,7 +714,9 @@ namespace Helium
                     break;
 
                 case Opcodes::ret: {
-                    ctx.frames.pop_back();
+                    // The return value might be borrowed from a local that is about to go away
+                    ctx.stack.takeOwnershipOfTop();
+                    ctx.leaveFunction();
 
                     if ( ctx.frames.empty() ) {
                         ctx.state = ActivationContext::returnedValue;
@@ -568,8 +731,8 @@ namespace Helium
                 }
 
                 case Opcodes::op_sub: {
-                    ValueRef right = ctx.stack.pop();
-                    ValueRef left = ctx.stack.pop();
+                    auto right = ctx.stack.popForReading();
+                    auto left = ctx.stack.popForReading();
 
                     ValueRef result = RuntimeFunctions::operatorSub(left, right);
 
@@ -580,22 +743,11 @@ namespace Helium
 
                 case Opcodes::op_switch:
                 {
-                    ValueRef value = ctx.stack.pop();
-                    size_t i = 0;
-
-                    auto switchTable = ctx.activeModule->switchTables[next->switchTableIndex];
+                    auto value = ctx.stack.popForReading();
+                    auto const& switchTable = *ctx.activeModule->switchTables[next->switchTableIndex];
 
-                    //* Iterate throught the cases, break if we have a match
-                    //* If no corresponding handler is foud, we automatically fall back to the 'else' handler
-                    for ( ; i < switchTable->cases.size(); i++ ) {
-                        bool equals;
-                        helium_assert(RuntimeFunctions::operatorEquals(value, switchTable->cases[i], &equals));
-
-                        if (equals)
-                            break;
-                    }
-
-                    ctx.pc = switchTable->handlers[i];
+                    //* If no corresponding case is found, we automatically fall back to the 'else' handler
+                    ctx.pc = switchTable.handlers[switchTable.findCase(value)];
                     break;
                 }
 
@@ -605,57 +757,129 @@ namespace Helium
                     break;
                 }
 
+                case Opcodes::add_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, RuntimeFunctions::operatorAdd);
+                    break;
+
+                case Opcodes::div_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, RuntimeFunctions::operatorDiv);
+                    break;
+
+                case Opcodes::mod_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, RuntimeFunctions::operatorMod);
+                    break;
+
+                case Opcodes::mul_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, RuntimeFunctions::operatorMul);
+                    break;
+
+                case Opcodes::sub_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, RuntimeFunctions::operatorSub);
+                    break;
+
+                case Opcodes::eq_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, [](Value left, Value right) {
+                        return compareRegisters(RuntimeFunctions::operatorEquals, left, right, false);
+                    });
+                    break;
+
+                case Opcodes::grtr_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, [](Value left, Value right) {
+                        return compareRegisters(RuntimeFunctions::operatorGreaterThan, left, right, false);
+                    });
+                    break;
+
+                case Opcodes::grtrEq_r:
+                    // implemented as not-less-than
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, [](Value left, Value right) {
+                        return compareRegisters(RuntimeFunctions::operatorLessThan, left, right, true);
+                    });
+                    break;
+
+                case Opcodes::less_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, [](Value left, Value right) {
+                        return compareRegisters(RuntimeFunctions::operatorLessThan, left, right, false);
+                    });
+                    break;
+
+                case Opcodes::lessEq_r:
+                    // implemented as not-greater-than
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, [](Value left, Value right) {
+                        return compareRegisters(RuntimeFunctions::operatorGreaterThan, left, right, true);
+                    });
+                    break;
+
+                case Opcodes::neq_r:
+                    executeRegisterForm(*ctx.frame, ctx.stack, *next, [](Value left, Value right) {
+                        return compareRegisters(RuntimeFunctions::operatorEquals, left, right, true);
+                    });
+                    break;
+
                 default:
                     helium_assert(next->opcode != next->opcode);
             }
 
-            numInstructionsSinceLastCollect++;
+#if HELIUM_OPCODE_STATS
+            OpcodeStats::record(next->opcode, OpcodeStats::readCycleCounter() - opcodeStartCycles);
+#endif
 
-            if (ctx.state == ActivationContext::raisedException) {
-                // Pop frames until we find a handler
+            numInstructionsSinceLastCollect++;
 
-                bool found = false;
-                bool frameSwitch = false;
+            if (ctx.state == ActivationContext::raisedException)
+                unwindToExceptionHandler(ctx);
+        }
+    }
 
-                while (!ctx.frames.empty()) {
-                    // Scan the next frame
-                    auto& frame = ctx.frames.back();
+    void VM::unwindToExceptionHandler(ActivationContext& ctx)
+    {
+        // Pop frames until we find a handler
 
-                    // Is a handler active in this frame?
-                    // TODO: optimized lookup
+        bool found = false;
+        bool frameSwitch = false;
 
-                    for (const auto& eh : frame.scriptFunction->exceptionHandlers) {
-                        auto pc = ctx.pc - 1;       // TODO: ok?
+        while (!ctx.frames.empty()) {
+            // Scan the next frame
+            auto& frame = ctx.frames.back();
 
-                        if (pc >= eh.start && pc < eh.start + eh.length) {
-                            ctx.pc = eh.handler;
-                            found = true;
-                            break;
-                        }
-                    }
+            // Is a handler active in this frame?
+            // TODO: optimized lookup
 
-                    if (found)
-                        break;
+            for (const auto& eh : frame.scriptFunction->exceptionHandlers) {
+                auto pc = ctx.pc - 1;       // the instruction that raised, or the call it was raised in
 
-                    // No active handler in this frame - pop it and continue the search
-                    ctx.frames.pop_back();
-                    frameSwitch = true;
+                if (pc >= eh.start && pc < eh.start + eh.length) {
+                    ctx.pc = eh.handler;
+                    found = true;
+                    break;
                 }
+            }
 
-                if (found) {
-                    if (frameSwitch) {
-                        ctx.frame = &ctx.frames.back();
-                        ctx.activeModule = ctx.frame->module;
-                        ctx.activeModuleIndex = ctx.frame->moduleIndex;
-                    }
+            if (found)
+                break;
 
-                    while ( ctx.stack.getHeight() > ctx.frame->stackBase )
-                        ctx.stack.pop();
+            // No active handler in this frame - pop it and continue the search
+            ctx.leaveFunction();
+            frameSwitch = true;
 
-                    ctx.stack.push( move(ctx.exception) );
-                    ctx.resume();
-                }
+            // A caller saved the address after its call, so the handlers around the call itself are found.
+            // Without this, the callee's pc would be matched against the caller's handlers.
+            if (!ctx.frames.empty())
+                ctx.pc = ctx.frames.back().pc;
+        }
+
+        if (found) {
+            if (frameSwitch) {
+                ctx.frame = &ctx.frames.back();
+                ctx.activeModule = ctx.frame->module;
+                ctx.activeModuleIndex = ctx.frame->moduleIndex;
             }
+
+            // Note that borrowed slots of the frames popped above are now dangling, so they must not be read
+            while ( ctx.stack.getHeight() > ctx.frame->stackBase )
+                ctx.stack.drop();
+
+            ctx.stack.push( move(ctx.exception) );
+            ctx.resume();
         }
     }
 
@@ -752,81 +976,135 @@ namespace Helium
         return oldLength;
     }*/
 
+    size_t VM::findExternal(std::string_view name) const
+    {
+        for ( size_t index = 0; index < externals.size(); index++ )
+            if ( externals[index].name == name )
+                return index;
+
+        // FIXME: how to handle this?
+        throw ( "Failed to link external " + std::string(name) ).c_str();
+    }
+
     ModuleIndex_t VM::loadModule(Module* script )
     {
-        std::vector<size_t> externalIndices;
-        externalIndices.resize( script->dependencies.size() );
+        auto module = std::make_unique<VMModule>();
 
         // Check and satisfy any external dependencies.
-        for ( size_t i = 0; i < script->dependencies.size(); i++ )
-        {
-            const auto& name = script->dependencies[i];
+        for ( const auto& name : script->dependencies )
+            module->externalIndices.push_back( findExternal( name ) );
 
-            size_t index;
+        size_t stringMemorySize = 0;
 
-            for ( index = 0; index < externals.size(); index++ )
-                if ( externals[index].name == name )
-                    break;
+        for (const auto& s : script->stringPool)
+            stringMemorySize += s.size() + 1;
 
-            if ( index >= externals.size() )
-                // FIXME: how to handle this?
-                throw ( "Failed to link external " + name ).c_str();
+        module->stringMemory.resize(stringMemorySize);
+        module->strings.reserve(script->stringPool.size());
 
-            externalIndices[i] = index;
+        char* text = module->stringMemory.data();
+
+        for (const auto& s : script->stringPool) {
+            std::copy(s.begin(), s.end(), text);
+            text[s.size()] = 0;
+
+            module->strings.push_back(VMString{text, static_cast<uint32_t>(s.size()),
+                                               Hash::fromString(text, s.size())});
+            text += s.size() + 1;
         }
 
+        // Instructions are trivially copyable; line information stays with the functions
+        module->ownedInstructions.reserve(script->code.size());
+
+        for ( auto instruction : script->code )
+        {
+            module->ownedInstructions.emplace_back(*instruction);
+
+            // FIXME: verify stringIndex
+            // FIXME: verify switchTableIndex
+        }
+
+        module->instructions = module->ownedInstructions;
+        module->functions = script->functions;
+        module->switchTables = script->switchTables;
+        module->unitName = script->unitName;
+        module->hotness.resize(module->functions.size());
+
+        loadedModules.emplace_back(std::move(module));
+        return loadedModules.size() - 1;
+    }
+
+    ModuleIndex_t VM::loadModuleImage(std::shared_ptr<ModuleImage> image)
+    {
         auto module = std::make_unique<VMModule>();
 
-        size_t stringPoolSize = script->stringPool.size() * sizeof(VMString);
+        for ( size_t i = 0; i < image->getNumDependencies(); i++ )
+            module->externalIndices.push_back( findExternal( image->getDependency( i ) ) );
 
-        for (size_t i = 0; i < script->stringPool.size(); i++) {
-            const auto& s = script->stringPool[i];
+        // The text and hashes are precomputed in the image; only the pointers are per-process
+        module->strings.reserve(image->getNumPoolStrings());
 
-            module->stringMemory.resize(stringPoolSize + s.size() + 1);
+        for (size_t i = 0; i < image->getNumPoolStrings(); i++)
+            module->strings.push_back(image->getString(i));
 
-            auto strings = reinterpret_cast<VMString*>(&module->stringMemory[0]);
-            strings[i].text = reinterpret_cast<const char*>(stringPoolSize);
-            strings[i].length = s.size();
-            strings[i].hash = Hash::fromString(reinterpret_cast<const char*>(s.data()), s.size());
+        for (size_t i = 0; i < image->getNumFunctions(); i++)
+            module->functions.push_back(image->getFunction(i));
 
-            memcpy(&module->stringMemory[stringPoolSize], s.data(), s.size());
-            module->stringMemory[stringPoolSize + s.size()] = 0;
-            stringPoolSize += s.size() + 1;
-        }
+        for (size_t i = 0; i < image->getNumSwitchTables(); i++)
+            module->switchTables.push_back(image->createSwitchTable(i));
 
-        module->strings = script->stringPool.size() != 0 ? reinterpret_cast<VMString*>(&module->stringMemory[0]) : nullptr;
+        module->instructions = image->getInstructions();
+        module->unitName = image->getUnitName();
+        module->hotness.resize(module->functions.size());
+        module->image = std::move(image);
 
-        for (size_t i = 0; i < script->stringPool.size(); i++) {
-            module->strings[i].text = reinterpret_cast<const char*>(&module->stringMemory[0]) + reinterpret_cast<size_t>(module->strings[i].text);
-        }
+        loadedModules.emplace_back(std::move(module));
+        return loadedModules.size() - 1;
+    }
 
-        // Use this once Instruction is POD
-        //module->instructions.assign(script->code.begin(), script->code.end());
+    std::vector<VM::FunctionStatsEntry> VM::getFunctionStats() const
+    {
+        std::vector<FunctionStatsEntry> entries;
 
-        module->instructions.resize(script->code.size());
+        for (const auto& [function, stats] : scriptFunctionStats)
+            entries.push_back(FunctionStatsEntry{ function->name, false, stats });
 
-        for ( size_t i = 0; i < module->instructions.size(); i++ )
-        {
-            auto current = &module->instructions[i];
-            new(current) Instruction(*script->code[i]);
+        for (const auto& [callback, stats] : nativeFunctionStats) {
+            std::string name;
 
-            auto op = current->opcode;
+            for (const auto& external : externals) {
+                if (external.callback == callback)
+                    name = external.name;
+            }
 
-            if (op == Opcodes::call_ext)
-                current->integer = externalIndices[current->integer];
-            // TODO: set pointer to VMString
-            //else if (InstructionDesc::getByOpcode(op)->operandType == OperandType::string)
-            //    current->string
+            // Built-in methods don't have a global name
+            for (const auto& [methodName, method] : listMethods) {
+                if (name.empty() && method == callback)
+                    name = "list." + methodName;
+            }
 
-            // FIXME: verify stringIndex
-            // FIXME: verify switchTableIndex
+            for (const auto& [methodName, method] : stringMethods) {
+                if (name.empty() && method == callback)
+                    name = "string." + methodName;
+            }
+
+            if (name.empty())
+                name = "(native)";
+
+            entries.push_back(FunctionStatsEntry{ move(name), true, stats });
         }
 
-        module->functions = script->functions;
-        module->switchTables = script->switchTables;
+        return entries;
+    }
 
-        loadedModules.emplace_back(std::move(module));
-        return loadedModules.size() - 1;
+    void VM::resetFunctionStats()
+    {
+        // Active frames point into the maps, so the entries must stay
+        for (auto& [function, stats] : scriptFunctionStats)
+            stats = FunctionStats{ 0, {}, {}, stats.numActiveCalls };
+
+        for (auto& [callback, stats] : nativeFunctionStats)
+            stats = FunctionStats{ 0, {}, {}, stats.numActiveCalls };
     }
 
     int16_t VM::registerCallback( const char* name, NativeFunction callback )
@@ -1,10 +1,13 @@
 #include <Helium/Assert.hpp>
 #include <Helium/Config.hpp>
+#include <Helium/Memory/PoolAllocator.hpp>
+#include <Helium/Runtime/Debug/AllocationProfiler.hpp>
 #include <Helium/Runtime/RuntimeFunctions.hpp>
 #include <Helium/Runtime/VM.hpp>
 
 #include <cinttypes>
 #include <cstdlib>
+#include <limits>
 
 #if HELIUM_TRACE_VALUES
 #include <Helium/Runtime/Debug/ValueTrace.hpp>
@@ -16,6 +19,64 @@ namespace Helium
 {
     static VarId_t numAllocatedVars = 0, numExistingVars = 0, nextRefId = 0;
 
+    // Most lists and objects are small and short-lived, so their headers and (initial) storage come from pools
+    // instead of the general-purpose heap. Item/member arrays up to the pooled capacity are always allocated
+    // with exactly that capacity, which means `capacity <= POOLED_*_CAPACITY` identifies a pooled array.
+    //
+    // Like the counters above, the pools are shared by all VMs in the process: values handed out by one VM (e.g. the
+    // exception of a script-created VM) routinely outlive it. Values must therefore only be used from one thread at
+    // a time. Chunks of the pools go back to the system as soon as they are entirely free.
+    static constexpr uint32_t POOLED_LIST_CAPACITY = 4;
+    static constexpr unsigned POOLED_OBJECT_CAPACITY = 4;
+
+    static PoolAllocator listInfoPool(sizeof(ListInfo));
+    static PoolAllocator objectInfoPool(sizeof(ObjectInfo));
+    static PoolAllocator listItemsPool(POOLED_LIST_CAPACITY * sizeof(Value));
+    static PoolAllocator objectMembersPool(POOLED_OBJECT_CAPACITY * sizeof(Member));
+
+    template <typename Type>
+    static Type* allocateArray(PoolAllocator& pool, size_t pooledCapacity, size_t capacity) {
+        void* array;
+
+        if (capacity <= pooledCapacity) {
+            array = pool.allocate();
+
+            if (array != nullptr)
+                memset(array, 0, pooledCapacity * sizeof(Type));
+        }
+        else
+            array = calloc(capacity, sizeof(Type));
+
+        return static_cast<Type*>(array);
+    }
+
+    // On failure, returns nullptr and leaves the original array intact
+    template <typename Type>
+    static Type* reallocateArray(PoolAllocator& pool, size_t pooledCapacity, Type* array, size_t oldCapacity,
+                                 size_t newCapacity) {
+        helium_assert_debug(newCapacity > pooledCapacity);
+
+        if (oldCapacity > pooledCapacity)
+            return static_cast<Type*>(realloc(array, newCapacity * sizeof(Type)));
+
+        auto newArray = static_cast<Type*>(malloc(newCapacity * sizeof(Type)));
+
+        if (newArray != nullptr) {
+            memcpy(newArray, array, oldCapacity * sizeof(Type));
+            pool.deallocate(array);
+        }
+
+        return newArray;
+    }
+
+    template <typename Type>
+    static void freeArray(PoolAllocator& pool, size_t pooledCapacity, Type* array, size_t capacity) {
+        if (capacity <= pooledCapacity)
+            pool.deallocate(array);
+        else
+            free(array);
+    }
+
     VMString VMString::fromCString(const char* string) {
         auto len = strlen(string);
         helium_assert(len < std::numeric_limits<uint32_t>::max());
@@ -322,35 +383,45 @@ namespace Helium
         if (preallocSize > std::numeric_limits<uint32_t>::max())
             preallocSize = std::numeric_limits<uint32_t>::max();
 
-        ValueRef var;
-        var->type = ValueType::list;
-        var->list = new ListInfo;
-        var->list->capacity = preallocSize > 0 ? static_cast<uint32_t>(preallocSize) : 1;
-        var->list->length = 0;
-        var->list->items = static_cast<Value*>(calloc(var->list->capacity, sizeof(Value)));
+        auto list = static_cast<ListInfo*>(listInfoPool.allocate());
 
-        var->list->vm = vm;
-        var->list->flags = 0;
-        var->list->numReferences = 1;
+        if ( list == nullptr ) {
+            return newInvalid();
+        }
+
+        list->capacity = preallocSize > POOLED_LIST_CAPACITY ? static_cast<uint32_t>(preallocSize) : POOLED_LIST_CAPACITY;
+        list->length = 0;
+        list->items = allocateArray<Value>(listItemsPool, POOLED_LIST_CAPACITY, list->capacity);
 
-        if ( var->list->items == nullptr ) {
+        list->vm = vm;
+        list->flags = 0;
+        list->numReferences = 1;
+
+        if ( list->items == nullptr ) {
+            listInfoPool.deallocate(list);
             return newInvalid();
         }
 
-        var->register_();
-        return var.detach();
+        AllocationProfiler::recordAllocation(ValueType::list, sizeof(ListInfo) + list->capacity * sizeof(Value));
+
+        Value var;
+        var.type = ValueType::list;
+        var.list = list;
+        var.register_();
+        return var;
 	}
 
     bool Value::listGrow(unsigned minLength) {
         unsigned oldLength = list->capacity;
+        uint32_t newCapacity = minLength + minLength / 2 + 1;
 
-        list->capacity = minLength + minLength / 2 + 1;
-        auto newItems = static_cast<Value*>(realloc(list->items, list->capacity * sizeof(Value)));
+        auto newItems = reallocateArray<Value>(listItemsPool, POOLED_LIST_CAPACITY, list->items, oldLength, newCapacity);
 
         if ( newItems == nullptr ) {
             return false;
         }
 
+        list->capacity = newCapacity;
         list->items = newItems;
         memset( list->items + oldLength, 0, ( list->capacity - oldLength ) * sizeof( Value ) );
         return true;
@@ -374,10 +445,10 @@ namespace Helium
             if ( list->items[index].type != ValueType::list && list->items[index].type != ValueType::object )
                 list->items[index].release();
 
-        free( list->items );
+        freeArray<Value>(listItemsPool, POOLED_LIST_CAPACITY, list->items, list->capacity);
 
         unregister();
-        delete list;
+        listInfoPool.deallocate(list);
     }
 
     bool Value::listAddItem(Value valueRef) {
@@ -421,26 +492,35 @@ namespace Helium
 
     Value Value::newObject( VM* vm )
     {
-        ValueRef var;
-        var->type = ValueType::object;
-        var->object = new ObjectInfo;
-        ( var->object )->capacity = 4;
-        ( var->object )->numMembers = 0;
-        ( var->object )->members = static_cast<Member*>(calloc(var->object->capacity, sizeof(Member)));
+        auto object = static_cast<ObjectInfo*>(objectInfoPool.allocate());
+
+        if ( object == nullptr ) {
+            return newInvalid();
+        }
+
+        object->capacity = POOLED_OBJECT_CAPACITY;
+        object->numMembers = 0;
+        object->members = allocateArray<Member>(objectMembersPool, POOLED_OBJECT_CAPACITY, object->capacity);
 
-        ( var->object )->clone = 0;
-        ( var->object )->finalize = 0;
+        object->clone = 0;
+        object->finalize = 0;
 
-        var->object->vm = vm;
-        var->object->flags = 0;
-        var->object->numReferences = 1;
+        object->vm = vm;
+        object->flags = 0;
+        object->numReferences = 1;
 
-        if ( var->object->members == nullptr ) {
+        if ( object->members == nullptr ) {
+            objectInfoPool.deallocate(object);
             return newInvalid();
         }
 
-        var->register_();
-        return var.detach();
+        AllocationProfiler::recordAllocation(ValueType::object, sizeof(ObjectInfo) + object->capacity * sizeof(Member));
+
+        Value var;
+        var.type = ValueType::object;
+        var.object = object;
+        var.register_();
+        return var;
     }
 
     Value Value::replicateObject() const
@@ -488,10 +568,10 @@ namespace Helium
         for ( unsigned i = 0; i < object->numMembers; i++ )
             free( object->members[i].key );
 
-        free( object->members );
+        freeArray<Member>(objectMembersPool, POOLED_OBJECT_CAPACITY, object->members, object->capacity);
 
         unregister();
-        delete object;
+        objectInfoPool.deallocate(object);
 
         object = reinterpret_cast<ObjectInfo*>(0xcccccccc);
     }
@@ -537,15 +617,18 @@ namespace Helium
                 // Oops, we need more memory!
 
                 long oldLength = object->capacity;
-                object->capacity *= 2;
-                object->members = static_cast<Member*>(realloc(object->members, object->capacity * sizeof(Member)));
+                auto newMembers = reallocateArray<Member>(objectMembersPool, POOLED_OBJECT_CAPACITY, object->members,
+                                                          object->capacity, object->capacity * 2);
 
-                if ( !object->members )
+                if ( !newMembers )
                 {
                     valueRef.release();
                     return ObjectSetPropertyResult::memoryError;
                 }
 
+                object->capacity *= 2;
+                object->members = newMembers;
+
                 memset( object->members + oldLength, 0, ( object->capacity - oldLength ) * sizeof( Member ) );
             }
 
@@ -599,6 +682,9 @@ namespace Helium
         var.string->numReferences = 1;
         var.string->text[var.length] = 0;
 
+        // Also covers appendString
+        AllocationProfiler::recordAllocation(ValueType::string, sizeof(unsigned) + var.length + 1);
+
         var.register_();
         return var;
     }
@@ -757,6 +843,15 @@ namespace Helium
         return numExistingVars;
     }
 
+    VarId_t* Value::getNumExistingValuesCounter() {
+        return &numExistingVars;
+    }
+
+    size_t Value::getPoolMemoryUsage() {
+        return listInfoPool.getMemoryUsageInclOverhead() + objectInfoPool.getMemoryUsageInclOverhead()
+                + listItemsPool.getMemoryUsageInclOverhead() + objectMembersPool.getMemoryUsageInclOverhead();
+    }
+
     std::string_view to_string(ValueType t) {
         switch (t) {
         case ValueType::boolean: return "boolean";
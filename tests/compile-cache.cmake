@@ -0,0 +1,79 @@
+# Runs HeliumExe with --compile-cache and checks the entries it leaves behind.
+# Usage: cmake -DHELIUM=<HeliumExe> -DWORK_DIR=<scratch directory> -P compile-cache.cmake
+
+set(CACHE_DIR ${WORK_DIR}/cache)
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(WRITE ${WORK_DIR}/program.he "print('program');\n")
+file(WRITE ${WORK_DIR}/other.he "print('other');\n")
+
+# Runs program.he with the cache and the given extra options, and checks what it printed
+function(run_cached expected_output)
+    execute_process(COMMAND ${HELIUM} -s --compile-cache=${CACHE_DIR} ${ARGN} program.he
+                    WORKING_DIRECTORY ${WORK_DIR}
+                    RESULT_VARIABLE result
+                    OUTPUT_VARIABLE output)
+
+    if(NOT result EQUAL 0 OR NOT output STREQUAL "${expected_output}\n")
+        message(FATAL_ERROR "program.he ${ARGN}: expected '${expected_output}', got '${output}' (exit code ${result})")
+    endif()
+endfunction()
+
+function(expect_entries count)
+    file(GLOB entries ${CACHE_DIR}/*)
+    list(LENGTH entries actual)
+
+    if(NOT actual EQUAL count)
+        message(FATAL_ERROR "Expected ${count} cache entries, found: ${entries}")
+    endif()
+endfunction()
+
+# Checks that `entry` holds a complete binary module again
+function(expect_valid_entry entry)
+    file(READ ${entry} contents HEX)
+    string(SUBSTRING "${contents}" 0 8 magic)
+    string(LENGTH "${contents}" length)
+
+    # Helium_object_magic, little-endian
+    if(NOT magic STREQUAL "31713713" OR length LESS 32)
+        message(FATAL_ERROR "${entry} was not overwritten with a valid module")
+    endif()
+endfunction()
+
+# A miss compiles the program and stores it
+run_cached(program)
+expect_entries(1)
+file(GLOB entry ${CACHE_DIR}/*.hem)
+
+# A hit runs whatever module is stored for the source, without compiling it
+execute_process(COMMAND ${HELIUM} -s -c -o${entry} other.he WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE result)
+
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Failed to compile other.he")
+endif()
+
+run_cached(other)
+expect_entries(1)
+
+# Optimization and debug information are part of the key
+run_cached(program -O0)
+expect_entries(2)
+run_cached(program -g0)
+expect_entries(3)
+run_cached(program -O0 -g0)
+expect_entries(4)
+run_cached(program -O0)
+expect_entries(4)
+
+# Corrupt and truncated entries are misses, and get overwritten
+file(WRITE ${entry} "not a module")
+run_cached(program)
+expect_valid_entry(${entry})
+
+string(ASCII 49 113 55 19 truncated)
+file(WRITE ${entry} "${truncated}")
+run_cached(program)
+expect_valid_entry(${entry})
+
+expect_entries(4)